@@ -33,7 +33,8 @@ struct PrivateSpace {
 		uint16_t Height, Width;
 	} Offset;
 	uint8_t MADCtl, PageSize;
-	uint8_t Model;
+	uint8_t Model, Bank;
+	uint16_t BankSize;
 };
 
 // Functions are not declared to minimize # of lines
@@ -54,52 +55,77 @@ static void SetRowAddress( struct GDS_Device* Device, uint16_t Start, uint16_t E
 	Device->WriteData( Device, (uint8_t*) &Addr, 4 );
 }
 
+static uint8_t* GetBank( struct GDS_Device* Device ) {
+	struct PrivateSpace *Private = (struct PrivateSpace*) Device->Private;
+	uint8_t *Bank = Private->iRAM + Private->Bank * Private->BankSize;
+	// bank can't be refilled before what was queued from it has been sent
+	if (Device->WaitData) Device->WaitData( Device, Bank, Private->BankSize );
+	return Bank;
+}
+
+static void SendBank( struct GDS_Device* Device, uint8_t *Bank, size_t Length ) {
+	struct PrivateSpace *Private = (struct PrivateSpace*) Device->Private;
+	// queue transfer and swap bank so that next one is prepared while this one is sent
+	if (Device->WriteDataAsync) {
+		Device->WriteDataAsync( Device, Bank, Length );
+		Private->Bank ^= 1;
+	} else {
+		Device->WriteData( Device, Bank, Length );
+	}	
+}
+
 static void Update16( struct GDS_Device* Device ) {
 	struct PrivateSpace *Private = (struct PrivateSpace*) Device->Private;
 		
 #ifdef SHADOW_BUFFER
-	uint32_t *optr = (uint32_t*) Private->Shadowbuffer, *iptr = (uint32_t*) Device->Framebuffer;
+	struct GDS_Area Full = { 0, 0, Device->Width - 1, Device->Height - 1 }, *Area = Device->DamageCount ? Device->Damage : &Full;
 	int FirstCol = Device->Width / 2, LastCol = 0, FirstRow = -1, LastRow = 0;  
 	
-	for (int r = 0; r < Device->Height; r++) {
-		// look for change and update shadow (cheap optimization = width is always a multiple of 2)
-		for (int c = 0; c < Device->Width / 2; c++, iptr++, optr++) {
-			if (*optr != *iptr) {
-				*optr = *iptr;
-				if (c < FirstCol) FirstCol = c;	
-				if (c > LastCol) LastCol = c;
-				if (FirstRow < 0) FirstRow = r;
-				LastRow = r;
+	// only scan damaged areas, whole screen if none has been recorded
+	for (int n = Device->DamageCount ? Device->DamageCount : 1; --n >= 0; Area++) {
+		for (int r = Area->y1; r <= Area->y2; r++) {
+			uint32_t *optr = (uint32_t*) Private->Shadowbuffer + r * Device->Width / 2, *iptr = (uint32_t*) Device->Framebuffer + r * Device->Width / 2;
+
+			// look for change and update shadow (cheap optimization = width is always a multiple of 2)
+			for (int c = Area->x1 / 2; c <= Area->x2 / 2; c++) {
+				if (optr[c] != iptr[c]) {
+					optr[c] = iptr[c];
+					if (c < FirstCol) FirstCol = c;	
+					if (c > LastCol) LastCol = c;
+					if (FirstRow < 0) FirstRow = r;
+					LastRow = r;
+				}
 			}
-		}
 
-		// wait for a large enough window - careful that window size might increase by more than a line at once !
-		if (FirstRow < 0 || ((LastCol - FirstCol + 1) * (r - FirstRow + 1) * 4 < PAGE_BLOCK && r != Device->Height - 1)) continue;
+			// wait for a large enough window - careful that window size might increase by more than a line at once !
+			if (FirstRow < 0 || ((LastCol - FirstCol + 1) * (r - FirstRow + 1) * 4 < PAGE_BLOCK && r != Area->y2)) continue;
 		
-		FirstCol *= 2;
-		LastCol = LastCol * 2 + 1;
-		SetRowAddress( Device, FirstRow + Private->Offset.Height, LastRow + Private->Offset.Height);
-		SetColumnAddress( Device, FirstCol + Private->Offset.Width, LastCol + Private->Offset.Width );
-		Device->WriteCommand( Device, ENABLE_WRITE );
+			FirstCol *= 2;
+			LastCol = LastCol * 2 + 1;
+			SetRowAddress( Device, FirstRow + Private->Offset.Height, LastRow + Private->Offset.Height);
+			SetColumnAddress( Device, FirstCol + Private->Offset.Width, LastCol + Private->Offset.Width );
+			Device->WriteCommand( Device, ENABLE_WRITE );
 			
-		int ChunkSize = (LastCol - FirstCol + 1) * 2;
+			int ChunkSize = (LastCol - FirstCol + 1) * 2;
 			
-		// own use of IRAM has not proven to be much better than letting SPI do its copy
-		if (Private->iRAM) {
-			uint8_t *optr = Private->iRAM;
-			for (int i = FirstRow; i <= LastRow; i++) {
-				memcpy(optr, Private->Shadowbuffer + (i * Device->Width + FirstCol) * 2, ChunkSize);
-				optr += ChunkSize;
-				if (optr - Private->iRAM <= (PAGE_BLOCK - ChunkSize) && i < LastRow) continue;
-				Device->WriteData(Device, Private->iRAM, optr - Private->iRAM);
-				optr = Private->iRAM;
-			}
-		} else for (int i = FirstRow; i <= LastRow; i++) {
-			Device->WriteData( Device, Private->Shadowbuffer + (i * Device->Width + FirstCol) * 2, ChunkSize );
-		}	
+			// own use of IRAM has not proven to be much better than letting SPI do its copy
+			if (Private->iRAM) {
+				uint8_t *iRAM = NULL, *optr = NULL;
+				for (int i = FirstRow; i <= LastRow; i++) {
+					if (!optr) optr = iRAM = GetBank( Device );
+					memcpy(optr, Private->Shadowbuffer + (i * Device->Width + FirstCol) * 2, ChunkSize);
+					optr += ChunkSize;
+					if (optr - iRAM <= (PAGE_BLOCK - ChunkSize) && i < LastRow) continue;
+					SendBank( Device, iRAM, optr - iRAM );
+					optr = NULL;
+				}
+			} else for (int i = FirstRow; i <= LastRow; i++) {
+				Device->WriteData( Device, Private->Shadowbuffer + (i * Device->Width + FirstCol) * 2, ChunkSize );
+			}	
 
-		FirstCol = Device->Width / 2; LastCol = 0;
-		FirstRow = -1;
+			FirstCol = Device->Width / 2; LastCol = 0;
+			FirstRow = -1;
+		}
 	}	
 #else
 	// always update by full lines
@@ -112,8 +138,9 @@ static void Update16( struct GDS_Device* Device ) {
 		Device->WriteCommand(Device, ENABLE_WRITE);
 		
 		if (Private->iRAM) {
-			memcpy(Private->iRAM, Device->Framebuffer + r * Device->Width * 2, Height * Device->Width * 2 );
-			Device->WriteData( Device, Private->iRAM, Height * Device->Width * 2 );
+			uint8_t *iRAM = GetBank( Device );
+			memcpy(iRAM, Device->Framebuffer + r * Device->Width * 2, Height * Device->Width * 2 );
+			SendBank( Device, iRAM, Height * Device->Width * 2 );
 		} else	{
 			Device->WriteData( Device, Device->Framebuffer + r * Device->Width * 2, Height * Device->Width * 2 );
 		}	
@@ -125,48 +152,54 @@ static void Update24( struct GDS_Device* Device ) {
 	struct PrivateSpace *Private = (struct PrivateSpace*) Device->Private;
 		
 #ifdef SHADOW_BUFFER
-	uint16_t *optr = (uint16_t*) Private->Shadowbuffer, *iptr = (uint16_t*) Device->Framebuffer;
+	struct GDS_Area Full = { 0, 0, Device->Width - 1, Device->Height - 1 }, *Area = Device->DamageCount ? Device->Damage : &Full;
 	int FirstCol = (Device->Width * 3) / 2, LastCol = 0, FirstRow = -1, LastRow = 0;  
 	
-	for (int r = 0; r < Device->Height; r++) {
-		// look for change and update shadow (cheap optimization = width always / by 2)
-		for (int c = 0; c < (Device->Width * 3) / 2; c++, optr++, iptr++) {
-			if (*optr != *iptr) {
-				*optr = *iptr;
-				if (c < FirstCol) FirstCol = c;	
-				if (c > LastCol) LastCol = c;
-				if (FirstRow < 0) FirstRow = r;
-				LastRow = r;
+	// only scan damaged areas, whole screen if none has been recorded
+	for (int n = Device->DamageCount ? Device->DamageCount : 1; --n >= 0; Area++) {
+		for (int r = Area->y1; r <= Area->y2; r++) {
+			uint16_t *optr = (uint16_t*) Private->Shadowbuffer + r * (Device->Width * 3) / 2, *iptr = (uint16_t*) Device->Framebuffer + r * (Device->Width * 3) / 2;
+
+			// look for change and update shadow (cheap optimization = width always / by 2)
+			for (int c = (Area->x1 * 3) / 2; c <= (Area->x2 * 3 + 2) / 2; c++) {
+				if (optr[c] != iptr[c]) {
+					optr[c] = iptr[c];
+					if (c < FirstCol) FirstCol = c;	
+					if (c > LastCol) LastCol = c;
+					if (FirstRow < 0) FirstRow = r;
+					LastRow = r;
+				}
 			}
-		}
 		
-		// do we have enough to send (cols are divided by 3/2)
-		if (FirstRow < 0 || ((((LastCol - FirstCol + 1) * 2 + 3 - 1) / 3) * (r - FirstRow + 1) * 3 < PAGE_BLOCK && r != Device->Height - 1)) continue;
+			// do we have enough to send (cols are divided by 3/2)
+			if (FirstRow < 0 || ((((LastCol - FirstCol + 1) * 2 + 3 - 1) / 3) * (r - FirstRow + 1) * 3 < PAGE_BLOCK && r != Area->y2)) continue;
 		
-		FirstCol = (FirstCol * 2) / 3;
-		LastCol = (LastCol * 2 + 1) / 3; 
-		SetRowAddress( Device, FirstRow + Private->Offset.Height, LastRow + Private->Offset.Height);
-		SetColumnAddress( Device, FirstCol + Private->Offset.Width, LastCol + Private->Offset.Width );
-		Device->WriteCommand( Device, ENABLE_WRITE );
+			FirstCol = (FirstCol * 2) / 3;
+			LastCol = (LastCol * 2 + 1) / 3; 
+			SetRowAddress( Device, FirstRow + Private->Offset.Height, LastRow + Private->Offset.Height);
+			SetColumnAddress( Device, FirstCol + Private->Offset.Width, LastCol + Private->Offset.Width );
+			Device->WriteCommand( Device, ENABLE_WRITE );
 			
-		int ChunkSize = (LastCol - FirstCol + 1) * 3;
+			int ChunkSize = (LastCol - FirstCol + 1) * 3;
 					
-		// own use of IRAM has not proven to be much better than letting SPI do its copy
-		if (Private->iRAM) {
-			uint8_t *optr = Private->iRAM;
-			for (int i = FirstRow; i <= LastRow; i++) {
-				memcpy(optr, Private->Shadowbuffer + (i * Device->Width + FirstCol) * 3, ChunkSize);
-				optr += ChunkSize;
-				if (optr - Private->iRAM <= (PAGE_BLOCK - ChunkSize) && i < LastRow) continue;
-				Device->WriteData(Device, Private->iRAM, optr - Private->iRAM);
-				optr = Private->iRAM;
+			// own use of IRAM has not proven to be much better than letting SPI do its copy
+			if (Private->iRAM) {
+				uint8_t *iRAM = NULL, *optr = NULL;
+				for (int i = FirstRow; i <= LastRow; i++) {
+					if (!optr) optr = iRAM = GetBank( Device );
+					memcpy(optr, Private->Shadowbuffer + (i * Device->Width + FirstCol) * 3, ChunkSize);
+					optr += ChunkSize;
+					if (optr - iRAM <= (PAGE_BLOCK - ChunkSize) && i < LastRow) continue;
+					SendBank( Device, iRAM, optr - iRAM );
+					optr = NULL;
+				}	
+			} else for (int i = FirstRow; i <= LastRow; i++) {
+				Device->WriteData( Device, Private->Shadowbuffer + (i * Device->Width + FirstCol) * 3, ChunkSize );
 			}	
-		} else for (int i = FirstRow; i <= LastRow; i++) {
-			Device->WriteData( Device, Private->Shadowbuffer + (i * Device->Width + FirstCol) * 3, ChunkSize );
-		}	
 
-		FirstCol = (Device->Width * 3) / 2; LastCol = 0;
-		FirstRow = -1;
+			FirstCol = (Device->Width * 3) / 2; LastCol = 0;
+			FirstRow = -1;
+		}
 	}	
 #else
 	// always update by full lines
@@ -179,8 +212,9 @@ static void Update24( struct GDS_Device* Device ) {
 		Device->WriteCommand(Device, ENABLE_WRITE);
 		
 		if (Private->iRAM) {
-			memcpy(Private->iRAM, Device->Framebuffer + r * Device->Width * 3, Height * Device->Width * 3 );
-			Device->WriteData( Device, Private->iRAM, Height * Device->Width * 3 );
+			uint8_t *iRAM = GetBank( Device );
+			memcpy(iRAM, Device->Framebuffer + r * Device->Width * 3, Height * Device->Width * 3 );
+			SendBank( Device, iRAM, Height * Device->Width * 3 );
 		} else	{
 			Device->WriteData( Device, Device->Framebuffer + r * Device->Width * 3, Height * Device->Width * 3 );
 		}	
@@ -236,7 +270,9 @@ static bool Init( struct GDS_Device* Device ) {
 	memset(Private->Shadowbuffer, 0xFF, Device->FramebufferSize);
 #endif
 #ifdef USE_IRAM
-	Private->iRAM = heap_caps_malloc( (Private->PageSize + 1) * Device->Width * Depth, MALLOC_CAP_INTERNAL | MALLOC_CAP_DMA );
+	// with queued transfers, one bank is filled while the other is sent
+	Private->BankSize = (Private->PageSize + 1) * Device->Width * Depth;
+	Private->iRAM = heap_caps_malloc( Private->BankSize * (Device->WriteDataAsync ? 2 : 1), MALLOC_CAP_INTERNAL | MALLOC_CAP_DMA );
 #endif
 
 	ESP_LOGI(TAG, "ST77xx with bit depth %u, offsets %hu:%hu, page %u, iRAM %p", Device->Depth, Private->Offset.Height, Private->Offset.Width, Private->PageSize, Private->iRAM);
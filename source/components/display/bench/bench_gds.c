@@ -0,0 +1,312 @@
+/* 
+ *  GDS host benchmark
+ *
+ *  Drives an emulated ST7789 panel through the GDS core and counts what is pushed 
+ *  on the bus per update. The panel content is checked against the framebuffer 
+ *  after every update. Transfers are queued like the SPI interface does, so
+ *  bounce buffers reused too early would show up as a mismatch. Sprite blits are
+ *  also checked against direct drawing for all framebuffer formats.
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "gds.h"
+#include "gds_private.h"
+#include "gds_draw.h"
+
+#define WIDTH		320
+#define HEIGHT		240
+#define UPDATES		200
+#define SPI_QUEUE_SIZE	8
+
+struct GDS_Device* ST77xx_Detect(char *Driver, struct GDS_Device* Device);
+
+static struct GDS_Device Device;
+
+static struct {
+	uint8_t Command;
+	uint16_t Col[2], Row[2];
+	uint16_t X, Y;
+	uint8_t Pixels[WIDTH * HEIGHT * 2];
+	uint64_t Bytes, PixelBytes;
+} Panel;
+
+/****************************************************************************************
+ * Emulated panel, only what ST77xx uses for updates
+ */
+static void Process( uint8_t Command, const uint8_t* Data, size_t DataLength ) {
+	if (!Data) {
+		Panel.Command = Command;
+		Panel.Bytes++;
+		if (Command == 0x2c) {
+			Panel.X = Panel.Col[0];
+			Panel.Y = Panel.Row[0];
+		}
+		return;
+	}
+
+	Panel.Bytes += DataLength;
+	
+	if (Panel.Command == 0x2a || Panel.Command == 0x2b) {
+		uint16_t *Range = Panel.Command == 0x2a ? Panel.Col : Panel.Row;
+		Range[0] = (Data[0] << 8) | Data[1];
+		Range[1] = (Data[2] << 8) | Data[3];
+	} else if (Panel.Command == 0x2c) {
+		Panel.PixelBytes += DataLength;
+		for (size_t i = 0; i + 1 < DataLength; i += 2) {
+			memcpy(Panel.Pixels + (Panel.Y * WIDTH + Panel.X) * 2, Data + i, 2);
+			if (++Panel.X > Panel.Col[1]) {
+				Panel.X = Panel.Col[0];
+				Panel.Y++;
+			}
+		}
+	}
+}
+
+/****************************************************************************************
+ * Emulated SPI queue, like default_if_spi: data is only read when transaction is "sent"
+ * so a bank refilled too early shows up as a panel/framebuffer mismatch
+ */
+static struct {
+	struct {
+		uint8_t Command, Small[4];
+		const uint8_t *Data;
+		size_t DataLength;
+	} Transactions[SPI_QUEUE_SIZE];
+	int Head, Pending;
+	uint64_t Async;
+} Queue;
+
+static void Send( int Count ) {
+	while (Count-- > 0) {
+		int Tail = (Queue.Head + SPI_QUEUE_SIZE - Queue.Pending--) % SPI_QUEUE_SIZE;
+		Process( Queue.Transactions[Tail].Command, Queue.Transactions[Tail].Data, Queue.Transactions[Tail].DataLength );
+	}	
+}
+
+static void Push( uint8_t Command, const uint8_t* Data, size_t DataLength ) {
+	if (Queue.Pending == SPI_QUEUE_SIZE) Send( 1 );
+	Queue.Transactions[Queue.Head].Command = Command;
+	Queue.Transactions[Queue.Head].DataLength = DataLength;
+	if (Data && DataLength <= 4) {
+		memcpy( Queue.Transactions[Queue.Head].Small, Data, DataLength );
+		Data = Queue.Transactions[Queue.Head].Small;
+	}
+	Queue.Transactions[Queue.Head].Data = Data;
+	Queue.Head = (Queue.Head + 1) % SPI_QUEUE_SIZE;
+	Queue.Pending++;
+}
+
+static bool WriteCommand( struct GDS_Device* Device, uint8_t Command ) {
+	Push( Command, NULL, 0 );
+	return true;
+}
+
+static bool WriteData( struct GDS_Device* Device, const uint8_t* Data, size_t DataLength ) {
+	Push( 0, Data, DataLength );
+	if (DataLength > 4) Send( Queue.Pending );
+	return true;
+}
+
+static bool WriteDataAsync( struct GDS_Device* Device, const uint8_t* Data, size_t DataLength ) {
+	Push( 0, Data, DataLength );
+	Queue.Async++;
+	return true;
+}
+
+static void WaitData( struct GDS_Device* Device, const uint8_t* Data, size_t DataLength ) {
+	int Count = 0;
+	for (int i = 1; i <= Queue.Pending; i++) {
+		int n = (Queue.Head + SPI_QUEUE_SIZE - Queue.Pending + i - 1) % SPI_QUEUE_SIZE;
+		const uint8_t *Buffer = Queue.Transactions[n].Data;
+		if (!Data || (Buffer && Queue.Transactions[n].DataLength > 4 && Buffer < Data + DataLength && Buffer + Queue.Transactions[n].DataLength > Data)) Count = i;
+	}
+	Send( Count );
+}
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/****************************************************************************************
+ * Visualizer-like drawing: clear a strip then draw bars of random height
+ */
+static void draw_bars( int Row, int Height, uint32_t *Seed ) {
+	GDS_ClearExt( &Device, false, false, 0, Row, -1, Row + Height - 1 );
+	for (int i = 0; i < 48; i++) {
+		*Seed = *Seed * 1664525 + 1013904223;
+		int Level = (*Seed >> 16) % Height;
+		int x = 4 + i * 6;
+		for (int j = 0; j <= Level; j += 2) GDS_DrawLine( &Device, x, Row + Height - 1 - j, x + 4, Row + Height - 1 - j, GDS_COLOR_WHITE );
+	}
+}
+
+static void draw_box( int Row, int Height, uint32_t *Seed ) {
+	*Seed = *Seed * 1664525 + 1013904223;
+	int Fill = (*Seed >> 16) % (WIDTH - 40);
+	GDS_DrawBox( &Device, 20, Row, 20 + Fill, Row + Height - 1, GDS_COLOR_WHITE, true );
+	GDS_DrawBox( &Device, 21 + Fill, Row, WIDTH - 20, Row + Height - 1, GDS_COLOR_BLACK, true );
+}
+
+static void run( const char *Name, void (*Draw)( int, int, uint32_t* ), int Row, int Height, bool Whole ) {
+	uint32_t Seed = 0x1234567;
+	uint64_t Bytes = Panel.Bytes, PixelBytes = Panel.PixelBytes, Async = Queue.Async, Elapsed = 0;
+	int Errors = 0;
+	
+	for (int n = 0; n < UPDATES; n++) {
+		Draw( Row, Height, &Seed );
+		// what we had before damage tracking: scan all framebuffer
+		if (Whole) Device.DamageCount = 0;
+		uint64_t Start = now_ns();
+		GDS_Update( &Device );
+		Elapsed += now_ns() - Start;
+		WaitData( &Device, NULL, 0 );
+		if (memcmp(Panel.Pixels, Device.Framebuffer, sizeof(Panel.Pixels))) Errors++;
+	}
+	
+	if (Errors) fprintf(stderr, "%s: panel differs from framebuffer after %d updates\n", Name, Errors);
+	printf("%s,%s,%d,%.0f,%.0f,%.1f,%.0f\n", Name, Whole ? "whole" : "damage", UPDATES, 
+			(double) (Panel.Bytes - Bytes) / UPDATES, (double) (Panel.PixelBytes - PixelBytes) / UPDATES, 
+			(double) (Queue.Async - Async) / UPDATES, (double) Elapsed / UPDATES);
+}
+
+/****************************************************************************************
+ * Blit must give what drawing the same pixels directly gives, for all built-in formats
+ * and for drivers with their own pixel format (byte sprites)
+ */
+static bool NoInit( struct GDS_Device* Device ) { return true; }
+
+static void CustomPixel( struct GDS_Device* Device, int X, int Y, int Color ) {
+	// horizontal framing, like SSD1326
+	uint8_t *FBOffset = Device->Framebuffer + ((Y * Device->Width + X) >> 3);
+	*FBOffset = Color == GDS_COLOR_BLACK ? *FBOffset & ~(1 << (X & 0x07)) : *FBOffset | (1 << (X & 0x07));
+}
+
+static int check_blit( int Depth, int Mode, bool Custom ) {
+	struct GDS_Device Screen[2] = { 0 };
+	uint32_t Seed = Depth;
+	int Errors = 0;
+	
+	for (int i = 0; i < 2; i++) {
+		Screen[i].Width = 64; 
+		Screen[i].Height = 48;
+		Screen[i].Depth = Depth;
+		Screen[i].Mode = Mode;
+		Screen[i].Backlight.Pin = -1;
+		Screen[i].Init = NoInit;
+		if (Custom) Screen[i].DrawPixelFast = CustomPixel;
+		GDS_Init( Screen + i );
+	}	
+	
+	// aligned, unaligned and clipped
+	int Positions[][4] = { { 8, 16, 16, 8 }, { 3, 5, 11, 32 }, { 2, 8, 13, 9 }, { 58, 44, 12, 10 }, { -3, -2, 8, 8 } };
+	
+	for (int p = 0; p < sizeof(Positions) / sizeof(*Positions); p++) {
+		int x = Positions[p][0], y = Positions[p][1], Width = Positions[p][2], Height = Positions[p][3];
+		struct GDS_Device* Sprite = GDS_CreateSprite( Screen, Width, Height );
+		
+		for (int r = 0; r < Height; r++) {
+			for (int c = 0; c < Width; c++) {
+				Seed = Seed * 1664525 + 1013904223;
+				int Color = Seed >> 8;
+				if (Depth == 1 || Custom) Color = Color & 1 ? GDS_COLOR_WHITE : GDS_COLOR_BLACK;
+				else if (Depth < 24) Color &= (1 << Depth) - 1;
+				else if (Mode == GDS_RGB666) Color &= 0x3ffff;
+				else Color &= 0xffffff;
+				GDS_DrawPixelFast( Sprite, c, r, Color );
+				GDS_DrawPixel( Screen + 1, x + c, y + r, Color );
+			}
+		}
+		
+		GDS_Blit( Screen, Sprite, x, y );
+		if (memcmp(Screen[0].Framebuffer, Screen[1].Framebuffer, Screen[0].FramebufferSize)) Errors++;
+		GDS_DeleteSprite( Sprite );
+	}
+	
+	for (int i = 0; i < 2; i++) free(Screen[i].Framebuffer);
+	return Errors;
+}
+
+/****************************************************************************************
+ * VU-meter like drawing: 160x32 pixels every time or background + needle sprites
+ */
+static uint64_t draw_vu( bool Blit ) {
+	static struct GDS_Device *Base, *Needle;
+	uint64_t Start;
+	
+	if (!Base) {
+		Base = GDS_CreateSprite( &Device, 160, 32 );
+		Needle = GDS_CreateSprite( &Device, 11, 32 );
+		for (int c = 0; c < 160; c++) for (int r = 0; r < 32; r++) GDS_DrawPixelFast( Base, c, r, c * r );
+		for (int c = 0; c < 11; c++) for (int r = 0; r < 32; r++) GDS_DrawPixelFast( Needle, c, r, 0xffff - c * r );
+	}	
+	
+	Start = now_ns();
+	for (int n = 0; n < UPDATES; n++) {
+		int Level = n % (160 - 11);
+		if (Blit) {
+			GDS_Blit( &Device, Base, 0, 0 );
+			GDS_Blit( &Device, Needle, Level, 0 );
+		} else {
+			for (int c = 0; c < 160; c++) {
+				for (int r = 0; r < 32; r++) {
+					int Color = c >= Level && c < Level + 11 ? 0xffff - (c - Level) * r : c * r;
+					GDS_DrawPixelFast( &Device, c, r, Color );
+				}
+			}
+			GDS_Damage( &Device, 0, 0, 159, 31 );
+		}
+		Device.DamageCount = 0;
+	}
+	
+	return (now_ns() - Start) / UPDATES;
+}
+
+int main(int argc, char *argv[]) {
+	ST77xx_Detect( "ST7789:16", &Device );
+	Device.Width = WIDTH;
+	Device.Height = HEIGHT;
+	Device.TextWidth = WIDTH;
+	Device.IF = GDS_IF_SPI;
+	Device.RSTPin = -1;
+	Device.Backlight.Pin = -1;
+	Device.WriteCommand = WriteCommand;
+	Device.WriteData = WriteData;
+	Device.WriteDataAsync = WriteDataAsync;
+	Device.WaitData = WaitData;
+	
+	if (!GDS_Init( &Device )) {
+		fprintf(stderr, "cannot initialize device\n");
+		return 1;
+	}	
+	
+	printf("case,mode,updates,bytes_per_update,pixel_bytes_per_update,queued_per_update,ns_per_update\n");
+	for (int Whole = 1; Whole >= 0; Whole--) {
+		run( "spectrum", draw_bars, HEIGHT - 32, 32, Whole );
+		run( "progress", draw_box, HEIGHT / 2, 16, Whole );
+	}
+	
+	printf("\ncase,ns_per_draw\n");
+	printf("vu_pixels,%llu\n", (unsigned long long) draw_vu( false ));
+	printf("vu_blit,%llu\n", (unsigned long long) draw_vu( true ));
+	
+	printf("\nblit,depth,mode,errors\n");
+	printf("blit,1,mono,%d\n", check_blit( 1, GDS_MONO, false ));
+	printf("blit,1,custom,%d\n", check_blit( 1, GDS_MONO, true ));
+	printf("blit,4,grayscale,%d\n", check_blit( 4, GDS_GRAYSCALE, false ));
+	printf("blit,8,rgb332,%d\n", check_blit( 8, GDS_RGB332, false ));
+	printf("blit,16,rgb565,%d\n", check_blit( 16, GDS_RGB565, false ));
+	printf("blit,24,rgb666,%d\n", check_blit( 24, GDS_RGB666, false ));
+	printf("blit,24,rgb888,%d\n", check_blit( 24, GDS_RGB888, false ));
+	
+	return 0;
+}
@@ -0,0 +1,4 @@
+/* minimal gpio.h for the display bench, no reset pin is used */
+#pragma once
+
+#define gpio_set_level(pin, level) do { } while (0)
@@ -0,0 +1,5 @@
+/* minimal esp_attr.h so that code placed in IRAM/DRAM builds on host */
+#pragma once
+
+#define IRAM_ATTR
+#define DRAM_ATTR
@@ -0,0 +1,10 @@
+/* minimal esp_heap_caps.h, there is only one heap on host */
+#pragma once
+
+#include <stdlib.h>
+
+#define MALLOC_CAP_INTERNAL	0x01
+#define MALLOC_CAP_DMA		0x02
+
+#define heap_caps_malloc(size, caps) malloc(size)
+#define heap_caps_calloc(n, size, caps) calloc(n, size)
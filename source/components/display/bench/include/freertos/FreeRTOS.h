@@ -0,0 +1,9 @@
+/* minimal FreeRTOS.h for the display bench */
+#pragma once
+
+#include <stdint.h>
+#include "esp_heap_caps.h"
+
+typedef uint32_t TickType_t;
+
+#define pdMS_TO_TICKS(ms) ((TickType_t) (ms))
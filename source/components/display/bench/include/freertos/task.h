@@ -0,0 +1,4 @@
+/* minimal task.h for the display bench */
+#pragma once
+
+#define vTaskDelay(ticks) do { } while (0)
@@ -7,9 +7,11 @@
  */
 
 #include <string.h>
+#include <stdlib.h>
 #include <ctype.h>
 #include <stdint.h>
 #include <math.h>
+#include <limits.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "driver/gpio.h"
@@ -19,6 +21,9 @@
 #include "gds.h"
 #include "gds_private.h"
 
+#define min(a,b) (((a) < (b)) ? (a) : (b))
+#define max(a,b) (((a) > (b)) ? (a) : (b))
+
 #ifdef CONFIG_IDF_TARGET_ESP32S3
 #define LEDC_SPEED_MODE LEDC_LOW_SPEED_MODE
 #else
@@ -69,7 +74,6 @@ void GDS_ClearExt(struct GDS_Device* Device, bool full, ...) {
 		va_end(args);
 	}
 	
-	Device->Dirty = true;
 	if (commit)	GDS_Update(Device);		
 }	
 
@@ -79,7 +83,7 @@ void GDS_Clear( struct GDS_Device* Device, int Color ) {
 	else if (Device->Depth == 4) memset( Device->Framebuffer, Color | (Color << 4), Device->FramebufferSize );
 	else if (Device->Depth == 8) memset( Device->Framebuffer, Color, Device->FramebufferSize );
 	else GDS_ClearWindow(Device, 0, 0, -1, -1, Color);
-	Device->Dirty = true;
+	GDS_Damage( Device, 0, 0, -1, -1 );
 }
 
 #define CLEAR_WINDOW(x1,y1,x2,y2,F,W,C,T,N)				\
@@ -122,7 +126,7 @@ void GDS_ClearWindow( struct GDS_Device* Device, int x1, int y1, int x2, int y2,
 				}
 			}
 		}
-	} if (Device->Depth == 4) {
+	} else if (Device->Depth == 4) {
 		if (x2 - x1 == Device->Width - 1 && y2 - y1 == Device->Height - 1) {
 			// we assume color is 0..15
 			memset( Device->Framebuffer, Color | (Color << 4), Device->FramebufferSize );
@@ -154,12 +158,60 @@ void GDS_ClearWindow( struct GDS_Device* Device, int x1, int y1, int x2, int y2,
 	}
 	
 	// make sure diplay will do update
-	Device->Dirty = true;
+	GDS_Damage( Device, x1, y1, x2, y2 );
 }
 
 void GDS_Update( struct GDS_Device* Device ) {
 	if (Device->Dirty) Device->Update( Device );
 	Device->Dirty = false;
+	Device->DamageCount = 0;
+}
+
+/****************************************************************************************
+ * Record a modified area (-1 means up to width/height) so that drivers can only push 
+ * what has changed. Close areas are merged and when there are too many, the new one
+ * is merged with the one that grows the least
+ */
+#define DAMAGE_GAP	8
+
+static inline int AreaSize( int x1, int y1, int x2, int y2 ) { return (x2 - x1 + 1) * (y2 - y1 + 1); }
+
+void GDS_Damage( struct GDS_Device* Device, int x1, int y1, int x2, int y2 ) {
+	struct GDS_Area *Area = Device->Damage;
+	int Best = 0, Growth = INT_MAX;
+	
+	if (x2 < 0 || x2 >= Device->Width) x2 = Device->Width - 1;
+	if (y2 < 0 || y2 >= Device->Height) y2 = Device->Height - 1;
+	if (x1 < 0) x1 = 0;
+	if (y1 < 0) y1 = 0;
+	if (x1 > x2 || y1 > y2) return;
+
+	Device->Dirty = true;
+	
+	for (int i = 0; i < Device->DamageCount; i++, Area++) {
+		// already covered or close enough
+		if (x1 <= Area->x2 + DAMAGE_GAP && x2 >= Area->x1 - DAMAGE_GAP && y1 <= Area->y2 + DAMAGE_GAP && y2 >= Area->y1 - DAMAGE_GAP) {
+			Best = i;
+			Growth = 0;
+			break;
+		}
+		int Size = AreaSize(min(x1, Area->x1), min(y1, Area->y1), max(x2, Area->x2), max(y2, Area->y2)) - AreaSize(Area->x1, Area->y1, Area->x2, Area->y2);
+		if (Size < Growth) {
+			Best = i;
+			Growth = Size;
+		}	
+	}
+	
+	// room for a new one
+	if (Growth && Device->DamageCount < MAX_DAMAGE) {
+		Area = Device->Damage + Device->DamageCount++;
+		*Area = (struct GDS_Area) { x1, y1, x2, y2 };
+		return;
+	}	
+	
+	Area = Device->Damage + Best;
+	Area->x1 = min(x1, Area->x1); Area->y1 = min(y1, Area->y1);
+	Area->x2 = max(x2, Area->x2); Area->y2 = max(y2, Area->y2);
 }
 
 bool GDS_Reset( struct GDS_Device* Device ) {
@@ -226,6 +278,116 @@ static void IRAM_ATTR DrawPixel24Fast( struct GDS_Device* Device, int X, int Y,
 	*FBOffset++ = Color >> 16; *FBOffset++ = Color >> 8; *FBOffset = Color;
 }
 
+/****************************************************************************************
+ * Sprites are off-screen devices that can be drawn into with any GDS function and then 
+ * blitted. They use the screen's own framebuffer format when it is one of the built-in, 
+ * otherwise they hold one byte per pixel (so drivers with their own DrawPixelFast must
+ * not have a depth above 8). Odd width on 4 bits screen also requires byte sprites
+ */
+bool GDS_IsNative( struct GDS_Device* Device ) {
+	return Device->DrawPixelFast == DrawPixel1Fast || Device->DrawPixelFast == DrawPixel4Fast || 
+		   Device->DrawPixelFast == DrawPixel4FastHigh || Device->DrawPixelFast == DrawPixel8Fast || 
+		   Device->DrawPixelFast == DrawPixel16Fast || Device->DrawPixelFast == DrawPixel18Fast || 
+		   Device->DrawPixelFast == DrawPixel24Fast;
+}
+
+struct GDS_Device* GDS_CreateSprite( struct GDS_Device* Device, int Width, int Height ) {
+	struct GDS_Device* Sprite = calloc( 1, sizeof(struct GDS_Device) );
+	if (!Sprite) return NULL;
+	
+	// driver's methods may rely on its private data, only pixel access is kept
+	Sprite->Width = Sprite->TextWidth = Width;
+	Sprite->Height = Height;
+	Sprite->Mode = Device->Mode;
+	Sprite->HighNibble = Device->HighNibble;
+	Sprite->Font = Device->Font;
+	
+	// 4 bits lines must be made of full bytes
+	if (GDS_IsNative( Device ) && !(Device->Depth == 4 && (Width & 0x01))) {
+		Sprite->Alloc = GDS_ALLOC_NONE;
+		Sprite->Depth = Device->Depth;
+		Sprite->DrawPixelFast = Device->DrawPixelFast;
+	} else {
+		Sprite->Alloc = GDS_ALLOC_NONE | GDS_ALLOC_BYTES;
+		Sprite->Depth = 8;
+		Sprite->DrawPixelFast = DrawPixel8Fast;
+	}	
+	
+	// 1 bit is by pages of 8 lines
+	if (Sprite->Depth > 8) Sprite->FramebufferSize = Width * Height * ((8 + Sprite->Depth - 1) / 8);
+	else if (Sprite->Depth == 1) Sprite->FramebufferSize = Width * ((Height + 7) / 8);
+	else Sprite->FramebufferSize = (Width * Height * Sprite->Depth + 7) / 8;
+	
+	Sprite->Framebuffer = calloc( 1, Sprite->FramebufferSize );
+	if (!Sprite->Framebuffer) {
+		free(Sprite);
+		return NULL;
+	}	
+	
+	return Sprite;
+}
+
+void GDS_DeleteSprite( struct GDS_Device* Sprite ) {
+	if (!Sprite) return;
+	free(Sprite->Framebuffer);
+	free(Sprite);
+}
+
+static int GetPixel( struct GDS_Device* Sprite, int X, int Y ) {
+	uint8_t *Data = Sprite->Framebuffer;
+	
+	switch (Sprite->Depth) {
+	case 1:
+		return Data[(Y >> 3) * Sprite->Width + X] & BIT(Y & 0x07) ? GDS_COLOR_WHITE : GDS_COLOR_BLACK;
+	case 4:
+		Data += (Y * Sprite->Width >> 1) + (X >> 1);
+		return (X & 0x01) ^ Sprite->HighNibble ? *Data >> 4 : *Data & 0x0f;
+	case 8:
+		// byte sprites store colors of other depths, where white is -1
+		if (Sprite->Alloc & GDS_ALLOC_BYTES) return (int8_t) Data[Y * Sprite->Width + X];
+		return Data[Y * Sprite->Width + X];
+	case 16:
+		return __builtin_bswap16(((uint16_t*) Data)[Y * Sprite->Width + X]);
+	default:
+		Data += (Y * Sprite->Width + X) * 3;
+		if (Sprite->Mode == GDS_RGB666) return (Data[0] << 12) | (Data[1] << 6) | Data[2];
+		return (Data[0] << 16) | (Data[1] << 8) | Data[2];
+	}
+}
+
+void GDS_Blit( struct GDS_Device* Device, struct GDS_Device* Sprite, int x, int y ) {
+	int Width = Sprite->Width, Height = Sprite->Height;
+	uint8_t *Data = Sprite->Framebuffer;
+	bool Inside = x >= 0 && y >= 0 && x + Width <= Device->Width && y + Height <= Device->Height;
+	
+	GDS_Damage( Device, x, y, x + Width - 1, y + Height - 1 );
+
+	// copy whole lines (or pages) when formats and alignment allow it
+	if (Sprite->Alloc & GDS_ALLOC_BYTES) {
+		for (int r = 0; r < Height; r++) {
+			for (int c = 0; c < Width; c++) DrawPixel( Device, x + c, y + r, GetPixel( Sprite, c, r ) );
+		}	
+	} else if (Inside && Device->Depth >= 8) {
+		int Bytes = (Device->Depth + 8 - 1) / 8;
+		for (int r = 0; r < Height; r++) {
+			memcpy( Device->Framebuffer + ((y + r) * Device->Width + x) * Bytes, Data + r * Width * Bytes, Width * Bytes );
+		}	
+	} else if (Inside && Device->Depth == 4 && !(x & 0x01) && !(Width & 0x01) && !(Device->Width & 0x01)) {
+		for (int r = 0; r < Height; r++) {
+			memcpy( Device->Framebuffer + (((y + r) * Device->Width + x) >> 1), Data + (r * Width >> 1), Width >> 1 );
+		}	
+	} else if (Inside && Device->Depth == 1 && !(y & 0x07) && !(Height & 0x07)) {
+		for (int r = 0; r < Height; r += 8) {
+			memcpy( Device->Framebuffer + ((y + r) >> 3) * Device->Width + x, Data + (r >> 3) * Width, Width );
+		}	
+	} else {
+		// unaligned or clipped
+		for (int r = 0; r < Height; r++) {
+			for (int c = 0; c < Width; c++) DrawPixel( Device, x + c, y + r, GetPixel( Sprite, c, r ) );
+		}	
+	}	
+}
+
 bool GDS_Init( struct GDS_Device* Device ) {
 	
 	if (Device->Depth > 8) Device->FramebufferSize = Device->Width * Device->Height * ((8 + Device->Depth - 1) / 8);
@@ -308,8 +470,12 @@ void GDS_SetContrast( struct GDS_Device* Device, uint8_t Contrast ) {
 	}
 }
 
-void GDS_SetLayout( struct GDS_Device* Device, struct GDS_Layout *Layout ) { if (Device->SetLayout) Device->SetLayout( Device, Layout ); }
-void GDS_SetDirty( struct GDS_Device* Device ) { Device->Dirty = true; }
+void GDS_SetLayout( struct GDS_Device* Device, struct GDS_Layout *Layout ) { 
+	if (Device->SetLayout) Device->SetLayout( Device, Layout ); 
+	// panel content is now wrong everywhere
+	GDS_Damage( Device, 0, 0, -1, -1 );
+}
+void GDS_SetDirty( struct GDS_Device* Device ) { GDS_Damage( Device, 0, 0, -1, -1 ); }
 int	 GDS_GetWidth( struct GDS_Device* Device ) { return Device ? Device->Width : 0; }
 void GDS_SetTextWidth( struct GDS_Device* Device, int TextWidth ) { Device->TextWidth = Device && TextWidth && TextWidth < Device->Width ? TextWidth : Device->Width; }
 int	 GDS_GetHeight( struct GDS_Device* Device ) { return Device ? Device->Height : 0; }
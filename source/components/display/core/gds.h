@@ -52,5 +52,9 @@ int 	GDS_GrayMap( struct GDS_Device* Device, uint8_t Level );
 void 	GDS_ClearExt( struct GDS_Device* Device, bool full, ...);
 void 	GDS_Clear( struct GDS_Device* Device, int Color );
 void 	GDS_ClearWindow( struct GDS_Device* Device, int x1, int y1, int x2, int y2, int Color );
+// off-screen image in Device's format, draw into it like a device then blit it
+struct GDS_Device* GDS_CreateSprite( struct GDS_Device* Device, int Width, int Height );
+void	GDS_DeleteSprite( struct GDS_Device* Sprite );
+void	GDS_Blit( struct GDS_Device* Device, struct GDS_Device* Sprite, int x, int y );
 
 #endif
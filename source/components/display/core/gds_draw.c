@@ -37,6 +37,9 @@ static const unsigned char BitReverseTable256[] =
   0x0F, 0x8F, 0x4F, 0xCF, 0x2F, 0xAF, 0x6F, 0xEF, 0x1F, 0x9F, 0x5F, 0xDF, 0x3F, 0xBF, 0x7F, 0xFF
 };
 
+#define min(a,b) (((a) < (b)) ? (a) : (b))
+#define max(a,b) (((a) > (b)) ? (a) : (b))
+
 __attribute__( ( always_inline ) ) static inline void SwapInt( int* a, int* b ) {
     int Temp = *b;
 
@@ -44,6 +47,11 @@ __attribute__( ( always_inline ) ) static inline void SwapInt( int* a, int* b )
     *a = Temp;
 }
 
+/* 
+ Pixel functions don't record damage, it would cost more than the pixel itself. Drawing
+ primitives do it once for their area and callers drawing pixels on the display (not 
+ on a sprite) must do it once for what they have drawn
+*/
 void IRAM_ATTR GDS_DrawPixelFast( struct GDS_Device* Device, int X, int Y, int Color ) {
 	Device->DrawPixelFast( Device, X, Y, Color );
 }
@@ -52,34 +60,42 @@ void IRAM_ATTR GDS_DrawPixel( struct GDS_Device* Device, int X, int Y, int Color
 	DrawPixel( Device, X, Y, Color );
 }
 
-void GDS_DrawHLine( struct GDS_Device* Device, int x, int y, int Width, int Color ) {
+static void DrawHLine( struct GDS_Device* Device, int x, int y, int Width, int Color, bool Damage ) {
     int XEnd = x + Width;
 
-	Device->Dirty = true;
-	
 	if (x < 0) x = 0;
 	if (XEnd >= Device->Width) XEnd = Device->Width - 1;
 	
 	if (y < 0) y = 0;
 	else if (y >= Device->Height) y = Device->Height - 1;
+	
+	if (Damage) GDS_Damage( Device, x, y, XEnd - 1, y );
 
     for ( ; x < XEnd; x++ ) Device->DrawPixelFast( Device, x, y, Color );
 }
 
-void GDS_DrawVLine( struct GDS_Device* Device, int x, int y, int Height, int Color ) {
+static void DrawVLine( struct GDS_Device* Device, int x, int y, int Height, int Color, bool Damage ) {
     int YEnd = y + Height;
 
-	Device->Dirty = true;
-	
 	if (x < 0) x = 0;
 	if (x >= Device->Width) x = Device->Width - 1;
 	
 	if (y < 0) y = 0;
 	else if (YEnd >= Device->Height) YEnd = Device->Height - 1;
+	
+	if (Damage) GDS_Damage( Device, x, y, x, YEnd - 1 );
 
     for ( ; y < YEnd; y++ ) DrawPixel( Device, x, y, Color );
 }
 
+void GDS_DrawHLine( struct GDS_Device* Device, int x, int y, int Width, int Color ) {
+	DrawHLine( Device, x, y, Width, Color, true );
+}
+
+void GDS_DrawVLine( struct GDS_Device* Device, int x, int y, int Height, int Color ) {
+	DrawVLine( Device, x, y, Height, Color, true );
+}
+
 static inline void DrawWideLine( struct GDS_Device* Device, int x0, int y0, int x1, int y1, int Color ) {
     int dx = ( x1 - x0 );
     int dy = ( y1 - y0 );
@@ -144,7 +160,7 @@ void GDS_DrawLine( struct GDS_Device* Device, int x0, int y0, int x1, int y1, in
     } else if ( y0 == y1 ) {
         GDS_DrawHLine( Device, x0, y0, ( x1 - x0 ), Color );
     } else {
-		Device->Dirty = true;
+		GDS_Damage( Device, min( x0, x1 ), min( y0, y1 ), max( x0, x1 ), max( y0, y1 ) );
         if ( abs( x1 - x0 ) > abs( y1 - y0 ) ) {
             /* Wide ( run > rise ) */
             if ( x0 > x1 ) {
@@ -169,24 +185,25 @@ void GDS_DrawBox( struct GDS_Device* Device, int x1, int y1, int x2, int y2, int
     int Width = ( x2 - x1 );
     int Height = ( y2 - y1 );
 
-	Device->Dirty = true;
+	// one area for the whole box
+	GDS_Damage( Device, x1, y1, x2, y2 );
 	
     if ( Fill == false ) {
         /* Top side */
-        GDS_DrawHLine( Device, x1, y1, Width, Color );
+        DrawHLine( Device, x1, y1, Width, Color, false );
 
         /* Bottom side */
-        GDS_DrawHLine( Device, x1, y1 + Height, Width, Color );
+        DrawHLine( Device, x1, y1 + Height, Width, Color, false );
 
         /* Left side */
-        GDS_DrawVLine( Device, x1, y1, Height, Color );
+        DrawVLine( Device, x1, y1, Height, Color, false );
 
         /* Right side */
-        GDS_DrawVLine( Device, x1 + Width, y1, Height, Color );
+        DrawVLine( Device, x1 + Width, y1, Height, Color, false );
     } else {
         /* Fill the box by drawing horizontal lines */
         for ( ; y1 <= y2; y1++ ) {
-            GDS_DrawHLine( Device, x1, y1, Width, Color );
+            DrawHLine( Device, x1, y1, Width, Color, false );
         }
     }
 }
@@ -198,7 +215,10 @@ void GDS_DrawBox( struct GDS_Device* Device, int x1, int y1, int x2, int y2, int
 void GDS_DrawBitmapCBR(struct GDS_Device* Device, uint8_t *Data, int Width, int Height, int Color ) {
 	if (!Height) Height = Device->Height;
 	if (!Width) Width = Device->Width;
-		
+	
+	// do it now as Height is then counted in bytes
+	GDS_Damage( Device, 0, 0, Width - 1, Height - 1 );
+	
 	if (Device->DrawBitmapCBR) {
 		Device->DrawBitmapCBR( Device, Data, Width, Height, Color );
 	} else if (Device->Depth == 1) {
@@ -374,6 +394,4 @@ void GDS_DrawBitmapCBR(struct GDS_Device* Device, uint8_t *Data, int Width, int
 		}
 		*/
 	}
-	
-	Device->Dirty = true;
 }
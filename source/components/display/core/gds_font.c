@@ -81,7 +81,7 @@ void GDS_FontDrawChar( struct GDS_Device* Device, char Character, int x, int y,
         /* Do not attempt to draw past the end of the screen */
         CharEndX = ( CharEndX >= Device->TextWidth ) ? Device->TextWidth - 1 : CharEndX;
         CharEndY = ( CharEndY >= Device->Height ) ? Device->Height - 1 : CharEndY;
-		Device->Dirty = true;
+		GDS_Damage( Device, CharStartX, CharStartY, CharEndX, CharEndY );
 
         for ( x = CharStartX; x < CharEndX; x++ ) {
             for ( y = CharStartY, i = 0; y < CharEndY && i < CharHeight; y++, i++ ) {
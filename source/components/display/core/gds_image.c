@@ -34,8 +34,10 @@ typedef struct {
 		struct {						// DirectDraw
 			struct GDS_Device *Device;
 			int XOfs, YOfs;
-			int XMin, YMin;
+			int XMin, YMin, XMax, YMax;	// absolute clipping window
+			int XStep, YStep;			// decoded to drawn pixels ratio (16.16)
 			int Depth;
+			bool Native;
 		};	
 	};	
 } JpegCtx;
@@ -130,38 +132,79 @@ static unsigned OutHandler(JDEC *Decoder, void *Bitmap, JRECT *Frame) {
     return 1;
 }
 
-// Convert the RGB888 to destination color plane, use DrawPixel and not "fast" 
-// version as X,Y may be beyond screen				
-#define OUTHANDLERDIRECT(F,S)																		\
-	for (int y = Frame->top; y <= Frame->bottom; y++) {												\
-		if (y < Context->YMin) continue;															\
-		for (int x = Frame->left; x <= Frame->right; x++) {											\
-			if (x < Context->XMin) continue;														\
-			DrawPixel( Context->Device, x + Context->XOfs, y + Context->YOfs, F(Pixels) >> S);	\
-			Pixels += 3;																			\
+/****************************************************************************************
+ * Ordered dithering for grayscale screens (4x4 Bayer matrix), so that 1 and 4 bits
+ * panels render gradients of cover art instead of flat bands 
+ */
+static const uint8_t Bayer[4][4] = { 
+	{ 0, 8, 2, 10 }, { 12, 4, 14, 6 }, { 3, 11, 1, 9 }, { 15, 7, 13, 5 } 
+};
+
+static inline int Dither(uint8_t *Pixels, int x, int y, int Levels) {
+	return (ScalerGray(Pixels) * Levels * 32 + (Bayer[y & 0x03][x & 0x03] * 2 + 1) * 255) / (255 * 32);
+}
+
+// write in the framebuffer when its layout is a built-in one, otherwise use driver 
+static inline void IRAM_ATTR PutPixel(JpegCtx *Context, int x, int y, int Color) {
+	struct GDS_Device *Device = Context->Device;
+	
+	if (!Context->Native || Context->Depth < 8) {
+		Device->DrawPixelFast(Device, x, y, Color);
+	} else if (Context->Depth == 16) {
+		((uint16_t*) Device->Framebuffer)[y * Device->Width + x] = __builtin_bswap16(Color);
+	} else if (Context->Depth == 8) {
+		Device->Framebuffer[y * Device->Width + x] = Color;
+	} else {
+		uint8_t *p = Device->Framebuffer + (y * Device->Width + x) * 3;
+		if (Context->Mode == GDS_RGB666) { *p++ = Color >> 12; *p++ = (Color >> 6) & 0x3f; *p = Color & 0x3f; }
+		else { *p++ = Color >> 16; *p++ = Color >> 8; *p = Color; }
+	}	
+}
+
+// Convert the RGB888 MCU to destination color plane, straight in the framebuffer. Decoded 
+// pixel c covers destination columns [(c * XStep) >> 16, ((c + 1) * XStep) >> 16) so it 
+// is dropped or replicated for fractional scaling (same for rows). Clipping is done once 
+// per row so "fast" draw can be used
+#define OUTHANDLERDIRECT(F)																			\
+	for (int r = Frame->top; r <= Frame->bottom; r++) {												\
+		int y = Context->YOfs + ((r * Context->YStep) >> 16);										\
+		int yEnd = Context->YOfs + (((r + 1) * Context->YStep) >> 16);								\
+		if (y < Context->YMin) y = Context->YMin;													\
+		if (yEnd > Context->YMax + 1) yEnd = Context->YMax + 1;										\
+		uint8_t *Row = Pixels + (r - Frame->top) * (Frame->right - Frame->left + 1) * 3;			\
+		for (; y < yEnd; y++) {																		\
+			int c = Frame->left, x = Context->XOfs + ((c * Context->XStep) >> 16);					\
+			int xEnd = Context->XOfs + (((Frame->right + 1) * Context->XStep) >> 16);				\
+			if (xEnd > Context->XMax + 1) xEnd = Context->XMax + 1;									\
+			for (uint8_t *p = Row; x < xEnd; x++) {													\
+				while (Context->XOfs + (((c + 1) * Context->XStep) >> 16) <= x) { c++; p += 3; }	\
+				if (x >= Context->XMin) PutPixel(Context, x, y, F);									\
+			}																						\
 		}																							\
 	}
 	
 static unsigned OutHandlerDirect(JDEC *Decoder, void *Bitmap, JRECT *Frame) {
 	JpegCtx *Context = (JpegCtx*) Decoder->device;
     uint8_t *Pixels = (uint8_t*) Bitmap;
-	int Shift = 8 - Context->Depth;
+	int Levels = (1 << Context->Depth) - 1;
 	
-	// decoded image is RGB888, shift only make sense for grayscale
+	// decoded image is RGB888, dithering only make sense for grayscale
 	if (Context->Mode == GDS_RGB888) {
-		OUTHANDLERDIRECT(Scaler888, 0);
+		OUTHANDLERDIRECT(Scaler888(p));
 	} else if (Context->Mode == GDS_RGB666) {
-		OUTHANDLERDIRECT(Scaler666, 0);		
+		OUTHANDLERDIRECT(Scaler666(p));
 	} else if (Context->Mode == GDS_RGB565) {
-		OUTHANDLERDIRECT(Scaler565, 0);		
+		OUTHANDLERDIRECT(Scaler565(p));
 	} else if (Context->Mode == GDS_RGB555) {
-		OUTHANDLERDIRECT(Scaler555, 0);				
+		OUTHANDLERDIRECT(Scaler555(p));
 	} else if (Context->Mode == GDS_RGB444) {
-		OUTHANDLERDIRECT(Scaler444, 0);						
+		OUTHANDLERDIRECT(Scaler444(p));
 	} else if (Context->Mode == GDS_RGB332) {
-		OUTHANDLERDIRECT(Scaler332, 0);						
+		OUTHANDLERDIRECT(Scaler332(p));
+	} else if (Context->Mode <= GDS_GRAYSCALE && Context->Depth < 8) { 	 
+		OUTHANDLERDIRECT(Dither(p, x, y, Levels));
 	} else if (Context->Mode <= GDS_GRAYSCALE) { 	 
-		OUTHANDLERDIRECT(ScalerGray, Shift);
+		OUTHANDLERDIRECT(ScalerGray(p));
 	}
     
     return 1;
@@ -189,10 +232,6 @@ static void* DecodeJPEG(uint8_t *Source, int *Width, int *Height, float Scale, b
 	Decoder.scale = Scale;
 
     if (Res == JDR_OK && !SizeOnly) {
-		if (RGB_Mode <= GDS_RGB332) Context.OutData = malloc(Decoder.width * Decoder.height);
-		else if (RGB_Mode < GDS_RGB666) Context.OutData = malloc(Decoder.width * Decoder.height * 2);
-		else if (RGB_Mode <= GDS_RGB888) Context.OutData = malloc(Decoder.width * Decoder.height * 3);
-		
 		// find the scaling factor
 		uint8_t N = 0, ScaleInt =  ceil(1.0 / Scale);
 		ScaleInt--; ScaleInt |= ScaleInt >> 1; ScaleInt |= ScaleInt >> 2; ScaleInt++;
@@ -202,6 +241,12 @@ static void* DecodeJPEG(uint8_t *Source, int *Width, int *Height, float Scale, b
 			N = 3;
 		}	
 		
+		// only allocate what the scaled image needs
+		size_t Size = (Decoder.width >> N) * (Decoder.height >> N);
+		if (RGB_Mode <= GDS_RGB332) Context.OutData = malloc(Size);
+		else if (RGB_Mode < GDS_RGB666) Context.OutData = malloc(Size * 2);
+		else if (RGB_Mode <= GDS_RGB888) Context.OutData = malloc(Size * 3);
+		
 		// ready to decode		
 		if (Context.OutData) {
 			Context.Width = Decoder.width / (1 << N);
@@ -314,7 +359,7 @@ void GDS_DrawRGB( struct GDS_Device* Device, uint8_t *Image, int x, int y, int W
 	// don't do anything if driver supplies a draw function
 	if (Device->DrawRGB) {
 		Device->DrawRGB( Device, Image, x, y, Width, Height, RGB_Mode );
-		Device->Dirty = true;	
+		GDS_Damage( Device, x, y, x + Width - 1, y + Height - 1 );
 		return;
 	}
 	
@@ -334,7 +379,7 @@ void GDS_DrawRGB( struct GDS_Device* Device, uint8_t *Image, int x, int y, int W
 			DRAW_RGB24;
 		}	
 		
-		Device->Dirty = true;
+		GDS_Damage( Device, x, y, x + Width - 1, y + Height - 1 );
 		return;
 	}
 	
@@ -366,7 +411,7 @@ void GDS_DrawRGB( struct GDS_Device* Device, uint8_t *Image, int x, int y, int W
 		}	
 	} 
 	
-	Device->Dirty = true;	
+	GDS_Damage( Device, x, y, x + Width - 1, y + Height - 1 );
 }
 
 /****************************************************************************************
@@ -398,10 +443,18 @@ bool GDS_DrawJPEG(struct GDS_Device* Device, uint8_t *Source, int x, int y, int
 	
     if (Res == JDR_OK) {
 		uint8_t N = 0;
+		int Width = Device->Width - x, Height = Device->Height - y;
 		
-		// do we need to fit the image
-		if (Fit & GDS_IMAGE_FIT) {
-			float XRatio = (Device->Width - x) / (float) Decoder.width, YRatio = (Device->Height - y) / (float) Decoder.height;
+		// do we need to fit the image (fill can also enlarge it)
+		if ((Fit & GDS_IMAGE_FILL) && Width > 0 && Height > 0) {
+			// largest 2^N decoder's downscale that keeps image above target then (fractional) stretch 
+			if (Width * Decoder.height < Height * Decoder.width) Height = (Decoder.height * Width) / Decoder.width;
+			else Width = (Decoder.width * Height) / Decoder.height;
+			while (N < 3 && (Decoder.width >> (N + 1)) >= Width && (Decoder.height >> (N + 1)) >= Height) N++;
+			Context.Width = Width ? Width : 1;
+			Context.Height = Height ? Height : 1;
+		} else if (Fit & GDS_IMAGE_FIT) {
+			float XRatio = Width / (float) Decoder.width, YRatio = Height / (float) Decoder.height;
 			uint8_t Ratio = XRatio < YRatio ? ceil(1/XRatio) : ceil(1/YRatio);
 			Ratio--; Ratio |= Ratio >> 1; Ratio |= Ratio >> 2; Ratio++;
 			while (Ratio >>= 1) N++;
@@ -413,20 +466,32 @@ bool GDS_DrawJPEG(struct GDS_Device* Device, uint8_t *Source, int x, int y, int
 			Context.Height /= 1 << N;
 		} 
 		
+		// rounded up so that last decoded pixel reaches the image's edge
+		Context.XStep = ((Context.Width << 16) + (Decoder.width >> N) - 1) / (Decoder.width >> N);
+		Context.YStep = ((Context.Height << 16) + (Decoder.height >> N) - 1) / (Decoder.height >> N);
+		
 		// then place it
 		if (Fit & GDS_IMAGE_CENTER_X) Context.XOfs = (Device->Width + x - Context.Width) / 2;
 		else if (Fit & GDS_IMAGE_RIGHT) Context.XOfs = Device->Width - Context.Width;
 		if (Fit & GDS_IMAGE_CENTER_Y) Context.YOfs = (Device->Height + y - Context.Height) / 2;
 		else if (Fit & GDS_IMAGE_BOTTOM) Context.YOfs = Device->Height - Context.Height;
 
-		Context.XMin = x - Context.XOfs;
-		Context.YMin = y - Context.YOfs;
+		// clip to the window and to the image
+		Context.XMin = Context.XOfs > x ? Context.XOfs : x;
+		Context.YMin = Context.YOfs > y ? Context.YOfs : y;
+		if (Context.XMin < 0) Context.XMin = 0;
+		if (Context.YMin < 0) Context.YMin = 0;
+		Context.XMax = Context.XOfs + Context.Width - 1;
+		Context.YMax = Context.YOfs + Context.Height - 1;
+		if (Context.XMax >= Device->Width) Context.XMax = Device->Width - 1;
+		if (Context.YMax >= Device->Height) Context.YMax = Device->Height - 1;
 		Context.Mode = Device->Mode;
+		Context.Native = GDS_IsNative(Device);
 					
 		// do decompress & draw
 		Res = jd_decomp(&Decoder, OutHandlerDirect, N);
 		if (Res == JDR_OK) {
-			Device->Dirty = true;
+			if (Context.XMin <= Context.XMax && Context.YMin <= Context.YMax) GDS_Damage( Device, Context.XMin, Context.YMin, Context.XMax, Context.YMax );
 			Ret = true;
 		} else {	
 			ESP_LOGE(TAG, "Image decoder: jd_decode failed (%d)", Res);
@@ -24,6 +24,7 @@ struct GDS_Device;
 #define GDS_IMAGE_CENTER_Y	0x02
 #define GDS_IMAGE_CENTER	(GDS_IMAGE_CENTER_X | GDS_IMAGE_CENTER_Y)
 #define GDS_IMAGE_FIT		0x10	// re-scale by a factor of 2^N (up to 3)
+#define GDS_IMAGE_FILL		0x20	// re-scale by any ratio to fill the area (keeps aspect ratio)
 
 // Width and Height can be NULL if you already know them (actual scaling is closest ^2)
 void*	 	GDS_DecodeJPEG(uint8_t *Source, int *Width, int *Height, float Scale, int RGB_Mode);	// can be 8, 16 or 24 bits per pixel in return
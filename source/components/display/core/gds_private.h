@@ -18,6 +18,7 @@
 #define GDS_ALLOC_NONE		0x80
 #define GDS_ALLOC_IRAM		0x01
 #define GDS_ALLOC_IRAM_SPI	0x02
+#define GDS_ALLOC_BYTES		0x04	// sprite with one byte per pixel
 
 #define GDS_CLIPDEBUG_NONE 0
 #define GDS_CLIPDEBUG_WARNING 1
@@ -50,6 +51,7 @@
 #define GDS_ALWAYS_INLINE __attribute__( ( always_inline ) )
 
 #define MAX_LINES	8
+#define MAX_DAMAGE	8
 
 #if ! defined BIT
 #define BIT( n ) ( 1 << ( n ) )
@@ -64,6 +66,11 @@ struct GDS_FontDef;
 typedef bool ( *WriteCommandProc ) ( struct GDS_Device* Device, uint8_t Command );
 typedef bool ( *WriteDataProc ) ( struct GDS_Device* Device, const uint8_t* Data, size_t DataLength );
 
+// inclusive coordinates
+struct GDS_Area {
+	int16_t x1, y1, x2, y2;
+};
+
 struct spi_device_t;
 typedef struct spi_device_t* spi_device_handle_t;
 
@@ -104,6 +111,9 @@ struct GDS_Device {
 	uint8_t* Framebuffer;
     uint32_t FramebufferSize;
 	bool Dirty;
+	// areas modified since last update (none means whole screen)
+	struct GDS_Area Damage[MAX_DAMAGE];
+	uint8_t DamageCount;
 
 	// default fonts when using direct draw	
 	const struct GDS_FontDef* Font;
@@ -131,6 +141,9 @@ struct GDS_Device {
 	// interface-specific methods	
     WriteCommandProc WriteCommand;
     WriteDataProc WriteData;
+	// optional, Data is only queued and must not be modified until WaitData (NULL waits for all) has returned for it
+	WriteDataProc WriteDataAsync;
+	void (*WaitData)( struct GDS_Device* Device, const uint8_t* Data, size_t DataLength );
 
 	// 32 bytes for whatever the driver wants (should be aligned as it's 32 bits)	
 	uint32_t Private[8];
@@ -138,6 +151,9 @@ struct GDS_Device {
 
 bool GDS_Reset( struct GDS_Device* Device );
 bool GDS_Init( struct GDS_Device* Device );
+void GDS_Damage( struct GDS_Device* Device, int x1, int y1, int x2, int y2 );
+// framebuffer uses one of the built-in layouts (not driver's own DrawPixelFast)
+bool GDS_IsNative( struct GDS_Device* Device );
 
 static inline bool IsPixelVisible( struct GDS_Device* Device, int x, int y )  {
     bool Result = (
@@ -116,7 +116,7 @@ bool GDS_TextLine(struct GDS_Device* Device, int N, int Pos, int Attr, char *Tex
 	ESP_LOGD(TAG, "displaying %s line %u (x:%d, attr:%u)", Text, N+1, X, Attr);
 	
 	// update whole display if requested
-	Device->Dirty = true;
+	GDS_Damage( Device, 0, Device->Lines[N].Y, Device->TextWidth - 1, Device->Lines[N].Y + Device->Lines[N].Font->Height - 1 );
 	if (Attr & GDS_TEXT_UPDATE) GDS_Update( Device );
 		
 	return Width + X < Device->TextWidth;
@@ -200,7 +200,6 @@ void GDS_TextPos(struct GDS_Device* Device, int FontType, int Where, int Attr, c
 	GDS_SetFont( Device, GuessFont( Device, FontType ) );	
 	GDS_FontDrawAnchoredString( Device, Anchor, Text, GDS_COLOR_WHITE );
 	
-	Device->Dirty = true;
 	if (Attr & GDS_TEXT_UPDATE) GDS_Update( Device );
 	
 	va_end(args);
@@ -13,20 +13,36 @@
 #include <driver/spi_master.h>
 #include <driver/gpio.h>
 #include <freertos/task.h>
+#include <esp_attr.h>
 #include "gds.h"
 #include "gds_err.h"
 #include "gds_private.h"
 #include "gds_default_if.h"
 
+#define SPI_QUEUE_SIZE	8
+
 static const int GDS_SPI_Command_Mode = 0;
 static const int GDS_SPI_Data_Mode = 1;
 
 static spi_host_device_t SPIHost;
 static int DCPin;
 
-static bool SPIDefaultWriteBytes( spi_device_handle_t SPIHandle, int WriteMode, const uint8_t* Data, size_t DataLength );
+// transactions are all queued and complete in order, Pending are the ones before Head
+static struct {
+	spi_transaction_t Transactions[SPI_QUEUE_SIZE];
+	uint8_t Head, Pending;
+} Queue;
+
+static bool SPIDefaultWriteBytes( spi_device_handle_t SPIHandle, int WriteMode, const uint8_t* Data, size_t DataLength, bool Async );
 static bool SPIDefaultWriteCommand( struct GDS_Device* Device, uint8_t Command );
 static bool SPIDefaultWriteData( struct GDS_Device* Device, const uint8_t* Data, size_t DataLength );
+static bool SPIDefaultWriteDataAsync( struct GDS_Device* Device, const uint8_t* Data, size_t DataLength );
+static void SPIDefaultWaitData( struct GDS_Device* Device, const uint8_t* Data, size_t DataLength );
+
+// D/C must follow each transaction as they are queued
+static void IRAM_ATTR SPIPreTransfer( spi_transaction_t* SPITransaction ) {
+	gpio_set_level( DCPin, (int) SPITransaction->user );
+}
 
 bool GDS_SPIInit( int SPI, int DC ) {
 	SPIHost = SPI;
@@ -47,9 +63,10 @@ bool GDS_SPIAttachDevice( struct GDS_Device* Device, int Width, int Height, int
 	
     SPIDeviceConfig.clock_speed_hz = Speed > 0 ? Speed : SPI_MASTER_FREQ_8M;
     SPIDeviceConfig.spics_io_num = CSPin;
-    SPIDeviceConfig.queue_size = 1;
+    SPIDeviceConfig.queue_size = SPI_QUEUE_SIZE;
     SPIDeviceConfig.mode = Mode;
 	SPIDeviceConfig.flags = SPI_DEVICE_NO_DUMMY;
+	SPIDeviceConfig.pre_cb = SPIPreTransfer;
 	if (Device->SPIParams) Device->SPIParams(SPIDeviceConfig.clock_speed_hz, &SPIDeviceConfig.mode, 
 											 &SPIDeviceConfig.cs_ena_pretrans, &SPIDeviceConfig.cs_ena_posttrans);
 	
@@ -57,6 +74,8 @@ bool GDS_SPIAttachDevice( struct GDS_Device* Device, int Width, int Height, int
 	
 	Device->WriteCommand = SPIDefaultWriteCommand;
     Device->WriteData = SPIDefaultWriteData;
+	Device->WriteDataAsync = SPIDefaultWriteDataAsync;
+	Device->WaitData = SPIDefaultWaitData;
     Device->SPIHandle = SPIDevice;
     Device->RSTPin = RSTPin;
     Device->CSPin = CSPin;
@@ -74,27 +93,47 @@ bool GDS_SPIAttachDevice( struct GDS_Device* Device, int Width, int Height, int
 	return GDS_Init( Device );
 }
 
-static bool SPIDefaultWriteBytes( spi_device_handle_t SPIHandle, int WriteMode, const uint8_t* Data, size_t DataLength ) {
-    spi_transaction_t SPITransaction = { };
+static bool SPIDefaultWait( spi_device_handle_t SPIHandle, int Count ) {
+	spi_transaction_t* SPITransaction;
+	
+	// the task sleeps while DMA runs, unlike polling
+	while (Count-- > 0) {
+		ESP_ERROR_CHECK_NONFATAL( spi_device_get_trans_result( SPIHandle, &SPITransaction, portMAX_DELAY ), return false );
+		Queue.Pending--;
+	}	
+	
+	return true;
+}
+
+static bool SPIDefaultWriteBytes( spi_device_handle_t SPIHandle, int WriteMode, const uint8_t* Data, size_t DataLength, bool Async ) {
+    spi_transaction_t* SPITransaction;
 
     NullCheck( SPIHandle, return false );
     NullCheck( Data, return false );
 
     if ( DataLength > 0 ) {
-		gpio_set_level( DCPin, WriteMode );
-
-		SPITransaction.length = DataLength * 8;
+		// recycle oldest transaction when queue is full
+		if (Queue.Pending == SPI_QUEUE_SIZE && !SPIDefaultWait( SPIHandle, 1 )) return false;
 		
+		SPITransaction = Queue.Transactions + Queue.Head;
+		memset( SPITransaction, 0, sizeof(spi_transaction_t) );
+		SPITransaction->length = DataLength * 8;
+		SPITransaction->user = (void*) WriteMode;
+		
+		// small writes are copied so they never have to be waited for
 		if (DataLength <= 4) {
-			SPITransaction.flags = SPI_TRANS_USE_TXDATA;
-			SPITransaction.tx_data[0] = *Data++; SPITransaction.tx_data[1] = *Data++;
-			SPITransaction.tx_data[2] = *Data++; SPITransaction.tx_data[3] = *Data;
+			SPITransaction->flags = SPI_TRANS_USE_TXDATA;
+			memcpy( SPITransaction->tx_data, Data, DataLength );
 		} else {
-			SPITransaction.tx_buffer = Data;
+			SPITransaction->tx_buffer = Data;
 		}	
             
-		// only do polling as we don't have contention on SPI (otherwise DMA for transfers > 16 bytes)		
-		ESP_ERROR_CHECK_NONFATAL( spi_device_polling_transmit(SPIHandle, &SPITransaction), return false );
+		ESP_ERROR_CHECK_NONFATAL( spi_device_queue_trans( SPIHandle, SPITransaction, portMAX_DELAY ), return false );
+		Queue.Head = (Queue.Head + 1) % SPI_QUEUE_SIZE;
+		Queue.Pending++;
+		
+		// caller may reuse Data as soon as we return
+		if (!Async && DataLength > 4) return SPIDefaultWait( SPIHandle, Queue.Pending );
     }
 
     return true;
@@ -108,12 +147,32 @@ static bool SPIDefaultWriteCommand( struct GDS_Device* Device, uint8_t Command )
 
     CommandByte = Command;
 
-    return SPIDefaultWriteBytes( Device->SPIHandle, GDS_SPI_Command_Mode, &CommandByte, 1 );
+    return SPIDefaultWriteBytes( Device->SPIHandle, GDS_SPI_Command_Mode, &CommandByte, 1, false );
 }
 
 static bool SPIDefaultWriteData( struct GDS_Device* Device, const uint8_t* Data, size_t DataLength ) {
     NullCheck( Device, return false );
     NullCheck( Device->SPIHandle, return false );
 
-    return SPIDefaultWriteBytes( Device->SPIHandle, GDS_SPI_Data_Mode, Data, DataLength );
+    return SPIDefaultWriteBytes( Device->SPIHandle, GDS_SPI_Data_Mode, Data, DataLength, false );
+}
+
+static bool SPIDefaultWriteDataAsync( struct GDS_Device* Device, const uint8_t* Data, size_t DataLength ) {
+    NullCheck( Device, return false );
+    NullCheck( Device->SPIHandle, return false );
+
+    return SPIDefaultWriteBytes( Device->SPIHandle, GDS_SPI_Data_Mode, Data, DataLength, true );
+}
+
+static void SPIDefaultWaitData( struct GDS_Device* Device, const uint8_t* Data, size_t DataLength ) {
+	int Count = 0;
+	
+	// completion is in order, so wait up to the most recent transaction that reads from Data
+	for (int i = 1; i <= Queue.Pending; i++) {
+		spi_transaction_t* SPITransaction = Queue.Transactions + (Queue.Head + SPI_QUEUE_SIZE - Queue.Pending + i - 1) % SPI_QUEUE_SIZE;
+		const uint8_t* Buffer = SPITransaction->tx_buffer;
+		if (!Data || (!(SPITransaction->flags & SPI_TRANS_USE_TXDATA) && Buffer < Data + DataLength && Buffer + SPITransaction->length / 8 > Data)) Count = i;
+	}
+	
+	SPIDefaultWait( Device->SPIHandle, Count );
 }
\ No newline at end of file
@@ -11,6 +11,7 @@
 #include <stdint.h>
 #include <arpa/inet.h>
 #include "esp_log.h"
+#include "esp_heap_caps.h"
 #include "globdefs.h"
 #include "platform_config.h"
 #include "tools.h"
@@ -22,6 +23,7 @@
 #include "gds_text.h"
 #include "gds_font.h"
 #include "gds_image.h"
+#include "task_profile.h"
 
 static const char *TAG = "display";
 
@@ -36,8 +38,11 @@ bool (*display_bus)(void *from, enum display_bus_cmd_e cmd) = NULL;
 #define HEADER_SIZE				64
 #define	DEFAULT_SLEEP			3600
 #define ARTWORK_BORDER			1
+#define ARTWORK_CACHE_SLOTS		8
+#define ARTWORK_CACHE_BUDGET	"524288"
 
 extern const uint8_t default_artwork[]   asm("_binary_note_jpg_start");
+extern const uint8_t default_artwork_end[] asm("_binary_note_jpg_end");
 
 static EXT_RAM_ATTR struct {
 	TaskHandle_t task;
@@ -65,6 +70,19 @@ static EXT_RAM_ATTR struct {
 	TickType_t tick;
 } displayer;
 
+// decoded artworks, ready to be blitted
+static EXT_RAM_ATTR struct {
+	SemaphoreHandle_t mutex;
+	size_t budget, used;
+	uint32_t age;
+	struct artwork_slot_s {
+		uint32_t hash, age;
+		size_t len, size;
+		int x, y, fit;
+		struct GDS_Device *sprite;
+	} slots[ARTWORK_CACHE_SLOTS];
+} artwork_cache;
+
 static const char *known_drivers[] = {"SH1106",
         "SH1122",
 		"SSD1306",
@@ -166,7 +184,8 @@ void display_init(char *welcome) {
 		displayer.by = 2;
 		displayer.pause = 3600;
 		displayer.speed = 33;
-		displayer.task = xTaskCreateStatic( (TaskFunction_t) displayer_task, "common_displayer", DISPLAYER_STACK_SIZE, NULL, ESP_TASK_PRIO_MIN + 1, xStack, &xTaskBuffer);
+		displayer.task = xTaskCreateStaticPinnedToCore( (TaskFunction_t) displayer_task, "common_displayer", DISPLAYER_STACK_SIZE, NULL, ESP_TASK_PRIO_MIN + 1, xStack, &xTaskBuffer,
+														task_profile_core(TASK_DISPLAY, tskNO_AFFINITY));
 		
 		// set lines for "fixed" text mode
 		GDS_TextSetFontAuto(display, 1, GDS_FONT_LINE_1, -3);
@@ -174,6 +193,15 @@ void display_init(char *welcome) {
 		
 		displayer.metadata_config = config_alloc_get(NVS_TYPE_STR, "metadata_config");
 		
+		// decoded artwork cache only makes sense when PSRAM is available
+		char *item = config_alloc_get_default(NVS_TYPE_STR, "artwork_cache", ARTWORK_CACHE_BUDGET, 0);
+		if (item && heap_caps_get_total_size(MALLOC_CAP_SPIRAM)) {
+			artwork_cache.budget = atoi(item);
+			artwork_cache.mutex = xSemaphoreCreateMutex();
+			ESP_LOGI(TAG, "Artwork cache of %zu bytes", artwork_cache.budget);
+		}	
+		free(item);
+		
 		// leave room for artwork is display is horizontal-style
 		if (strcasestr(displayer.metadata_config, "artwork")) {
 			displayer.artwork.enable = true;
@@ -273,7 +301,7 @@ static void displayer_task(void *args) {
 				// if we have not received artwork after 5s, display a default icon
 				if (displayer.artwork.active && !displayer.artwork.updated && tick - displayer.artwork.tick > pdMS_TO_TICKS(5000)) {
 					ESP_LOGI(TAG, "no artwork received, setting default");
-					displayer_artwork((uint8_t*) default_artwork);
+					displayer_artwork((uint8_t*) default_artwork, default_artwork_end - default_artwork);
 				}	
 				timer_sleep = 1000;
 			} else timer_sleep = max(1000 - elapsed, 0);	
@@ -287,10 +315,99 @@ static void displayer_task(void *args) {
 	}
 }	
 
+/****************************************************************************************
+ * Artwork is decoded once in a sprite of the whole area from (x,y) to bottom-right
+ * and then blitted when the same image comes back at the same place
+ */
+static uint32_t artwork_hash(uint8_t *data, size_t len) {
+	// FNV-1a
+	uint32_t hash = 2166136261;
+	while (len--) hash = (hash ^ *data++) * 16777619;
+	return hash;
+}
+
+bool display_draw_artwork(uint8_t *data, size_t len, int x, int y, int fit) {
+	if (!display) return false;
+	if (!artwork_cache.budget || !len) return GDS_DrawJPEG(display, data, x, y, fit);
+	
+	int width = GDS_GetWidth(display) - x, height = GDS_GetHeight(display) - y, lru = 0;
+	uint32_t hash = artwork_hash(data, len);
+	bool done = false;
+	
+	xSemaphoreTake(artwork_cache.mutex, portMAX_DELAY);
+	
+	// search a match and the oldest slot in case we need to evict one
+	for (int i = 0; i < ARTWORK_CACHE_SLOTS; i++) {
+		struct artwork_slot_s *slot = artwork_cache.slots + i;
+		if (slot->sprite && slot->hash == hash && slot->len == len && slot->x == x && slot->y == y && slot->fit == fit &&
+			GDS_GetWidth(slot->sprite) == width && GDS_GetHeight(slot->sprite) == height) {
+			slot->age = ++artwork_cache.age;
+			GDS_Blit(display, slot->sprite, x, y);
+			ESP_LOGD(TAG, "artwork cache hit %08x at slot %d", hash, i);
+			xSemaphoreGive(artwork_cache.mutex);
+			return true;
+		}
+		if (!slot->sprite || (artwork_cache.slots[lru].sprite && slot->age < artwork_cache.slots[lru].age)) lru = i;
+	}	
+	
+	size_t size = (width * height * GDS_GetDepth(display) + 7) / 8;
+	struct GDS_Device *sprite = size <= artwork_cache.budget ? GDS_CreateSprite(display, width, height) : NULL;
+	
+	// drivers with their own pixel format have byte sprites that JPEG can't be decoded in
+	if (sprite && GDS_GetDepth(sprite) != GDS_GetDepth(display)) {
+		ESP_LOGW(TAG, "artwork cache not supported by display, disabling it");
+		artwork_cache.budget = 0;
+		GDS_DeleteSprite(sprite);
+		sprite = NULL;
+	}	
+	
+	if (sprite && GDS_DrawJPEG(sprite, data, 0, 0, fit)) {
+		// make room, least recently used first
+		while (artwork_cache.used + size > artwork_cache.budget) {
+			int oldest = -1;
+			for (int i = 0; i < ARTWORK_CACHE_SLOTS; i++) {
+				if (artwork_cache.slots[i].sprite && (oldest < 0 || artwork_cache.slots[i].age < artwork_cache.slots[oldest].age)) oldest = i;
+			}	
+			GDS_DeleteSprite(artwork_cache.slots[oldest].sprite);
+			artwork_cache.slots[oldest].sprite = NULL;
+			artwork_cache.used -= artwork_cache.slots[oldest].size;
+			lru = oldest;
+		}	
+		
+		// slot might still be in use if budget was not the limit
+		struct artwork_slot_s *slot = artwork_cache.slots + lru;
+		if (slot->sprite) {
+			GDS_DeleteSprite(slot->sprite);
+			artwork_cache.used -= slot->size;
+		}	
+		
+		slot->sprite = sprite;
+		slot->hash = hash;
+		slot->len = len;
+		slot->x = x;
+		slot->y = y;
+		slot->fit = fit;
+		slot->size = size;
+		slot->age = ++artwork_cache.age;
+		artwork_cache.used += size;
+		
+		GDS_Blit(display, sprite, x, y);
+		ESP_LOGD(TAG, "artwork cache store %08x at slot %d (%zu/%zu)", hash, lru, artwork_cache.used, artwork_cache.budget);
+		done = true;
+	} else if (sprite) {
+		GDS_DeleteSprite(sprite);
+	}
+	
+	xSemaphoreGive(artwork_cache.mutex);
+	
+	// can't cache, just draw
+	return done ? true : GDS_DrawJPEG(display, data, x, y, fit);
+}
+
 /****************************************************************************************
  * 
  */
-void displayer_artwork(uint8_t *data) {
+void displayer_artwork(uint8_t *data, size_t len) {
 	if (!displayer.artwork.active) return;
 	
 	int x = displayer.artwork.offset ? displayer.artwork.offset + ARTWORK_BORDER : 0;
@@ -298,7 +415,7 @@ void displayer_artwork(uint8_t *data) {
 	GDS_ClearWindow(display, x, y, -1, -1, GDS_COLOR_BLACK);
 	if (data) {
 		displayer.artwork.updated = true;
-		GDS_DrawJPEG(display, data, x, y, GDS_IMAGE_CENTER | (displayer.artwork.fit ? GDS_IMAGE_FIT : 0));
+		display_draw_artwork(data, len, x, y, GDS_IMAGE_CENTER | (displayer.artwork.fit ? GDS_IMAGE_FILL : 0));
 	} else {
 		displayer.artwork.updated = false;
 		displayer.artwork.tick = xTaskGetTickCount();
@@ -471,13 +588,13 @@ void displayer_control(enum displayer_cmd_e cmd, ...) {
 	case DISPLAYER_SUSPEND:		
 		// task will display the line 2 from beginning and suspend
 		displayer.state = DISPLAYER_IDLE;
-		displayer_artwork(NULL);
+		displayer_artwork(NULL, 0);
 		display_bus(&displayer, DISPLAY_BUS_GIVE);
 		break;		
 	case DISPLAYER_SHUTDOWN:
 		// let the task self-suspend (we might be doing i2c_write)
 		GDS_SetTextWidth(display, 0);
-		displayer_artwork(NULL);
+		displayer_artwork(NULL, 0);
 		displayer.state = DISPLAYER_DOWN;
 		display_bus(&displayer, DISPLAY_BUS_GIVE);
 		break;
@@ -8,6 +8,7 @@
 
 #pragma once
 
+#include <stddef.h>
 #include "gds.h"
 
 
@@ -38,7 +39,8 @@ bool display_is_valid_driver(const char * driver);
 void displayer_scroll(char *string, int speed, int pause);
 void displayer_control(enum displayer_cmd_e cmd, ...);
 void displayer_metadata(char *artist, char *album, char *title);
-void displayer_artwork(uint8_t *data);
+void displayer_artwork(uint8_t *data, size_t len);
 void displayer_timer(enum displayer_time_e mode, int elapsed, int duration);
 bool displayer_can_artwork(void);
+bool display_draw_artwork(uint8_t *data, size_t len, int x, int y, int fit);
 char * display_get_supported_drivers(void);
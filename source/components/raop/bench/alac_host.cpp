@@ -0,0 +1,86 @@
+/*
+ *  Host ALAC wrapper for the rtp bench, same API as codecs/inc/alac/alac_wrapper.h
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "ALACDecoder.h"
+#include "ALACEncoder.h"
+#include "ALACBitUtilities.h"
+#include "alac_wrapper.h"
+
+struct alac_codec_s {
+	ALACDecoder *decoder;
+	unsigned block_size, channels;
+};
+
+static ALACEncoder *encoder;
+static AudioFormatDescription pcm_format, alac_format;
+
+extern "C" struct alac_codec_s *alac_create_decoder(int magic_cookie_size, unsigned char *magic_cookie,
+								unsigned char *sample_size, unsigned *sample_rate,
+								unsigned char *channels, unsigned int *block_size) {
+	struct alac_codec_s *codec = (struct alac_codec_s*) calloc(1, sizeof(struct alac_codec_s));
+
+	codec->decoder = new ALACDecoder;
+	if (codec->decoder->Init(magic_cookie, magic_cookie_size)) {
+		delete codec->decoder;
+		free(codec);
+		return NULL;
+	}
+
+	*channels = codec->channels = codec->decoder->mConfig.numChannels;
+	*sample_rate = codec->decoder->mConfig.sampleRate;
+	*sample_size = codec->decoder->mConfig.bitDepth;
+	*block_size = codec->block_size = codec->decoder->mConfig.frameLength;
+
+	return codec;
+}
+
+extern "C" void alac_delete_decoder(struct alac_codec_s *codec) {
+	delete codec->decoder;
+	free(codec);
+}
+
+extern "C" bool alac_to_pcm(struct alac_codec_s *codec, unsigned char* input,
+							unsigned char *output, char channels, unsigned *out_frames) {
+	BitBuffer bits;
+
+	BitBufferInit(&bits, input, codec->block_size * codec->channels * 4 + kALACMaxEscapeHeaderBytes);
+	return codec->decoder->Decode(&bits, output, codec->block_size, channels, out_frames) == 0;
+}
+
+/*---------------------------------------------------------------------------*/
+// encode one frame of 16 bits stereo, returns encoded size
+extern "C" int bench_alac_encode(short *pcm, int frames, unsigned char *out) {
+	int32_t size = frames * 4;
+
+	if (!encoder) {
+		memset(&pcm_format, 0, sizeof(pcm_format));
+		pcm_format.mSampleRate = 44100;
+		pcm_format.mFormatID = kALACFormatLinearPCM;
+		pcm_format.mFormatFlags = kALACFormatFlagIsSignedInteger | kALACFormatFlagIsPacked;
+		pcm_format.mBytesPerPacket = pcm_format.mBytesPerFrame = 4;
+		pcm_format.mFramesPerPacket = 1;
+		pcm_format.mChannelsPerFrame = 2;
+		pcm_format.mBitsPerChannel = 16;
+
+		alac_format = pcm_format;
+		alac_format.mFormatID = kALACFormatAppleLossless;
+		alac_format.mFormatFlags = 1;
+		alac_format.mBytesPerPacket = alac_format.mBytesPerFrame = 0;
+		alac_format.mFramesPerPacket = frames;
+		alac_format.mBitsPerChannel = 0;
+
+		encoder = new ALACEncoder;
+		encoder->SetFrameSize(frames);
+		encoder->InitializeEncoder(alac_format);
+	}
+
+	encoder->Encode(pcm_format, alac_format, (unsigned char*) pcm, out, &size);
+	return size;
+}
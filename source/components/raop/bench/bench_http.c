@@ -0,0 +1,364 @@
+/*
+ *  RTSP request parser host bench
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+/*
+Feeds util.c http_parse() through a socketpair with a scripted sender thread.
+Requests are parsed in place from the per-connection buffer, so what matters
+are the boundaries: requests split anywhere (down to one byte per write),
+several requests in one read, the byte after a body that is borrowed for its
+terminator and belongs to the next request, folded headers, LF-only lines,
+bodies too large for the buffer, bodies completed late and peers that go away
+in the middle of a request.
+
+Each scenario prints ok or the checks that failed, exit code is non-zero if any
+did not pass. Build with -fsanitize=address to catch reads outside the buffer.
+*/
+
+#include <signal.h>
+#include "../util.c"
+
+#define LARGE_SIZE		100000
+
+struct chunk_s {
+	const char *data;
+	int len;				// -1 for a string
+	int delay;				// ms before sending
+	bool dribble;			// one byte per write
+};
+
+static const char *scenario;
+static bool failed;
+static char large[LARGE_SIZE];
+
+#define CHECK(c) do { if (!(c)) { printf("%s:%d %s\n", scenario, __LINE__, #c); failed = true; } } while (0)
+
+/****************************************************************************************
+ * Stubs for log_util.c and network interfaces
+ */
+log_level util_loglevel = lERROR;
+esp_netif_t *wifi_netif, *wifi_ap_netif;
+
+const char *logtime(void) {
+	return "";
+}
+
+void logprint(const char *fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	vfprintf(stderr, fmt, args);
+	va_end(args);
+}
+
+/****************************************************************************************
+ * Sender, writes its chunks then closes its end
+ */
+struct sender_s {
+	int sock;
+	struct chunk_s *chunks;
+};
+
+static void *sender_thread(void *arg) {
+	struct sender_s *sender = arg;
+
+	for (struct chunk_s *chunk = sender->chunks; chunk->data; chunk++) {
+		int len = chunk->len < 0 ? strlen(chunk->data) : chunk->len;
+		if (chunk->delay) usleep(chunk->delay * 1000);
+		for (int i = 0; i < len; i += chunk->dribble ? 1 : len) {
+			if (chunk->dribble) usleep(1000);
+			if (write(sender->sock, chunk->data + i, chunk->dribble ? 1 : len) < 0) break;
+		}
+	}
+
+	close(sender->sock);
+	return NULL;
+}
+
+static void connect_sender(http_buf_t *http, struct sender_s *sender, pthread_t *thread, struct chunk_s *chunks, const char *name) {
+	int fds[2];
+
+	scenario = name;
+	failed = false;
+
+	socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+	sender->sock = fds[1];
+	sender->chunks = chunks;
+	pthread_create(thread, NULL, sender_thread, sender);
+
+	CHECK(http_open(http, fds[0]));
+}
+
+static bool disconnect_sender(http_buf_t *http, pthread_t thread) {
+	pthread_join(thread, NULL);
+	close(http->sock);
+	http_close(http);
+
+	printf("%-12s %s\n", scenario, failed ? "FAILED" : "ok");
+	return failed;
+}
+
+static bool is(char *s, const char *expected) {
+	return s && !strcmp(s, expected);
+}
+
+/****************************************************************************************
+ * Scenarios
+ */
+static bool run_dribble(void) {
+	struct chunk_s chunks[] = {
+		{ "SET_PARAMETER rtsp://x RTSP/1.0\r\nCSeq: 1\r\nContent-Length: 12\r\n\r\nvolume: -3.0", -1, 0, true },
+		{ NULL }
+	};
+	http_buf_t http;
+	struct sender_s sender;
+	pthread_t thread;
+	key_data_t kd[8];
+	char method[16], *body;
+	int len;
+
+	connect_sender(&http, &sender, &thread, chunks, "dribble");
+
+	CHECK(http_parse(&http, method, kd, 8, &body, &len));
+	CHECK(is(method, "SET_PARAMETER") && is(kd_lookup(kd, "CSeq"), "1"));
+	CHECK(len == 12 && is(body, "volume: -3.0"));
+	CHECK(!http_parse(&http, method, kd, 8, &body, &len));
+
+	return disconnect_sender(&http, thread);
+}
+
+static bool run_pipelined(void) {
+	struct chunk_s chunks[] = {
+		{ "OPTIONS * RTSP/1.0\r\nCSeq: 1\r\n\r\n"
+		  "SET_PARAMETER rtsp://x RTSP/1.0\r\nContent-Length: 12\r\nContent-Type: text/parameters\r\nCSeq: 2\r\n\r\nvolume: -3.0"
+		  "TEARDOWN rtsp://x RTSP/1.0\r\nCSeq: 3\r\n\r\n", -1 },
+		{ NULL }
+	};
+	http_buf_t http;
+	struct sender_s sender;
+	pthread_t thread;
+	key_data_t kd[8];
+	char method[16], *body;
+	int len;
+
+	connect_sender(&http, &sender, &thread, chunks, "pipelined");
+
+	CHECK(http_parse(&http, method, kd, 8, &body, &len));
+	CHECK(is(method, "OPTIONS") && is(kd_lookup(kd, "CSeq"), "1") && !kd[1].key && !body && !len);
+	CHECK(http_pending(&http));
+
+	CHECK(http_parse(&http, method, kd, 8, &body, &len));
+	CHECK(is(method, "SET_PARAMETER") && is(kd_lookup(kd, "CSeq"), "2"));
+	CHECK(is(kd_lookup(kd, "Content-Type"), "text/parameters"));
+	CHECK(len == 12 && is(body, "volume: -3.0"));
+	CHECK(http_pending(&http));
+
+	// first byte of this one was borrowed to terminate previous body
+	CHECK(http_parse(&http, method, kd, 8, &body, &len));
+	CHECK(is(method, "TEARDOWN") && is(kd_lookup(kd, "CSeq"), "3"));
+	CHECK(!http_pending(&http));
+
+	CHECK(!http_parse(&http, method, kd, 8, &body, &len));
+
+	return disconnect_sender(&http, thread);
+}
+
+static bool run_lines(void) {
+	struct chunk_s chunks[] = {
+		{ "GET_PARAMETER x RTSP/1.0\r\nX-Folded: a\r\n  b\r\n\tc\r\nCSeq: 1\r\n\r\n", -1 },
+		{ "\r\n\r\nTEARDOWN x RTSP/1.0\nCSeq: 2\nContent-Length: 2\n\nok", -1, 20 },
+		{ NULL }
+	};
+	http_buf_t http;
+	struct sender_s sender;
+	pthread_t thread;
+	key_data_t kd[8];
+	char method[16], *body;
+	int len;
+
+	connect_sender(&http, &sender, &thread, chunks, "lines");
+
+	CHECK(http_parse(&http, method, kd, 8, &body, &len));
+	CHECK(is(method, "GET_PARAMETER") && is(kd_lookup(kd, "X-Folded"), "a    b  \tc"));
+	CHECK(is(kd_lookup(kd, "CSeq"), "1") && !kd[2].key);
+
+	// empty lines between requests and LF-only line endings
+	CHECK(http_parse(&http, method, kd, 8, &body, &len));
+	CHECK(is(method, "TEARDOWN") && is(kd_lookup(kd, "CSeq"), "2"));
+	CHECK(len == 2 && is(body, "ok"));
+
+	CHECK(!http_parse(&http, method, kd, 8, &body, &len));
+
+	return disconnect_sender(&http, thread);
+}
+
+static bool run_large(void) {
+	char header[128];
+	struct chunk_s chunks[LARGE_SIZE / 7000 + 4] = { { header, -1 } }, *chunk = chunks + 1;
+	http_buf_t http;
+	struct sender_s sender;
+	pthread_t thread;
+	key_data_t kd[8];
+	char method[16], *body;
+	int len;
+
+	for (int i = 0; i < LARGE_SIZE; i++) large[i] = i * 7;
+	sprintf(header, "SET_PARAMETER x RTSP/1.0\r\nContent-Type: image/jpeg\r\nContent-Length: %d\r\nCSeq: 1\r\n\r\n", LARGE_SIZE);
+	for (int i = 0; i < LARGE_SIZE; i += 7000) *chunk++ = (struct chunk_s) { large + i, min(7000, LARGE_SIZE - i), 1 };
+	*chunk = (struct chunk_s) { "GET_PARAMETER x RTSP/1.0\r\nCSeq: 2\r\n\r\n", -1, 20 };
+
+	connect_sender(&http, &sender, &thread, chunks, "large");
+
+	CHECK(http_parse(&http, method, kd, 8, &body, &len));
+	CHECK(is(method, "SET_PARAMETER") && is(kd_lookup(kd, "CSeq"), "1"));
+	CHECK(len == LARGE_SIZE && body == http.body && !memcmp(body, large, len) && !body[len]);
+
+	CHECK(http_parse(&http, method, kd, 8, &body, &len));
+	CHECK(is(method, "GET_PARAMETER") && is(kd_lookup(kd, "CSeq"), "2") && !body);
+
+	CHECK(!http_parse(&http, method, kd, 8, &body, &len));
+
+	return disconnect_sender(&http, thread);
+}
+
+static bool run_late_body(void) {
+	struct chunk_s chunks[] = {
+		{ "GET_PARAMETER x RTSP/1.0\r\nCSeq: 1\r\nContent-Length: 3\r\n\r\nab", -1 },
+		{ "c", -1, 50 },
+		{ NULL }
+	};
+	http_buf_t http;
+	struct sender_s sender;
+	pthread_t thread;
+	key_data_t kd[8];
+	char method[16], *body;
+	int len;
+
+	connect_sender(&http, &sender, &thread, chunks, "late body");
+
+	CHECK(http_parse(&http, method, kd, 8, &body, &len));
+	CHECK(is(method, "GET_PARAMETER") && len == 3 && is(body, "abc"));
+
+	CHECK(!http_parse(&http, method, kd, 8, &body, &len));
+
+	return disconnect_sender(&http, thread);
+}
+
+static bool run_trailing(void) {
+	struct chunk_s chunks[] = {
+		{ "SET_PARAMETER x RTSP/1.0\r\nCSeq: 1\r\nContent-Length: 2\r\n\r\nok\r\n", -1 },
+		{ "TEARDOWN x RTSP/1.0\r\nCSeq: 2\r\n\r\n", -1, 50 },
+		{ NULL }
+	};
+	http_buf_t http;
+	struct sender_s sender;
+	pthread_t thread;
+	key_data_t kd[8];
+	char method[16], *body;
+	int len;
+
+	connect_sender(&http, &sender, &thread, chunks, "trailing");
+
+	// CR/LF after body is not a pipelined request, so caller waits on socket
+	CHECK(http_parse(&http, method, kd, 8, &body, &len));
+	CHECK(is(method, "SET_PARAMETER") && len == 2 && is(body, "ok"));
+	CHECK(!http_pending(&http));
+
+	CHECK(http_parse(&http, method, kd, 8, &body, &len));
+	CHECK(is(method, "TEARDOWN") && is(kd_lookup(kd, "CSeq"), "2"));
+
+	CHECK(!http_parse(&http, method, kd, 8, &body, &len));
+
+	return disconnect_sender(&http, thread);
+}
+
+static bool run_disconnect(void) {
+	struct chunk_s headers[] = {
+		{ "OPTIONS * RTSP/1.0\r\nCSe", -1 },
+		{ NULL }
+	}, body[] = {
+		{ "SET_PARAMETER x RTSP/1.0\r\nCSeq: 1\r\nContent-Length: 10\r\n\r\nabc", -1 },
+		{ NULL }
+	};
+	http_buf_t http;
+	struct sender_s sender;
+	pthread_t thread;
+	key_data_t kd[8];
+	char method[16], *data;
+	int len;
+	bool rc;
+
+	connect_sender(&http, &sender, &thread, headers, "cut headers");
+	CHECK(!http_parse(&http, method, kd, 8, &data, &len));
+	rc = disconnect_sender(&http, thread);
+
+	// request is delivered with what was received, connection goes next
+	connect_sender(&http, &sender, &thread, body, "cut body");
+	CHECK(http_parse(&http, method, kd, 8, &data, &len));
+	CHECK(is(method, "SET_PARAMETER") && is(data, "abc"));
+	CHECK(!http_parse(&http, method, kd, 8, &data, &len));
+	rc |= disconnect_sender(&http, thread);
+
+	return rc;
+}
+
+static bool run_limits(void) {
+	char huge[HTTP_BUF_SIZE + 64];
+	struct chunk_s many[] = {
+		{ "SET_PARAMETER * RTSP/1.0\r\nA: 1\r\nB: 2\r\nC: 3\r\nD: 4\r\nContent-Length: 2\r\n\r\nok"
+		  "OPTIONS * RTSP/1.0\r\nCSeq: 2\r\n\r\n", -1 },
+		{ NULL }
+	}, oversized[] = {
+		{ huge, -1 },
+		{ NULL }
+	};
+	http_buf_t http;
+	struct sender_s sender;
+	pthread_t thread;
+	key_data_t kd[4];
+	char method[16], *body;
+	int len;
+	bool rc;
+
+	connect_sender(&http, &sender, &thread, many, "many headers");
+	CHECK(http_parse(&http, method, kd, 4, &body, &len));
+	CHECK(is(kd[0].key, "A") && is(kd[2].data, "3") && !kd[3].key);
+	// body is still read when its Content-Length is beyond what we keep
+	CHECK(len == 2 && is(body, "ok"));
+	CHECK(http_parse(&http, method, kd, 4, &body, &len));
+	CHECK(is(method, "OPTIONS") && is(kd_lookup(kd, "CSeq"), "2"));
+	CHECK(!http_parse(&http, method, kd, 4, &body, &len));
+	rc = disconnect_sender(&http, thread);
+
+	// headers never end within the buffer
+	strcpy(huge, "OPTIONS * RTSP/1.0\r\nX-Padding: ");
+	memset(huge + strlen(huge), 'x', sizeof(huge) - strlen(huge) - 5);
+	strcpy(huge + sizeof(huge) - 5, "\r\n\r\n");
+
+	connect_sender(&http, &sender, &thread, oversized, "huge headers");
+	CHECK(!http_parse(&http, method, kd, 4, &body, &len));
+	rc |= disconnect_sender(&http, thread);
+
+	return rc;
+}
+
+int main(int argc, char *argv[]) {
+	int rc;
+
+	// a failed write on a closed connection is expected
+	signal(SIGPIPE, SIG_IGN);
+
+	rc = run_dribble();
+	rc |= run_pipelined();
+	rc |= run_lines();
+	rc |= run_large();
+	rc |= run_late_body();
+	rc |= run_trailing();
+	rc |= run_disconnect();
+	rc |= run_limits();
+
+	return rc;
+}
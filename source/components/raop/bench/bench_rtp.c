@@ -0,0 +1,653 @@
+/*
+ *  AirPlay RTP jitter buffer host bench
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+/*
+Drives rtp.c buffer_put_packet() with a synthetic AirPlay stream on a virtual
+clock: frames are ALAC-encoded, AES-CBC encrypted like a sender would do, then
+delayed, reordered, duplicated and dropped. Resend requests sent by rtp.c on
+its control socket are served (or not) by the simulated sender.
+
+Every frame handed to the data callback must either be the exact PCM of the
+frame at the read pointer or a concealed one, frames must come out in order and
+only frames that were really lost (or whose resends were lost) may be concealed. The first samples of a frame
+that follows a concealed one are cross-faded, so they are not compared.
+
+Loss patterns without any resend then measure concealment: snr_zero is the SNR
+of the whole stream if lost frames were zeroed and snr_plc is what concealment
+achieves. Both are printed so that two builds can simply be diffed.
+
+The run is captured using __RTP_STORE format, then replayed and the outputs of
+the replay must match the captured ones. Any airplay.rtpin captured on a device
+can also be replayed with
+	./bench_rtp airplay.rtpin
+
+Finally, clock recovery is fed with synthetic NTP timing exchanges over jittery
+and asymmetric links, with spikes and a drifting sender clock. The local time
+where each sync's NTP time falls is compared to the truth, for the filter and
+for the previous "last good exchange" estimate.
+*/
+
+#include <time.h>
+#include "../rtp.c"
+
+extern int bench_alac_encode(short *pcm, int frames, unsigned char *out);
+
+#define FRAME_SIZE		352
+#define FRAMES			6000
+#define FLUSH_AT		3000
+#define FLUSH_SKIP		100
+#define LATENCY			(2 * RAOP_SAMPLE_RATE)
+#define BUFFER_SIZE		(512 * 1024)
+#define MAX_EVENTS		(FRAMES * 8)
+
+static const char *fmtp_str = "96 352 0 16 40 10 14 2 255 0 0 44100";
+static const u8_t aes_key[16] = "0123456789abcdef";
+static const u8_t aes_iv[16] = "fedcba9876543210";
+
+enum { EV_PACKET, EV_SYNC, EV_FLUSH };
+
+struct pattern_s {
+	char *name;
+	int lost, hole, late, reorder, dup;		// per mille
+	int burst;								// holes are that many frames in a row
+	bool flush;
+};
+
+static struct pattern_s network = { "network", 30, 3, 2, 25, 10, 1, true };
+
+static struct pattern_s loss_patterns[] = {
+	{ "hole_1pct",   0, 10, 0, 0, 0, 1, false },
+	{ "hole_3pct",   0, 30, 0, 0, 0, 1, false },
+	{ "burst2_2pct", 0, 10, 0, 0, 0, 2, false },
+	{ "burst3_3pct", 0, 10, 0, 0, 0, 3, false },
+	{ "burst6_3pct", 0, 5, 0, 0, 0, 6, false },
+	{ NULL },
+};
+
+struct event_s {
+	u32_t time;
+	int order, type;
+	seq_t seqno;
+	u32_t rtptime;
+	bool resend;
+};
+
+static struct {
+	struct event_s events[MAX_EVENTS];
+	int count, order;
+	u8_t lost[65536];		// all copies of that frame are lost or late
+	u8_t played[65536];
+	u8_t sent[65536];		// original is not lost (but may be late)
+	seq_t last;
+	bool started, concealing;
+	u32_t outputs, silences, mismatches, unexpected, disorders, decodes, silent_frames;
+	u32_t requests, requested, useless;
+	double signal, lost_signal, plc_error;
+	u32_t first_rtptime;
+	seq_t first_seqno;
+	int sock;
+} sim;
+
+static u32_t clock_ms;
+static rtp_t *rtp;
+static u32_t rand_state = 0x12345678;
+static u8_t pool_buffer[BUFFER_SIZE];
+
+/****************************************************************************************
+ * Stubs for util.c and log_util.c
+ */
+log_level raop_loglevel = lWARN;
+
+u32_t _gettime_ms_(void) {
+	return clock_ms;
+}
+
+const char *logtime(void) {
+	static char buf[16];
+	snprintf(buf, sizeof(buf), "[%u]", clock_ms);
+	return buf;
+}
+
+void logprint(const char *fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	vfprintf(stderr, fmt, args);
+	va_end(args);
+}
+
+int bind_socket(unsigned short *port, int mode) {
+	struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+	socklen_t len = sizeof(addr);
+	int sock = socket(AF_INET, mode, 0);
+
+	bind(sock, (struct sockaddr*) &addr, sizeof(addr));
+	getsockname(sock, (struct sockaddr*) &addr, &len);
+	*port = ntohs(addr.sin_port);
+	return sock;
+}
+
+/****************************************************************************************
+ * Synthetic sender
+ */
+static u32_t random32(void) {
+	rand_state ^= rand_state << 13;
+	rand_state ^= rand_state >> 17;
+	rand_state ^= rand_state << 5;
+	return rand_state;
+}
+
+static void make_pcm(u32_t rtptime, s16_t *pcm) {
+	for (int i = 0; i < FRAME_SIZE; i++) {
+		u32_t t = rtptime + i, noise = t * 1103515245u + 12345;
+		// slow vibrato so that pitch is not exactly constant
+		double phase = t * 0.0627 + 20 * sin(t * 0.00003);
+		pcm[2*i] = 8000 * sin(phase) + 2000 * sin(2 * phase) + ((noise >> 16) & 0x3ff) - 512;
+		pcm[2*i+1] = 6000 * sin(t * 0.0211) + 3000 * sin(phase) - ((noise >> 8) & 0x1ff) + 256;
+	}
+}
+
+static int make_packet(u32_t rtptime, u8_t *packet) {
+	s16_t pcm[FRAME_SIZE * 2];
+	u8_t iv[16];
+	AES_KEY key;
+	int len;
+
+	make_pcm(rtptime, pcm);
+	len = bench_alac_encode(pcm, FRAME_SIZE, packet);
+
+	// sender encrypts full blocks only and resets IV for every packet
+	AES_set_encrypt_key(aes_key, 128, &key);
+	memcpy(iv, aes_iv, sizeof(iv));
+	AES_cbc_encrypt(packet, packet, len & ~0xf, &key, iv, AES_ENCRYPT);
+
+	return len;
+}
+
+static void schedule(u32_t time, int type, seq_t seqno, u32_t rtptime, bool resend) {
+	struct event_s *ev;
+	int i;
+
+	if (sim.count == MAX_EVENTS) return;
+
+	// keep events sorted by time, then by scheduling order
+	for (i = sim.count; i > 0 && sim.events[i-1].time > time; i--) sim.events[i] = sim.events[i-1];
+	ev = sim.events + i;
+	*ev = (struct event_s) { time, sim.order++, type, seqno, rtptime, resend };
+	sim.count++;
+}
+
+static u32_t frame_time(u32_t frame) {
+	return 1000 + (u64_t) frame * FRAME_SIZE * 1000 / RAOP_SAMPLE_RATE;
+}
+
+static void build_stream(struct pattern_s *pattern) {
+	seq_t seqno = sim.first_seqno = 65000;
+	u32_t rtptime = sim.first_rtptime = 0xfff00000;
+	u32_t resume = 0;
+	int holes = 0;
+	int hole = pattern->hole, lost = hole + pattern->lost, late = lost + pattern->late;
+	int reorder = late + pattern->reorder, dup = reorder + pattern->dup;
+
+	for (int frame = 0; frame < FRAMES; frame++, seqno++, rtptime += FRAME_SIZE) {
+		u32_t send = frame_time(frame) + resume, r = random32() % 1000;
+
+		// pause, flush and resume a bit later with a gap in sequence numbers
+		if (frame == FLUSH_AT && pattern->flush) {
+			resume = 3000;
+			seqno += FLUSH_SKIP;
+			rtptime += FLUSH_SKIP * FRAME_SIZE;
+			send = frame_time(frame) + resume;
+			schedule(send - 500, EV_FLUSH, seqno, rtptime, false);
+		}
+
+		// sync every second, like senders do
+		if (frame % 125 == 0) schedule(send, EV_SYNC, 0, rtptime, false);
+
+		send += 5 + random32() % 40;
+
+		// never lose first frames so that there is something to conceal from
+		if (frame < 32) r = 1000;
+		if (!holes && r < hole) holes = pattern->burst;
+
+		if (holes) {
+			// black hole, not even resent
+			sim.lost[seqno] = 1;
+			holes--;
+		} else if (r < lost) {
+			// lost, will be resent on request
+		} else if (r < late) {
+			// way too late to be played
+			sim.lost[seqno] = 1;
+			schedule(send + 3000, EV_PACKET, seqno, rtptime, false);
+		} else if (r < reorder) {
+			// reordered
+			sim.sent[seqno] = 1;
+			schedule(send + 10 + random32() % 50, EV_PACKET, seqno, rtptime, false);
+		} else if (r < dup) {
+			// duplicated
+			sim.sent[seqno] = 1;
+			schedule(send, EV_PACKET, seqno, rtptime, false);
+			schedule(send + 5, EV_PACKET, seqno, rtptime, false);
+		} else {
+			sim.sent[seqno] = 1;
+			schedule(send, EV_PACKET, seqno, rtptime, false);
+		}
+	}
+}
+
+// serve resend requests that rtp.c sent on its control socket
+static void serve_resend(void) {
+	u8_t req[16];
+
+	while (recv(sim.sock, req, sizeof(req), MSG_DONTWAIT) == 8) {
+		seq_t first = ntohs(*(u16_t*)(req+4)), count = ntohs(*(u16_t*)(req+6));
+
+		sim.requests++;
+		sim.requested += count;
+
+		for (seq_t seqno = first; count--; seqno++) {
+			// original was not lost, so that request was not needed
+			if (sim.sent[seqno]) sim.useless++;
+			// retransmissions get lost too
+			if (sim.lost[seqno] || random32() % 100 < 15) continue;
+			// rtptime can be derived since seqno and rtptime only jump together at flush
+			u32_t rtptime = sim.first_rtptime + (seq_t) (seqno - sim.first_seqno) * FRAME_SIZE;
+			schedule(clock_ms + 20 + random32() % 30, EV_PACKET, seqno, rtptime, true);
+		}
+	}
+}
+
+/****************************************************************************************
+ * rtp.c callbacks
+ */
+static bool cmd_cb(raop_event_t event, ...) {
+	if (event == RAOP_PLAY) sim.started = true;
+	return true;
+}
+
+static void check_cb(const u8_t *data, size_t len, u32_t playtime) {
+	seq_t seqno = rtp->ab_read;
+	u32_t rtptime = sim.first_rtptime + (seq_t) (seqno - sim.first_seqno) * FRAME_SIZE;
+	s16_t pcm[FRAME_SIZE * 2], *out = (s16_t*) data;
+	bool missing = rtp->silent_frames != sim.silent_frames;
+	int skip = 0;
+
+	sim.silent_frames = rtp->silent_frames;
+	sim.outputs++;
+	if (sim.played[seqno] || (sim.last != (seq_t) (seqno - 1) && sim.outputs > 1 && seq_order(seqno, sim.last + 1))) sim.disorders++;
+	sim.played[seqno] = 1;
+	sim.last = seqno;
+
+	make_pcm(rtptime, pcm);
+	for (int i = 0; i < FRAME_SIZE * 2; i++) sim.signal += (double) pcm[i] * pcm[i];
+
+	if (missing) {
+		sim.silences++;
+		if (!sim.lost[seqno]) sim.unexpected++;
+	} else {
+		sim.decodes++;
+		// beginning of a frame after a concealed one is cross-faded
+		if (sim.concealing) skip = PLC_OLA * 2;
+	}
+
+	if (missing || skip) {
+		for (int i = 0; i < (missing ? FRAME_SIZE * 2 : skip); i++) {
+			if (missing) sim.lost_signal += (double) pcm[i] * pcm[i];
+			sim.plc_error += (double) (pcm[i] - out[i]) * (pcm[i] - out[i]);
+		}
+	}
+
+	sim.concealing = missing;
+	if (!missing && (len != sizeof(pcm) || memcmp(pcm + skip, out + skip, len - skip * 2))) sim.mismatches++;
+}
+
+/****************************************************************************************
+ * Captured outputs, replay compares against them (a recovered frame can release a whole buffer)
+ */
+static struct {
+	struct {
+		u32_t playtime;
+		u16_t len;
+		u8_t pcm[MAX_PACKET];
+	} queue[BUFFER_FRAMES_MAX];
+	int head, tail;
+	u32_t outputs, mismatches;
+} replay;
+
+static void replay_cb(const u8_t *data, size_t len, u32_t playtime) {
+	int next = (replay.tail + 1) % BUFFER_FRAMES_MAX;
+
+	if (next == replay.head) {
+		replay.mismatches++;
+		return;
+	}
+
+	replay.queue[replay.tail].playtime = playtime;
+	replay.queue[replay.tail].len = len;
+	memcpy(replay.queue[replay.tail].pcm, data, len);
+	replay.tail = next;
+}
+
+static void replay_check(rtp_store_t *event, u8_t *pcm) {
+	replay.outputs++;
+
+	if (replay.head == replay.tail) {
+		replay.mismatches++;
+		return;
+	}
+
+	if (replay.queue[replay.head].playtime != event->time || replay.queue[replay.head].len != event->len ||
+		memcmp(replay.queue[replay.head].pcm, pcm, event->len)) replay.mismatches++;
+
+	replay.head = (replay.head + 1) % BUFFER_FRAMES_MAX;
+}
+
+/****************************************************************************************
+ * Helpers
+ */
+static int control_socket(unsigned short *port) {
+	int sock = bind_socket(port, SOCK_DGRAM);
+	fcntl(sock, F_SETFL, O_NONBLOCK);
+	return sock;
+}
+
+static rtp_t *start(char *fmtp, char *key, char *iv, unsigned short cport, raop_data_cb_t data_cb) {
+	char *fmtpstr = strdup(fmtp);
+	rtp_resp_t resp = rtp_init((struct in_addr) { htonl(INADDR_LOOPBACK) }, 0, key, iv, fmtpstr,
+								cport, 0, pool_buffer, sizeof(pool_buffer), cmd_cb, data_cb);
+	free(fmtpstr);
+
+	// there is no RTP task, packets are pushed by the bench
+	if (resp.ctx) {
+		resp.ctx->running = false;
+		resp.ctx->rtp_host.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	}
+
+	return resp.ctx;
+}
+
+static void stop(rtp_t *ctx) {
+	// the task was never created, so rtp_end won't free its buffer
+	free(ctx->xTaskBuffer);
+	rtp_end(ctx);
+}
+
+static void bench_sync(rtp_t *ctx, u32_t rtptime, u32_t time, int latency) {
+	pthread_mutex_lock(&ctx->ab_mutex);
+	ctx->latency = latency;
+	ctx->synchro.rtp = rtptime;
+	ctx->synchro.time = time;
+	ctx->synchro.status = RTP_SYNC | NTP_SYNC;
+	rtp_store(ctx, 'S', 0, rtptime, time, NULL, 0);
+	pthread_mutex_unlock(&ctx->ab_mutex);
+}
+
+static u64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/****************************************************************************************
+ * Synthetic run
+ */
+static int run_stream(struct pattern_s *pattern) {
+	unsigned short cport;
+	u64_t ns = 0;
+	u32_t packets = 0;
+	bool failed;
+
+	memset(&sim, 0, sizeof(sim));
+	sim.sock = control_socket(&cport);
+	build_stream(pattern);
+
+	rtp = start((char*) fmtp_str, (char*) aes_key, (char*) aes_iv, cport, check_cb);
+	if (!rtp) return 1;
+
+	rtp_record(rtp, sim.first_seqno, sim.first_rtptime);
+
+	for (int i = 0; i < sim.count; i++) {
+		struct event_s *ev = sim.events + i;
+		u8_t packet[MAX_PACKET];
+
+		clock_ms = ev->time;
+
+		if (ev->type == EV_SYNC) {
+			bench_sync(rtp, ev->rtptime - LATENCY, ev->time, LATENCY);
+			// timing exchange goes along sync and sees same network as resends
+			rtp_rtt_update(rtp, 20 + random32() % 30);
+		} else if (ev->type == EV_FLUSH) {
+			rtp_flush(rtp, ev->seqno, ev->rtptime, false);
+			sim.last = ev->seqno - 1;
+			sim.concealing = false;
+		} else {
+			int len = make_packet(ev->rtptime, packet);
+			u64_t t0 = now_ns();
+			buffer_put_packet(rtp, ev->seqno, ev->rtptime, false, (char*) packet, len);
+			ns += now_ns() - t0;
+			packets++;
+		}
+
+		serve_resend();
+	}
+
+	printf("%s,packets=%u,outputs=%u,decoded=%u,silent=%u,concealed=%u,unexpected=%u,disorders=%u,mismatches=%u,"
+		   "requests=%u,req=%u,useless=%u,rec=%u,discarded=%u,snr_zero=%.1f,snr_plc=%.1f,ns/packet=%.0f\n",
+			pattern->name, packets, sim.outputs, sim.decodes, sim.silences, rtp->concealed, sim.unexpected, sim.disorders,
+			sim.mismatches, sim.requests, sim.requested, sim.useless, rtp->resent_rec, rtp->discarded,
+			10 * log10(sim.signal / sim.lost_signal), 10 * log10(sim.signal / sim.plc_error), (double) ns / packets);
+
+	// retransmissions can be lost as well, but only a few frames should be unexpectedly missing
+	failed = !sim.started || sim.mismatches || sim.unexpected * 100 > sim.outputs || sim.disorders || sim.outputs < FRAMES / 2;
+	// concealment must do better than zeroing
+	if (sim.silences && sim.plc_error >= sim.lost_signal) failed = true;
+
+	stop(rtp);
+	close(sim.sock);
+
+	return failed;
+}
+
+/****************************************************************************************
+ * Replay of a capture
+ */
+static int run_replay(char *name) {
+	FILE *file = fopen(name, "rb");
+	int fmtp[32], sock;
+	char fmtpstr[256] = "", key[16], iv[16];
+	u8_t decrypt, *capture, *p;
+	unsigned short cport;
+	long size;
+
+	if (!file) return 1;
+
+	// capture is re-written by rtp_init, so load it first
+	fseek(file, 0, SEEK_END);
+	size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	capture = malloc(size);
+	size = fread(capture, 1, size, file);
+	fclose(file);
+
+	p = capture;
+	memcpy(fmtp, p, sizeof(fmtp));
+	p += sizeof(fmtp);
+	decrypt = *p++;
+	memcpy(key, p, 16);
+	memcpy(iv, p + 16, 16);
+	p += 32;
+
+	for (int i = 0; i < 12; i++) snprintf(fmtpstr + strlen(fmtpstr), sizeof(fmtpstr) - strlen(fmtpstr), "%d ", fmtp[i]);
+
+	sock = control_socket(&cport);
+	rtp = start(fmtpstr, decrypt ? key : NULL, decrypt ? iv : NULL, cport, replay_cb);
+	if (!rtp) return 1;
+
+	while (p + sizeof(rtp_store_t) <= capture + size) {
+		rtp_store_t event;
+		u8_t req[16];
+
+		memcpy(&event, p, sizeof(event));
+		p += sizeof(event);
+		if (p + event.len > capture + size) break;
+
+		clock_ms = event.now;
+
+		switch (event.type) {
+		case 'P':
+			buffer_put_packet(rtp, event.seqno, event.rtptime, false, (char*) p, event.len);
+			break;
+		case 'S':
+			bench_sync(rtp, event.rtptime, event.time, event.latency);
+			break;
+		case 'R':
+			rtp_record(rtp, event.seqno, event.rtptime);
+			break;
+		case 'F':
+			rtp_flush(rtp, event.seqno, event.rtptime, false);
+			break;
+		case 'O':
+			replay_check(&event, p);
+			break;
+		}
+
+		p += event.len;
+		while (recv(sock, req, sizeof(req), MSG_DONTWAIT) > 0);
+	}
+
+	if (replay.head != replay.tail) replay.mismatches++;
+
+	printf("replay,outputs=%u,mismatches=%u\n", replay.outputs, replay.mismatches);
+
+	stop(rtp);
+	close(sock);
+	free(capture);
+
+	return replay.mismatches || !replay.outputs;
+}
+
+/****************************************************************************************
+ * Clock recovery on timing traces
+ */
+struct trace_s {
+	char *name;
+	double base, forward, backward;	// fixed delay and mean of exponential jitter each way (ms)
+	int spikes;						// per mille of exchanges delayed by 50..300 ms
+	double skew, wander;			// sender clock drift and its sine wander amplitude (ppm)
+};
+
+static struct trace_s traces[] = {
+	{ "lan", 0.5, 0.3, 0.3, 0, 10, 0 },
+	{ "wifi", 2, 3, 8, 50, 20, 0 },
+	{ "wifi_drift", 2, 3, 8, 50, 80, 5 },
+	{ NULL },
+};
+
+#define TRACE_DURATION		(10 * 60 * 1000)
+#define TRACE_SETTLE		(30 * 1000)
+#define TRACE_WANDER		(300 * 1000.0)
+#define TRACE_EPOCH			(3900000000ULL << 32)
+#define TRACE_LOCAL			0xfff00000
+
+static double random_unit(void) {
+	return (random32() + 0.5) / 4294967296.0;
+}
+
+static double trace_delay(struct trace_s *trace, double mean) {
+	double delay = trace->base - mean * log(random_unit());
+	if (random32() % 1000 < (u32_t) trace->spikes) delay += 50 + random32() % 250;
+	return delay;
+}
+
+// sender clock (ms) at true time t (ms)
+static double trace_remote(struct trace_s *trace, double t) {
+	return 12345.678 + t * (1 + trace->skew * 1e-6) +
+		   trace->wander * 1e-6 * TRACE_WANDER / (2 * M_PI) * (1 - cos(2 * M_PI * t / TRACE_WANDER));
+}
+
+static u64_t trace_ntp(double ms) {
+	return TRACE_EPOCH + (u64_t) (ms * 4294967.296);
+}
+
+static u32_t trace_local(double t) {
+	return TRACE_LOCAL + (u32_t) floor(t);
+}
+
+struct clock_stats_s {
+	double sum, max, step, last;
+	int count;
+};
+
+static void clock_stats(struct clock_stats_s *stats, double error) {
+	if (stats->count && fabs(error - stats->last) > stats->step) stats->step = fabs(error - stats->last);
+	if (fabs(error) > stats->max) stats->max = fabs(error);
+	stats->sum += error * error;
+	stats->last = error;
+	stats->count++;
+}
+
+static int run_clock(struct trace_s *trace) {
+	struct clock_stats_s filter = { 0 }, legacy = { 0 };
+	u32_t legacy_local = 0;
+	u64_t legacy_remote = 0;
+	bool synced = false;
+	rtp_t *ctx = calloc(1, sizeof(rtp_t));
+
+	for (double t = 0; t < TRACE_DURATION; t += 1000) {
+		// timing exchange every 3 seconds, like rtp.c asks for
+		if ((int) t % 3000 == 0) {
+			double sent = t + random_unit() * 10;
+			double received = sent + trace_delay(trace, trace->forward);
+			double transmitted = received + 0.1 + random_unit();
+			double back = transmitted + trace_delay(trace, trace->backward);
+			u32_t t1 = trace_local(sent), t4 = trace_local(back);
+			u64_t t2 = trace_ntp(trace_remote(trace, received)), t3 = trace_ntp(trace_remote(trace, transmitted));
+
+			if (rtp_clock_update(ctx, t1, t4, t2, t3)) synced = true;
+			if (t4 - t1 <= 100) {
+				legacy_local = t1;
+				legacy_remote = t2;
+			}
+		}
+
+		if (!synced || !legacy_remote) continue;
+
+		// sync carries sender's NTP time when sent, truth is our local time at that instant
+		double now = t + 500 + random_unit() * 100;
+		u64_t remote = trace_ntp(trace_remote(trace, now));
+		double truth = TRACE_LOCAL + now;
+
+		if (t < TRACE_SETTLE) continue;
+
+		clock_stats(&filter, (s32_t) (rtp_clock_local(ctx, remote) - TRACE_LOCAL) - (truth - TRACE_LOCAL));
+		clock_stats(&legacy, (s32_t) (legacy_local + NTP2MS(remote - legacy_remote) - TRACE_LOCAL) - (truth - TRACE_LOCAL));
+	}
+
+	printf("clock_%s,syncs=%d,rms=%.2f,max=%.2f,step=%.2f,legacy_rms=%.2f,legacy_max=%.2f,legacy_step=%.2f,skew=%.1f\n",
+		   trace->name, filter.count, sqrt(filter.sum / filter.count), filter.max, filter.step,
+		   sqrt(legacy.sum / legacy.count), legacy.max, legacy.step, ctx->clock.skew * 1e6);
+
+	free(ctx);
+
+	// playtime has ms resolution, so 1 ms jitter is all we can ask for
+	return !filter.count || filter.step > 2 || filter.sum > legacy.sum || filter.max > legacy.max;
+}
+
+int main(int argc, char *argv[]) {
+	int rc;
+
+	if (argc > 1) return run_replay(argv[1]);
+
+	rc = run_stream(&network);
+	rc |= run_replay("airplay.rtpin");
+
+	for (struct pattern_s *pattern = loss_patterns; pattern->name; pattern++) rc |= run_stream(pattern);
+	for (struct trace_s *trace = traces; trace->name; trace++) rc |= run_clock(trace);
+
+	return rc;
+}
@@ -0,0 +1,9 @@
+/* minimal esp_heap_caps.h for the rtp bench */
+#pragma once
+
+#include <stdlib.h>
+
+#define MALLOC_CAP_INTERNAL	0
+#define MALLOC_CAP_8BIT		0
+
+#define heap_caps_malloc(size, caps) malloc(size)
@@ -0,0 +1,24 @@
+/* minimal esp_netif.h for the raop benches, there is no interface to query */
+#pragma once
+
+#include <stdint.h>
+
+typedef int esp_err_t;
+#define ESP_OK		0
+#define ESP_FAIL	-1
+
+typedef struct esp_netif_obj esp_netif_t;
+typedef struct {
+	struct { uint32_t addr; } ip, netmask, gw;
+} esp_netif_ip_info_t;
+
+// still fill results like a down interface would, callers don't check
+static inline esp_err_t esp_netif_get_ip_info(esp_netif_t *netif, esp_netif_ip_info_t *ip_info) { 
+	*ip_info = (esp_netif_ip_info_t) { 0 };
+	return ESP_FAIL; 
+}
+
+static inline esp_err_t esp_netif_get_hostname(esp_netif_t *netif, const char **hostname) { 
+	*hostname = "";
+	return ESP_FAIL; 
+}
@@ -0,0 +1,4 @@
+/* minimal esp_pthread.h for the rtp bench */
+#pragma once
+
+#include <pthread.h>
@@ -0,0 +1,4 @@
+/* minimal esp_system.h for the rtp bench */
+#pragma once
+
+#include <stdint.h>
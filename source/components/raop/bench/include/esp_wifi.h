@@ -0,0 +1,4 @@
+/* minimal esp_wifi.h for the raop benches */
+#pragma once
+
+typedef enum { ESP_IF_WIFI_STA, ESP_IF_WIFI_AP } wifi_interface_t;
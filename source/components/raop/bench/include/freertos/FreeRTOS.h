@@ -0,0 +1,31 @@
+/* minimal FreeRTOS.h for the rtp bench, the RTP task is never started */
+#pragma once
+
+#include <stdint.h>
+#include "esp_heap_caps.h"
+
+typedef uint32_t TickType_t;
+typedef uint8_t StackType_t;
+typedef struct { int dummy; } StaticTask_t;
+typedef void *TaskHandle_t;
+typedef void *TimerHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+#define pdFALSE 0
+#define portMAX_DELAY 0xffffffffUL
+#define pdMS_TO_TICKS(ms) ((TickType_t) (ms))
+
+#define CONFIG_ESP32_PTHREAD_TASK_PRIO_DEFAULT	5
+#define CONFIG_PTHREAD_TASK_CORE_DEFAULT		-1
+
+#define xTaskCreateStaticPinnedToCore(f, n, s, a, p, st, b, c) ((TaskHandle_t) NULL)
+#define xTaskGetCurrentTaskHandle() ((TaskHandle_t) NULL)
+#define ulTaskNotifyTake(c, t) ((void) 0)
+#define xTaskNotifyGive(h) do { } while (0)
+#define vTaskDelete(h) do { } while (0)
+#define vTaskSuspend(h) do { } while (0)
+
+#define xTimerCreate(n, p, r, id, f) ((TimerHandle_t) (id))
+#define xTimerStart(t, d) ((void) (t))
+#define xTimerDelete(t, d) do { } while (0)
+#define pvTimerGetTimerID(t) ((void*) (t))
@@ -0,0 +1,4 @@
+/* minimal timers.h for the rtp bench */
+#pragma once
+
+#include "freertos/FreeRTOS.h"
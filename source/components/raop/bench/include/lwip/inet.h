@@ -0,0 +1,4 @@
+/* minimal lwip/inet.h for the rtp bench, host provides it */
+#pragma once
+
+#include <netinet/in.h>
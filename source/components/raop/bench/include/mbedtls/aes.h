@@ -0,0 +1,19 @@
+/* mbedtls AES-CBC decrypt on top of host OpenSSL for the rtp bench */
+#pragma once
+
+#include <stddef.h>
+#include <openssl/aes.h>
+
+#define MBEDTLS_AES_DECRYPT	0
+
+typedef AES_KEY mbedtls_aes_context;
+
+static inline int mbedtls_aes_setkey_dec(mbedtls_aes_context *ctx, const unsigned char *key, unsigned int keybits) {
+	return AES_set_decrypt_key(key, keybits, ctx);
+}
+
+static inline int mbedtls_aes_crypt_cbc(mbedtls_aes_context *ctx, int mode, size_t length, unsigned char iv[16],
+										const unsigned char *input, unsigned char *output) {
+	AES_cbc_encrypt(input, output, length, ctx, iv, AES_DECRYPT);
+	return 0;
+}
@@ -0,0 +1,2 @@
+/* minimal mbedtls/version.h for the rtp bench */
+#pragma once
@@ -0,0 +1,4 @@
+/* minimal task_profile.h for the rtp bench */
+#pragma once
+
+#define task_profile_core(task, core) (core)
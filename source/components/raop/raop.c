@@ -25,6 +25,7 @@
 #include "mdns.h"
 #include "mbedtls/version.h"
 #include <mbedtls/x509.h>
+#include "task_profile.h"
 #endif
 
 #include "util.h"
@@ -44,6 +45,7 @@ typedef struct raop_ctx_s {
 	struct in_addr host;	// IP of bridge
 	short unsigned port;    // RTSP port for AirPlay
 	int sock;               // socket of the above
+	http_buf_t http;		// receive buffer of RTSP connection
 	struct in_addr peer;	// IP of the iDevice (airplay sender)
 	bool running;
 #ifdef WIN32
@@ -203,7 +205,8 @@ struct raop_ctx_s *raop_create(uint32_t host, char *name,
 	
     ctx->xTaskBuffer = (StaticTask_t*) heap_caps_malloc(sizeof(StaticTask_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
 	ctx->thread = xTaskCreateStaticPinnedToCore( (TaskFunction_t) rtsp_thread, "RTSP", RTSP_STACK_SIZE, ctx, 
-												 ESP_TASK_PRIO_MIN + 2, ctx->xStack, ctx->xTaskBuffer, CONFIG_PTHREAD_TASK_CORE_DEFAULT);
+												 ESP_TASK_PRIO_MIN + 2, ctx->xStack, ctx->xTaskBuffer,
+												 task_profile_core(TASK_NETWORK, CONFIG_PTHREAD_TASK_CORE_DEFAULT));
 #endif
 
 	return ctx;
@@ -393,15 +396,20 @@ static void rtsp_thread(void *arg) {
 			ctx->peer.s_addr = peer.sin_addr.s_addr;
 			ctx->abort = false;
 
-			if (sock != -1 && ctx->running) {
+			if (sock != -1 && ctx->running && http_open(&ctx->http, sock)) {
 				LOG_INFO("got RTSP connection %u", sock);
-			} else continue;
+			} else {
+				if (sock != -1) closesocket(sock);
+				sock = -1;
+				continue;
+			}
 		}
 
 		FD_ZERO(&rfds);
 		FD_SET(sock, &rfds);
 
-		n = select(sock + 1, &rfds, NULL, NULL, &timeout);
+		// a pipelined request might already be waiting in our buffer
+		n = http_pending(&ctx->http) ? 1 : select(sock + 1, &rfds, NULL, NULL, &timeout);
 		
 		if (!n && !ctx->abort) continue;
 
@@ -410,12 +418,14 @@ static void rtsp_thread(void *arg) {
 		if (n < 0 || !res || ctx->abort) {
 			cleanup_rtsp(ctx, true);
 			closesocket(sock);
+			http_close(&ctx->http);
 			LOG_INFO("RTSP close %u", sock);
 			sock = -1;
 		}
 	}
 	
 	if (sock != -1) closesocket(sock);
+	http_close(&ctx->http);
 
 #ifndef WIN32
 	xTaskNotifyGive(ctx->joiner);
@@ -434,11 +444,8 @@ static bool handle_rtsp(raop_ctx_t *ctx, int sock)
 	int len;
 	bool success = true;
 	
-	if (!http_parse(sock, method, headers, &body, &len)) {
-		NFREE(body);
-		kd_free(headers);
-		return false;
-	}
+	// headers and body are views of receive buffer, don't free them
+	if (!http_parse(&ctx->http, method, headers, sizeof(headers) / sizeof(key_data_t), &body, &len)) return false;
 	
 	if (strcmp(method, "OPTIONS")) {
 		LOG_INFO("[%p]: received %s", ctx, method);
@@ -531,7 +538,7 @@ static bool handle_rtsp(raop_ctx_t *ctx, int sock)
 		ctx->active_remote.xTaskBuffer = (StaticTask_t*) heap_caps_malloc(sizeof(StaticTask_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
 		ctx->active_remote.thread = xTaskCreateStaticPinnedToCore( (TaskFunction_t) search_remote, "search_remote", SEARCH_STACK_SIZE, ctx, 
 																	ESP_TASK_PRIO_MIN + 2, ctx->active_remote.xStack, ctx->active_remote.xTaskBuffer,
-																	CONFIG_PTHREAD_TASK_CORE_DEFAULT );
+																	task_profile_core(TASK_NETWORK, CONFIG_PTHREAD_TASK_CORE_DEFAULT) );
 #endif		
 
 	} else if (!strcmp(method, "SETUP") && ((buf = kd_lookup(headers, "Transport")) != NULL)) {
@@ -667,10 +674,8 @@ static bool handle_rtsp(raop_ctx_t *ctx, int sock)
 		LOG_INFO("[%p]: responding:\n%s", ctx, buf ? buf : "<void>");
 	}
 
-	NFREE(body);
 	NFREE(buf);
 	kd_free(resp);
-	kd_free(headers);
 
 	return true;
 }
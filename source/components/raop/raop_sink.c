@@ -113,7 +113,7 @@ static bool cmd_handler(raop_event_t event, ...) {
 	case RAOP_SETUP:
 		actrls_set(controls, false, NULL, actrls_ir_action);
 		displayer_control(DISPLAYER_ACTIVATE, "AIRPLAY", true);
-        displayer_artwork(NULL);
+        displayer_artwork(NULL, 0);
 		break;
 	case RAOP_PLAY:
 		displayer_control(DISPLAYER_TIMER_RUN);
@@ -137,7 +137,8 @@ static bool cmd_handler(raop_event_t event, ...) {
 	}	
 	case RAOP_ARTWORK: {
 		uint8_t *data = va_arg(args, uint8_t*);
-		displayer_artwork(data);
+		int len = va_arg(args, int);
+		displayer_artwork(data, len);
 		break;
 	}
 	case RAOP_PROGRESS: {
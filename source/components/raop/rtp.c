@@ -56,6 +56,7 @@
 #include <mbedtls/version.h>
 #include <mbedtls/aes.h>
 #include "alac_wrapper.h"
+#include "task_profile.h"
 #endif
 
 #define NTP2MS(ntp) ((((ntp) >> 10) * 1000L) >> 22)
@@ -82,26 +83,61 @@ static log_level 	*loglevel = &raop_loglevel;
 #define RTP_SYNC	(0x01)
 #define NTP_SYNC	(0x02)
 
-#define RESEND_TO	250
+#define RESEND_TO	250		// initial and maximum resend timeout
+#define RESEND_MIN	20
+#define RESEND_BACKOFF	3	// timeout doubles on each retry, up to that many times
+
+// clock recovery, samples kept to find the best roundtrip and Kalman noises
+#define CLOCK_WINDOW	8
+#define CLOCK_Q_OFFSET	1e-6	// ms^2 per ms
+#define CLOCK_Q_SKEW	1e-18	// (ms/ms)^2 per ms
+#define CLOCK_SKEW_MAX	500e-6
+#define CLOCK_SKEW_INIT	100e-6	// typical crystal tolerance
+#define CLOCK_OUTLIERS	3
+
+// packet loss concealment (in stereo samples)
+#define PLC_HISTORY		768
+#define PLC_WINDOW		160
+#define PLC_PITCH_MIN	40
+#define PLC_PITCH_MAX	(PLC_HISTORY - PLC_WINDOW)
+#define PLC_OLA			64
 
 enum { DATA = 0, CONTROL, TIMING };
 
-static const u8_t silence_frame[MAX_PACKET] = { 0 };
 uint32_t buffer_frames = ((150 * RAOP_SAMPLE_RATE * 2) / (352 * 100));
 
 typedef u16_t seq_t;
-typedef struct __attribute__((__packed__)) audio_buffer_entry {   // decoded audio packets
+typedef struct __attribute__((__packed__)) audio_buffer_entry {   // encoded audio packets
 	u32_t rtptime, last_resend;
-	s16_t *data;
+	u8_t *data;
     u16_t len;    
     u8_t ready;
-    u8_t allocated;
     u8_t missed;
+	u8_t resends;
 } abuf_t;
 
+// payloads are stored back-to-back in a ring, each preceded by this header
+typedef struct {
+	seq_t seqno;
+	u16_t len;
+} prec_t;
+
+#define POOL_WRAP		0xffff
+#define POOL_ALIGN(n)	(((n) + 3) & ~3)
+
+// __RTP_STORE capture records, replayed by bench/bench_rtp
+typedef struct __attribute__((__packed__)) {
+	u8_t type;					// 'P'acket, 'S'ync, 'R'ecord, 'F'lush, 'O'utput
+	u32_t now;
+	u16_t seqno;
+	u32_t rtptime, time;		// time is local sync time or output playtime
+	s32_t latency;
+	u16_t len;					// then len bytes of payload or PCM
+} rtp_store_t;
+
 typedef struct rtp_s {
 #ifdef __RTP_STORE
-	FILE *rtpIN, *rtpOUT;
+	FILE *rtpIN;
 #endif
 	bool running;
 	unsigned char aesiv[16];
@@ -111,7 +147,7 @@ typedef struct rtp_s {
 	mbedtls_aes_context aes;
 #endif
 	bool decrypt;
-	u8_t *decrypt_buf;
+	u8_t *decrypt_buf, *pcm_buf;
 	u32_t frame_size, frame_duration;
 	u32_t in_frames, out_frames;
 	struct in_addr host;
@@ -123,6 +159,19 @@ typedef struct rtp_s {
 	struct timing_s {
 		u64_t local, remote;
 	} timing;
+	struct {
+		bool valid;
+		u64_t remote0;			// references for remote NTP and local ms
+		u32_t local0;
+		double offset, skew;	// remote - local (in ms) at last update and its drift
+		double P[2][2];			// covariance of offset and skew
+		double last;
+		int outliers;
+		struct {
+			double local, offset, rtt;
+		} samples[CLOCK_WINDOW];
+		int count, next;
+	} clock;
 	struct {
 		u32_t 	rtp, time;
 		u8_t  	status;
@@ -130,10 +179,30 @@ typedef struct rtp_s {
 	int latency;			// rtp hold depth in samples
 	u32_t resent_req, resent_rec;	// total resent + recovered frames
 	u32_t silent_frames;	// total silence frames
+	u32_t concealed;		// silence frames that were concealed
 	u32_t discarded;
 	abuf_t audio_buffer[BUFFER_FRAMES_MAX];
 	seq_t ab_read, ab_write;
 	pthread_mutex_t ab_mutex;
+	struct {
+		u8_t *base;
+		size_t size, used;
+		size_t head, tail;
+		u8_t *allocated;
+	} pool;					// payloads of audio_buffer, in arrival order
+	u32_t flushes;
+	struct {
+		seq_t missing[BUFFER_FRAMES_MAX];	// frames not received yet, in order
+		int count;
+		bool measured;
+		u32_t srtt, rttvar, rto;			// from timing exchange, in ms
+		u32_t requests, given_up;
+	} resend;
+	struct {
+		s16_t *history;		// last decoded samples
+		u32_t count;		// samples concealed in current gap
+		int period;
+	} plc;
 #ifdef WIN32
 	pthread_t thread;
 #else
@@ -152,11 +221,19 @@ typedef struct rtp_s {
 
 
 #define BUFIDX(seqno) ((seq_t)(seqno) % buffer_frames)
-static void 	buffer_alloc(abuf_t *audio_buffer, int size, uint8_t *buf, size_t buf_size);
-static void 	buffer_release(abuf_t *audio_buffer);
-static void 	buffer_reset(abuf_t *audio_buffer);
+static void 	buffer_alloc(rtp_t *ctx, uint8_t *buf, size_t buf_size);
+static void 	buffer_release(rtp_t *ctx);
+static void 	buffer_reset(rtp_t *ctx);
 static void 	buffer_push_packet(rtp_t *ctx);
 static bool 	rtp_request_resend(rtp_t *ctx, seq_t first, seq_t last);
+static void 	rtp_resend_add(rtp_t *ctx, seq_t seqno);
+static void 	rtp_resend_schedule(rtp_t *ctx, u32_t now, u32_t hold);
+static void 	rtp_rtt_update(rtp_t *ctx, u32_t rtt);
+static bool 	rtp_clock_update(rtp_t *ctx, u32_t t1, u32_t t4, u64_t t2, u64_t t3);
+static u32_t 	rtp_clock_local(rtp_t *ctx, u64_t remote);
+#ifdef __RTP_STORE
+static void 	rtp_store(rtp_t *ctx, u8_t type, seq_t seqno, u32_t rtptime, u32_t time, const void *data, u16_t len);
+#endif
 static bool 	rtp_request_timing(rtp_t *ctx);
 static int	  	seq_order(seq_t a, seq_t b);
 #ifdef WIN32
@@ -230,11 +307,7 @@ rtp_resp_t rtp_init(struct in_addr host, int latency, char *aeskey, char *aesiv,
 	ctx->first_seqno = -1;
 	ctx->latency = latency;
 	ctx->ab_read = ctx->ab_write;
-
-#ifdef __RTP_STORE
-	ctx->rtpIN = fopen("airplay.rtpin", "wb");
-	ctx->rtpOUT = fopen("airplay.rtpout", "wb");
-#endif
+	ctx->resend.rto = RESEND_TO;
 
 	ctx->rtp_sockets[CONTROL].rport = pCtrlPort;
 	ctx->rtp_sockets[TIMING].rport = pTimingPort;
@@ -259,9 +332,20 @@ rtp_resp_t rtp_init(struct in_addr host, int latency, char *aeskey, char *aesiv,
 
 	// alac decoder
 	ctx->alac_codec = alac_init(fmtp);
-	rc &= ctx->alac_codec != NULL;
+	rc &= ctx->alac_codec != NULL && ctx->frame_size;
+
+	if (rc) buffer_alloc(ctx, buffer, size);
+	rc &= ctx->pool.base && ctx->pcm_buf && ctx->plc.history;
 
-	buffer_alloc(ctx->audio_buffer, ctx->frame_size*4, buffer, size);
+#ifdef __RTP_STORE
+	// header is fmtp and keys so that capture can be decoded
+	static const char nokey[16];
+	ctx->rtpIN = fopen("airplay.rtpin", "wb");
+	fwrite(fmtp, sizeof(fmtp), 1, ctx->rtpIN);
+	fwrite(&ctx->decrypt, 1, 1, ctx->rtpIN);
+	fwrite(aeskey ? aeskey : nokey, 16, 1, ctx->rtpIN);
+	fwrite(ctx->aesiv, 16, 1, ctx->rtpIN);
+#endif
 
 	// create rtp ports
 	for (i = 0; i < 3; i++) {
@@ -282,7 +366,7 @@ rtp_resp_t rtp_init(struct in_addr host, int latency, char *aeskey, char *aesiv,
 	ctx->xTaskBuffer = (StaticTask_t*) heap_caps_malloc(sizeof(StaticTask_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
 	ctx->thread = xTaskCreateStaticPinnedToCore( (TaskFunction_t) rtp_thread_func, "RTP_thread", RTP_STACK_SIZE, ctx,
 									 CONFIG_ESP32_PTHREAD_TASK_PRIO_DEFAULT + 1, ctx->xStack, ctx->xTaskBuffer,
-									 CONFIG_PTHREAD_TASK_CORE_DEFAULT );
+									 task_profile_core(TASK_NETWORK, CONFIG_PTHREAD_TASK_CORE_DEFAULT) );
 #endif
 	
 	// cleanup everything if we failed
@@ -323,14 +407,13 @@ void rtp_end(rtp_t *ctx)
 	if (ctx->decrypt_buf) free(ctx->decrypt_buf);
 	
 	pthread_mutex_destroy(&ctx->ab_mutex);
-	buffer_release(ctx->audio_buffer);
-	
-	free(ctx);
+	buffer_release(ctx);
 
 #ifdef __RTP_STORE
 	fclose(ctx->rtpIN);
-	fclose(ctx->rtpOUT);
 #endif
+
+	free(ctx);
 }
 
 /*---------------------------------------------------------------------------*/
@@ -338,13 +421,17 @@ bool rtp_flush(rtp_t *ctx, unsigned short seqno, unsigned int rtptime, bool exit
 {  
     pthread_mutex_lock(&ctx->ab_mutex);
     
+#ifdef __RTP_STORE
+	rtp_store(ctx, 'F', seqno, rtptime, 0, NULL, 0);
+#endif
+
     // always store flush seqno as we only want stricly above it, even when equal to RECORD
     ctx->first_seqno = seqno;
     bool flushed = false;
 
     // no need to stop playing if recent or equal to record - but first_seqno is needed
     if (ctx->state == RTP_PLAY) {
-        buffer_reset(ctx->audio_buffer);
+        buffer_reset(ctx);
         ctx->state = RTP_WAIT;
         flushed = true;
         LOG_INFO("[%p]: FLUSH packets below %hu - %u", ctx, seqno, rtptime);
@@ -362,44 +449,113 @@ void rtp_flush_release(rtp_t *ctx) {
 
 /*---------------------------------------------------------------------------*/
 void rtp_record(rtp_t *ctx, unsigned short seqno, unsigned rtptime) {
+#ifdef __RTP_STORE
+	rtp_store(ctx, 'R', seqno, rtptime, 0, NULL, 0);
+#endif
     ctx->first_seqno = (seqno || rtptime) ? seqno : -1;
 	ctx->state = RTP_WAIT;
 	LOG_INFO("[%p]: record %hu - %u", ctx, seqno, rtptime);	
 }
 
 /*---------------------------------------------------------------------------*/
-static void buffer_alloc(abuf_t *audio_buffer, int size, uint8_t *buf, size_t buf_size) {
-    for (buffer_frames = 0; buf && buf_size >= size && buffer_frames < BUFFER_FRAMES_MAX; buffer_frames++) {
-    	audio_buffer[buffer_frames].data = (s16_t*) buf;
-		audio_buffer[buffer_frames].allocated = 0;
-        audio_buffer[buffer_frames].ready = 0;
-        buf += size;
-        buf_size -= size;
-    }    
-    
-    LOG_INFO("allocated %d buffers (min=%d) from buffer of %zu bytes", buffer_frames, BUFFER_FRAMES_MIN, buf_size + buffer_frames * size);
-    
-    for(; buffer_frames < BUFFER_FRAMES_MIN; buffer_frames++) {
-		audio_buffer[buffer_frames].data = malloc(size);        
-		audio_buffer[buffer_frames].allocated = 1;
-		audio_buffer[buffer_frames].ready = 0;
+static void buffer_alloc(rtp_t *ctx, uint8_t *buf, size_t buf_size) {
+	size_t min_size = BUFFER_FRAMES_MIN * ctx->frame_size * 4;
+	
+	// need at least the room for the minimum of PCM frames
+	if (!buf || buf_size < min_size) {
+		buf = ctx->pool.allocated = malloc(min_size);
+		buf_size = buf ? min_size : 0;
 	}
+	
+	// payloads are compressed, so assume they take half of PCM to have more slots
+	buffer_frames = min(buf_size / (ctx->frame_size * 2), BUFFER_FRAMES_MAX);
+	for (int i = 0; i < buffer_frames; i++) ctx->audio_buffer[i].ready = 0;
+	
+	ctx->pool.base = buf ? buf + (-(uintptr_t) buf & 0x03) : NULL;
+	ctx->pool.size = (buf_size - (ctx->pool.base - buf)) & ~0x03;
+	ctx->pool.head = ctx->pool.tail = ctx->pool.used = 0;
+
+	ctx->pcm_buf = malloc(ctx->frame_size * 4);
+	ctx->plc.history = calloc(PLC_HISTORY, 4);
+
+	LOG_INFO("allocated %d buffers (min=%d) from buffer of %zu bytes", buffer_frames, BUFFER_FRAMES_MIN, buf_size);
 }
 
 /*---------------------------------------------------------------------------*/
-static void buffer_release(abuf_t *audio_buffer) {
+static void buffer_release(rtp_t *ctx) {
+	if (ctx->pool.allocated) free(ctx->pool.allocated);
+	if (ctx->pcm_buf) free(ctx->pcm_buf);
+	if (ctx->plc.history) free(ctx->plc.history);
+}
+
+/*---------------------------------------------------------------------------*/
+static void buffer_reset(rtp_t *ctx) {
 	int i;
-	for (i = 0; i < buffer_frames; i++) {
-		if (audio_buffer[i].allocated) free(audio_buffer[i].data);
+	for (i = 0; i < buffer_frames; i++) ctx->audio_buffer[i].ready = 0;
+	ctx->pool.head = ctx->pool.tail = ctx->pool.used = 0;
+	ctx->resend.count = 0;
+	ctx->flushes++;
+	// don't conceal new track with the end of the previous one
+	memset(ctx->plc.history, 0, PLC_HISTORY * 4);
+	ctx->plc.count = 0;
+}
+
+/*---------------------------------------------------------------------------*/
+// payloads at the tail can go once their frame has been played or replaced
+static void pool_reclaim(rtp_t *ctx) {
+	while (ctx->pool.used) {
+		prec_t *rec = (prec_t*) (ctx->pool.base + ctx->pool.tail);
+		size_t size = ctx->pool.size - ctx->pool.tail;
+
+		if (rec->len != POOL_WRAP) {
+			abuf_t *abuf = ctx->audio_buffer + BUFIDX(rec->seqno);
+			if (abuf->ready && abuf->data == (u8_t*) (rec + 1)) break;
+			size = sizeof(prec_t) + POOL_ALIGN(rec->len);
+		}
+
+		ctx->pool.used -= size;
+		ctx->pool.tail = (ctx->pool.tail + size) % ctx->pool.size;
 	}
+
+	if (!ctx->pool.used) ctx->pool.head = ctx->pool.tail = 0;
 }
 
 /*---------------------------------------------------------------------------*/
-static void buffer_reset(abuf_t *audio_buffer) {
-	int i;
-	for (i = 0; i < buffer_frames; i++) audio_buffer[i].ready = 0;
+static u8_t *pool_alloc(rtp_t *ctx, seq_t seqno, u16_t len) {
+	size_t size = sizeof(prec_t) + POOL_ALIGN(len);
+	prec_t *rec;
+
+	pool_reclaim(ctx);
+
+	// free space is head to tail or head to end then start to tail (needs a wrap mark)
+	if (ctx->pool.used == ctx->pool.size) return NULL;
+	if (ctx->pool.head >= ctx->pool.tail && ctx->pool.size - ctx->pool.head < size) {
+		if (ctx->pool.tail < size) return NULL;
+		((prec_t*) (ctx->pool.base + ctx->pool.head))->len = POOL_WRAP;
+		ctx->pool.used += ctx->pool.size - ctx->pool.head;
+		ctx->pool.head = 0;
+	} else if (ctx->pool.head < ctx->pool.tail && ctx->pool.tail - ctx->pool.head < size) {
+		return NULL;
+	}
+
+	rec = (prec_t*) (ctx->pool.base + ctx->pool.head);
+	rec->seqno = seqno;
+	rec->len = len;
+	ctx->pool.used += size;
+	ctx->pool.head = (ctx->pool.head + size) % ctx->pool.size;
+
+	return (u8_t*) (rec + 1);
 }
 
+#ifdef __RTP_STORE
+/*---------------------------------------------------------------------------*/
+static void rtp_store(rtp_t *ctx, u8_t type, seq_t seqno, u32_t rtptime, u32_t time, const void *data, u16_t len) {
+	rtp_store_t event = { type, gettime_ms(), seqno, rtptime, time, ctx->latency, len };
+	fwrite(&event, sizeof(event), 1, ctx->rtpIN);
+	if (len) fwrite(data, len, 1, ctx->rtpIN);
+}
+#endif
+
 /*---------------------------------------------------------------------------*/
 // the sequence numbers will wrap pretty often.
 // this returns true if the second arg is after the first
@@ -411,6 +567,7 @@ static int seq_order(seq_t a, seq_t b) {
 /*---------------------------------------------------------------------------*/
 static void alac_decode(rtp_t *ctx, s16_t *dest, char *buf, int len, u16_t *outsize) {
 	unsigned char iv[16];
+	unsigned frames = 0;
 	int aeslen;
 	assert(len<=MAX_PACKET);
 
@@ -423,20 +580,95 @@ static void alac_decode(rtp_t *ctx, s16_t *dest, char *buf, int len, u16_t *outs
 		mbedtls_aes_crypt_cbc(&ctx->aes, MBEDTLS_AES_DECRYPT, aeslen, iv, (unsigned char*) buf, ctx->decrypt_buf);
 #endif
 		memcpy(ctx->decrypt_buf+aeslen, buf+aeslen, len-aeslen);
-		alac_to_pcm(ctx->alac_codec, (unsigned char*) ctx->decrypt_buf, (unsigned char*) dest, 2, (unsigned int*) outsize);
+		alac_to_pcm(ctx->alac_codec, (unsigned char*) ctx->decrypt_buf, (unsigned char*) dest, 2, &frames);
 	} else {
-		alac_to_pcm(ctx->alac_codec, (unsigned char*) buf, (unsigned char*) dest, 2, (unsigned int*) outsize);
+		alac_to_pcm(ctx->alac_codec, (unsigned char*) buf, (unsigned char*) dest, 2, &frames);
 	}	
 	
-	*outsize *= 4;
+	*outsize = frames * 4;
 }
 
+/*---------------------------------------------------------------------------*/
+// pitch period of last decoded samples (mono), using normalized autocorrelation
+static int plc_pitch(rtp_t *ctx) {
+	s16_t *x = ctx->plc.history;
+	int period = PLC_PITCH_MAX;
+	float best = 0;
+
+	for (int p = PLC_PITCH_MIN; p <= PLC_PITCH_MAX; p++) {
+		s64_t corr = 0, energy = 0;
+
+		for (int i = PLC_HISTORY - PLC_WINDOW; i < PLC_HISTORY; i++) {
+			s32_t a = x[2*i] + x[2*i+1], b = x[2*(i-p)] + x[2*(i-p)+1];
+			corr += (s64_t) a * b;
+			energy += (s64_t) b * b;
+		}
+
+		if (corr > 0 && (float) corr * corr > best * energy) {
+			best = (float) corr * corr / energy;
+			period = p;
+		}
+	}
+
+	return period;
+}
+
+/*---------------------------------------------------------------------------*/
+// repeat last pitch period, full level for one frame then fade to zero over two
+static void plc_synth(rtp_t *ctx, s16_t *out, int count) {
+	s16_t *src = ctx->plc.history + 2 * (PLC_HISTORY - ctx->plc.period);
+	u32_t fade = ctx->frame_size * 2;
+
+	for (int i = 0; i < count; i++, ctx->plc.count++) {
+		u32_t n = ctx->plc.count;
+		s32_t gain = n < ctx->frame_size ? 32768 : n < ctx->frame_size + fade ? ((ctx->frame_size + fade - n) << 15) / fade : 0;
+		int j = n % ctx->plc.period;
+
+		out[2*i] = (src[2*j] * gain) >> 15;
+		out[2*i+1] = (src[2*j+1] * gain) >> 15;
+	}
+}
+
+/*---------------------------------------------------------------------------*/
+// synthesize a missing frame from the previous ones
+static void plc_conceal(rtp_t *ctx, s16_t *out) {
+	if (!ctx->plc.count) ctx->plc.period = plc_pitch(ctx);
+	if (ctx->plc.count < ctx->frame_size * 3) ctx->concealed++;
+	plc_synth(ctx, out, ctx->frame_size);
+}
+
+/*---------------------------------------------------------------------------*/
+// cross-fade out of a concealed gap and keep decoded samples for next one
+static void plc_update(rtp_t *ctx, s16_t *pcm, int frames) {
+	if (ctx->plc.count) {
+		s16_t synth[PLC_OLA * 2];
+		int count = min(frames, PLC_OLA);
+
+		plc_synth(ctx, synth, count);
+		for (int i = 0; i < count * 2; i++) {
+			pcm[i] = (synth[i] * (count - i / 2) + pcm[i] * (i / 2)) / count;
+		}
+
+		ctx->plc.count = 0;
+	}
+
+	if (frames < PLC_HISTORY) {
+		memmove(ctx->plc.history, ctx->plc.history + 2 * frames, (PLC_HISTORY - frames) * 4);
+		memcpy(ctx->plc.history + 2 * (PLC_HISTORY - frames), pcm, frames * 4);
+	} else {
+		memcpy(ctx->plc.history, pcm + 2 * (frames - PLC_HISTORY), PLC_HISTORY * 4);
+	}
+}
 
 /*---------------------------------------------------------------------------*/
 static void buffer_put_packet(rtp_t *ctx, seq_t seqno, unsigned rtptime, bool first, char *data, int len) {
 	abuf_t *abuf = NULL;
 
 	pthread_mutex_lock(&ctx->ab_mutex);
+
+#ifdef __RTP_STORE
+	rtp_store(ctx, 'P', seqno, rtptime, 0, data, len);
+#endif
     
     /* if we have received a RECORD with a seqno, then this is the first allowed rtp sequence number 
 	 * and we are in RTP_WAIT state. If seqno was 0, then we are waiting for a flush that will tell 
@@ -454,7 +686,8 @@ static void buffer_put_packet(rtp_t *ctx, seq_t seqno, unsigned rtptime, bool fi
 	if (ctx->state == RTP_WAIT) {
 		ctx->ab_write = seqno - 1;
 		ctx->ab_read = ctx->ab_write + 1;
-        ctx->resent_req = ctx->resent_rec = ctx->silent_frames = ctx->discarded = 0;        
+		ctx->resend.count = 0;
+        ctx->resent_req = ctx->resent_rec = ctx->silent_frames = ctx->concealed = ctx->discarded = 0;        
 		if (ctx->first_seqno != -1) {
         	LOG_INFO("[%p]: 1st accepted packet:%d, now playing", ctx, seqno);                                    
 			ctx->state = RTP_PLAY;
@@ -490,23 +723,30 @@ static void buffer_put_packet(rtp_t *ctx, seq_t seqno, unsigned rtptime, bool fi
 		if (ctx->latency && seq_order(ctx->latency / ctx->frame_size, seqno - ctx->ab_write - 1)) {
 			// this is a shitstorm, reset buffer
             LOG_WARN("[%p] too many missing frames %hu seq: %hu, (W:%hu R:%hu)", ctx, seqno - ctx->ab_write - 1, seqno, ctx->ab_write, ctx->ab_read);
-            ctx->ab_read = seqno;            
+            ctx->ab_read = seqno;
+			ctx->resend.count = 0;
+			// payloads of abandoned frames can be reclaimed
+			for (int i = 0; i < buffer_frames; i++) ctx->audio_buffer[i].ready = 0;
 		} else {
-            // request re-send missed frames and evaluate resent date as a whole *after*
-            if (ctx->state == RTP_PLAY) rtp_request_resend(ctx, ctx->ab_write + 1, seqno-1);
-            
-            // resend date is after all requests have been sent
             u32_t now = gettime_ms();
             
-            // set expected timing of missed frames for buffer_push_packet and set last_resend date
+            // set expected timing of missed frames, resend requests are scheduled by buffer_push_packet
             for (seq_t i = ctx->ab_write + 1; seq_order(i, seqno); i++) {
-                ctx->audio_buffer[BUFIDX(i)].rtptime = rtptime - (seqno-i)*ctx->frame_size;
-                ctx->audio_buffer[BUFIDX(i)].last_resend = now;
+				abuf_t *frame = ctx->audio_buffer + BUFIDX(i);
+                frame->rtptime = rtptime - (seqno-i)*ctx->frame_size;
+                frame->last_resend = now;
+				frame->resends = 0;
+				frame->ready = 0;
+				rtp_resend_add(ctx, i);
             }
             LOG_DEBUG("[%p]: packet newer seqno:%hu rtptime:%u (W:%hu R:%hu)", ctx, seqno, rtptime, ctx->ab_write, ctx->ab_read);            
         }        
 
 		ctx->ab_write = seqno;
+	} else if (abuf->ready && abuf->rtptime == rtptime) {
+		// duplicated packet, already have it
+		LOG_DEBUG("[%p]: packet duplicated seqno:%hu rtptime:%u (W:%hu R:%hu)", ctx, seqno, rtptime, ctx->ab_write, ctx->ab_read);
+		abuf = NULL;
 	} else if (seq_order(ctx->ab_read, seqno + 1)) {
 		// recovered packet, not yet sent
 		ctx->resent_rec++;
@@ -522,21 +762,51 @@ static void buffer_put_packet(rtp_t *ctx, seq_t seqno, unsigned rtptime, bool fi
 		ctx->in_frames = 0;
 	}
 
-	if (abuf) {
-		alac_decode(ctx, abuf->data, data, len, &abuf->len);
+	// only keep the payload, decoding is done when frame is sent
+	if (abuf && (abuf->data = pool_alloc(ctx, seqno, len)) != NULL) {
+		memcpy(abuf->data, data, len);
+		abuf->len = len;
 		abuf->ready = 1;
         abuf->missed = 0;
 		// this is the local rtptime when this frame is expected to play
 		abuf->rtptime = rtptime;
-		buffer_push_packet(ctx);
+	} else if (abuf) {
+		// handle it like a missing frame so that it is requested again
+		LOG_WARN("[%p]: no room for packet seqno:%hu (W:%hu R:%hu)", ctx, seqno, ctx->ab_write, ctx->ab_read);
+		abuf->ready = 0;
+		abuf->rtptime = rtptime;
+		abuf->last_resend = gettime_ms();
+		abuf->resends = 0;
+		rtp_resend_add(ctx, seqno);
+	}
+
+	if (abuf) buffer_push_packet(ctx);
+
+	pthread_mutex_unlock(&ctx->ab_mutex);
+}
+
+/*---------------------------------------------------------------------------*/
+// decode a frame and send it, mutex is released while decoding
+static bool buffer_send_frame(rtp_t *ctx, abuf_t *frame, u32_t playtime) {
+	u32_t flushes = ctx->flushes;
+	u16_t outsize;
+
+	// only RTP thread adds frames, so just a flush can happen while unlocked
+	pthread_mutex_unlock(&ctx->ab_mutex);
+	alac_decode(ctx, (s16_t*) ctx->pcm_buf, (char*) frame->data, frame->len, &outsize);
+	pthread_mutex_lock(&ctx->ab_mutex);
+
+	if (flushes != ctx->flushes) return false;
+
+	plc_update(ctx, (s16_t*) ctx->pcm_buf, outsize / 4);
 
 #ifdef __RTP_STORE
-		fwrite(data, len, 1, ctx->rtpIN);
-		fwrite(abuf->data, abuf->len, 1, ctx->rtpOUT);
+	rtp_store(ctx, 'O', ctx->ab_read, frame->rtptime, playtime, ctx->pcm_buf, outsize);
 #endif
-	}
 
-	pthread_mutex_unlock(&ctx->ab_mutex);
+	ctx->data_cb(ctx->pcm_buf, outsize, playtime);
+	frame->ready = 0;
+	return true;
 }
 
 /*---------------------------------------------------------------------------*/
@@ -563,17 +833,19 @@ static void buffer_push_packet(rtp_t *ctx) {
 			curframe->ready = 0;
 		} else if (playtime - now <= hold) {
 			if (curframe->ready) {
-				ctx->data_cb((const u8_t*) curframe->data, curframe->len, playtime);
-				curframe->ready = 0;
+				if (!buffer_send_frame(ctx, curframe, playtime)) return;
 			} else {
-				LOG_DEBUG("[%p]: created zero frame (W:%hu R:%hu)", ctx, ctx->ab_write, ctx->ab_read);
-				ctx->data_cb(silence_frame, ctx->frame_size * 4, playtime);
+				LOG_DEBUG("[%p]: concealed missing frame (W:%hu R:%hu)", ctx, ctx->ab_write, ctx->ab_read);
+				plc_conceal(ctx, (s16_t*) ctx->pcm_buf);
 				ctx->silent_frames++;
                 curframe->missed = 1;
+#ifdef __RTP_STORE
+				rtp_store(ctx, 'O', ctx->ab_read, curframe->rtptime, playtime, ctx->pcm_buf, ctx->frame_size * 4);
+#endif
+				ctx->data_cb(ctx->pcm_buf, ctx->frame_size * 4, playtime);
 			}
 		} else if (curframe->ready) {
-			ctx->data_cb((const u8_t*) curframe->data, curframe->len, playtime);
-			curframe->ready = 0;
+			if (!buffer_send_frame(ctx, curframe, playtime)) return;
 		} else {
 			break;
 		}
@@ -584,31 +856,16 @@ static void buffer_push_packet(rtp_t *ctx) {
 	} while (seq_order(ctx->ab_read, ctx->ab_write));
 
 	if (ctx->out_frames > 1000) {
-		LOG_INFO("[%p]: drain [level:%hd head:%d ms] [W:%hu R:%hu] [req:%u sil:%u dis:%u]",
+		LOG_INFO("[%p]: drain [level:%hd head:%d ms] [W:%hu R:%hu] [req:%u/%u lost:%u rto:%u] [sil:%u plc:%u dis:%u]",
 				ctx, ctx->ab_write - ctx->ab_read, playtime - now, ctx->ab_write, ctx->ab_read,
-				ctx->resent_req, ctx->silent_frames, ctx->discarded);
+				ctx->resent_req, ctx->resend.requests, ctx->resend.given_up, ctx->resend.rto,
+				ctx->silent_frames, ctx->concealed, ctx->discarded);
 		ctx->out_frames = 0;
 	}
 
 	LOG_SDEBUG("playtime %u %d [W:%hu R:%hu] %d", playtime, playtime - now, ctx->ab_write, ctx->ab_read, curframe->ready);
    
-    // try to request resend missing packet in order, explore up to 32 frames
-    for (int step = max((ctx->ab_write - ctx->ab_read + 1) / 32, 1), 
-         i = 0, first = 0; 
-         seq_order(ctx->ab_read + i, ctx->ab_write); i += step) {
-             
-        abuf_t* frame = ctx->audio_buffer + BUFIDX(ctx->ab_read + i);
-
-        // stop when we reach a ready frame or a recent pending resend
-        if (first && (frame->ready || now - frame->last_resend <= RESEND_TO)) {
-            if (!rtp_request_resend(ctx, first, ctx->ab_read + i - 1)) break;
-            first = 0;
-            i += step - 1;
-        } else if (!frame->ready && now - frame->last_resend > RESEND_TO) {
-            if (!first) first = ctx->ab_read + i;
-            frame->last_resend = now;
-        }
-    }
+	rtp_resend_schedule(ctx, now, hold);
 }
 
 
@@ -730,11 +987,15 @@ static void rtp_thread_func(void *arg) {
 				if (ctx->latency < MIN_LATENCY) ctx->latency = MIN_LATENCY;
 				else if (ctx->latency > MAX_LATENCY) ctx->latency = MAX_LATENCY;
 				ctx->synchro.rtp = rtp_now - ctx->latency;
-				ctx->synchro.time = ctx->timing.local + remote_gap;
+				ctx->synchro.time = rtp_clock_local(ctx, remote);
 
 				// now we are synced on RTP frames
 				ctx->synchro.status |= RTP_SYNC;
 
+#ifdef __RTP_STORE
+				rtp_store(ctx, 'S', 0, ctx->synchro.rtp, ctx->synchro.time, NULL, 0);
+#endif
+
 				// 1st sync packet received (signals a restart of playback)
 				if (packet[0] & 0x10) {
 					LOG_INFO("[%p]: 1st sync packet received", ctx);
@@ -754,31 +1015,31 @@ static void rtp_thread_func(void *arg) {
 			case 0x53: {
 				u32_t reference   = ntohl(*(u32_t*)(pktp+12)); // only low 32 bits in our case
 				u64_t remote 	  =(((u64_t) ntohl(*(u32_t*)(pktp+16))) << 32) + ntohl(*(u32_t*)(pktp+20));
-				u32_t roundtrip   = gettime_ms() - reference;
-				
-				// better discard sync packets when roundtrip is suspicious
-				if (roundtrip > 100) {
-					// ask for another one only if we are not synced already
-					if (!(ctx->synchro.status & NTP_SYNC)) rtp_request_timing(ctx);
+				u64_t transmit	  =(((u64_t) ntohl(*(u32_t*)(pktp+24))) << 32) + ntohl(*(u32_t*)(pktp+28));
+				u32_t now		  = gettime_ms();
+				u32_t roundtrip   = now - reference;
+
+				// even suspicious roundtrips tell how long a resend would take
+				rtp_rtt_update(ctx, roundtrip);
+
+				// all samples go to the clock filter, it only uses the best ones
+				bool good = rtp_clock_update(ctx, reference, now, remote, transmit);
+
+				// but don't start playing with a suspicious one
+				if (!good && !(ctx->synchro.status & NTP_SYNC)) {
+					rtp_request_timing(ctx);
 					LOG_WARN("[%p]: discarding NTP roundtrip of %u ms", ctx, roundtrip);
 					break;
 				}
 
-				/*
-				  The expected elapsed remote time should be exactly the same as
-				  elapsed local time between the two request, corrected by the
-				  drifting
-				u64_t expected = ctx->timing.remote + MS2NTP(reference - ctx->timing.local);
-				*/
-
 				ctx->timing.remote = remote;
 				ctx->timing.local = reference;
 
 				// now we are synced on NTP (mutex not needed)
 				ctx->synchro.status |= NTP_SYNC;
 
-				LOG_DEBUG("[%p]: Timing references local:%llu, remote:%llx (delta:%lld, sum:%lld, adjust:%lld, gaps:%d)",
-						  ctx, ctx->timing.local, ctx->timing.remote);
+				LOG_DEBUG("[%p]: Timing references local:%llu, remote:%llx (offset:%.3f ms, skew:%.2f ppm, roundtrip:%u)",
+						  ctx, ctx->timing.local, ctx->timing.remote, ctx->clock.offset, ctx->clock.skew * 1e6, roundtrip);
 
 				break;
 			}
@@ -859,6 +1120,170 @@ static bool rtp_request_resend(rtp_t *ctx, seq_t first, seq_t last) {
         return false;
 	}
 
+	ctx->resend.requests++;
 	return true;
 }
 
+/*---------------------------------------------------------------------------*/
+// add a missing frame, keeping set in sequence order (it is nearly always the last)
+static void rtp_resend_add(rtp_t *ctx, seq_t seqno) {
+	int i = ctx->resend.count;
+
+	if (i == BUFFER_FRAMES_MAX) return;
+	while (i && seq_order(seqno, ctx->resend.missing[i-1])) i--;
+	if (i && ctx->resend.missing[i-1] == seqno) return;
+
+	memmove(ctx->resend.missing + i + 1, ctx->resend.missing + i, (ctx->resend.count - i) * sizeof(seq_t));
+	ctx->resend.missing[i] = seqno;
+	ctx->resend.count++;
+}
+
+/*---------------------------------------------------------------------------*/
+// request due frames by contiguous ranges and drop the ones that can't arrive in time
+static void rtp_resend_schedule(rtp_t *ctx, u32_t now, u32_t hold) {
+	seq_t first = 0, last = 0;
+	int i, count = 0;
+	bool pending = false;
+
+	for (i = 0; i < ctx->resend.count; i++) {
+		seq_t seqno = ctx->resend.missing[i];
+		abuf_t *frame = ctx->audio_buffer + BUFIDX(seqno);
+		u32_t playtime = ctx->synchro.time + ((frame->rtptime - ctx->synchro.rtp) * 10) / (RAOP_SAMPLE_RATE / 100);
+		// first request waits a bit for re-ordered packets, then back-off exponentially
+		u32_t wait = frame->resends ? ctx->resend.rto << min(frame->resends - 1, RESEND_BACKOFF) : ctx->frame_duration * 2;
+
+		// received or already played
+		if (frame->ready || seq_order(seqno, ctx->ab_read)) continue;
+
+		// missing frames are played when they are within hold, so a resend must arrive before
+		if ((s32_t) (playtime - hold - now) <= (s32_t) ctx->resend.srtt) {
+			LOG_DEBUG("[%p]: giving up on frame %hu (resends:%u)", ctx, seqno, frame->resends);
+			ctx->resend.given_up++;
+			continue;
+		}
+
+		ctx->resend.missing[count++] = seqno;
+		if (now - frame->last_resend < wait) continue;
+
+		frame->last_resend = now;
+		frame->resends++;
+
+		if (pending && seqno == (seq_t) (last + 1)) {
+			last = seqno;
+			continue;
+		}
+
+		if (pending) rtp_request_resend(ctx, first, last);
+		first = last = seqno;
+		pending = true;
+	}
+
+	if (pending) rtp_request_resend(ctx, first, last);
+	ctx->resend.count = count;
+}
+
+/*---------------------------------------------------------------------------*/
+// smoothed roundtrip and resend timeout (RFC 6298)
+static void rtp_rtt_update(rtp_t *ctx, u32_t rtt) {
+	if (!ctx->resend.measured) {
+		ctx->resend.srtt = rtt;
+		ctx->resend.rttvar = rtt / 2;
+		ctx->resend.measured = true;
+	} else {
+		ctx->resend.rttvar = (3 * ctx->resend.rttvar + abs((int) (ctx->resend.srtt - rtt))) / 4;
+		ctx->resend.srtt = (7 * ctx->resend.srtt + rtt) / 8;
+	}
+
+	ctx->resend.rto = min(max(ctx->resend.srtt + max(4 * ctx->resend.rttvar, 10), RESEND_MIN), RESEND_TO);
+}
+
+/*---------------------------------------------------------------------------*/
+static double ntp_to_ms(u64_t ntp, u64_t reference) {
+	return (s64_t) (ntp - reference) * (1000.0 / 4294967296.0);
+}
+
+/*---------------------------------------------------------------------------*/
+// NTP-like clock filter: the sample with minimum roundtrip over the last few
+// exchanges feeds a Kalman filter estimating remote offset and skew
+static bool rtp_clock_update(rtp_t *ctx, u32_t t1, u32_t t4, u64_t t2, u64_t t3) {
+	int i, best = 0;
+
+	if (!ctx->clock.valid && !ctx->clock.count) {
+		ctx->clock.remote0 = t2;
+		ctx->clock.local0 = t1;
+	}
+
+	// midpoints on both sides cancel symmetric delays, remote processing time is not part of roundtrip
+	double local = ((s32_t) (t1 - ctx->clock.local0) + (s32_t) (t4 - ctx->clock.local0)) / 2.0;
+	double remote = (ntp_to_ms(t2, ctx->clock.remote0) + ntp_to_ms(t3, ctx->clock.remote0)) / 2;
+	double rtt = (t4 - t1) - ntp_to_ms(t3, t2);
+
+	i = ctx->clock.next;
+	ctx->clock.samples[i].local = local;
+	ctx->clock.samples[i].offset = remote - local;
+	ctx->clock.samples[i].rtt = max(rtt, 0);
+	ctx->clock.next = (i + 1) % CLOCK_WINDOW;
+	if (ctx->clock.count < CLOCK_WINDOW) ctx->clock.count++;
+
+	for (i = 1; i < ctx->clock.count; i++) {
+		if (ctx->clock.samples[i].rtt < ctx->clock.samples[best].rtt) best = i;
+	}
+
+	// ms resolution on local clock and unknown delay asymmetry
+	double z = ctx->clock.samples[best].offset;
+	double R = (ctx->clock.samples[best].rtt * ctx->clock.samples[best].rtt + 1) / 12;
+	double dt = ctx->clock.samples[best].local - ctx->clock.last;
+
+	if (!ctx->clock.valid) {
+		ctx->clock.offset = z;
+		ctx->clock.skew = 0;
+		ctx->clock.P[0][0] = R;
+		ctx->clock.P[0][1] = ctx->clock.P[1][0] = 0;
+		ctx->clock.P[1][1] = CLOCK_SKEW_INIT * CLOCK_SKEW_INIT;
+		ctx->clock.last = ctx->clock.samples[best].local;
+		ctx->clock.outliers = 0;
+		ctx->clock.valid = true;
+		return rtt <= 100;
+	}
+
+	// best sample has already been used
+	if (dt <= 0) return ctx->clock.samples[best].rtt <= 100;
+
+	// predict
+	double offset = ctx->clock.offset + ctx->clock.skew * dt;
+	double P00 = ctx->clock.P[0][0] + 2 * dt * ctx->clock.P[0][1] + dt * dt * ctx->clock.P[1][1] +
+				 CLOCK_Q_OFFSET * dt + CLOCK_Q_SKEW * dt * dt * dt / 3;
+	double P01 = ctx->clock.P[0][1] + dt * ctx->clock.P[1][1] + CLOCK_Q_SKEW * dt * dt / 2;
+	double P11 = ctx->clock.P[1][1] + CLOCK_Q_SKEW * dt;
+
+	// reject outliers but restart when remote clock has really jumped
+	double y = z - offset, S = P00 + R;
+	if (y * y > 9 * S && ++ctx->clock.outliers <= CLOCK_OUTLIERS) return false;
+	if (ctx->clock.outliers > CLOCK_OUTLIERS) {
+		LOG_INFO("[%p]: remote clock jumped by %.1f ms", ctx, y);
+		ctx->clock.valid = false;
+		ctx->clock.count = 0;
+		return rtp_clock_update(ctx, t1, t4, t2, t3);
+	}
+
+	// update
+	double K0 = P00 / S, K1 = P01 / S;
+	ctx->clock.offset = offset + K0 * y;
+	ctx->clock.skew += K1 * y;
+	ctx->clock.skew = max(min(ctx->clock.skew, CLOCK_SKEW_MAX), -CLOCK_SKEW_MAX);
+	ctx->clock.P[0][0] = (1 - K0) * P00;
+	ctx->clock.P[0][1] = ctx->clock.P[1][0] = (1 - K0) * P01;
+	ctx->clock.P[1][1] = P11 - K1 * P01;
+	ctx->clock.last = ctx->clock.samples[best].local;
+	ctx->clock.outliers = 0;
+
+	return ctx->clock.samples[best].rtt <= 100;
+}
+
+/*---------------------------------------------------------------------------*/
+// local time (ms) when remote clock will be at this NTP time
+static u32_t rtp_clock_local(rtp_t *ctx, u64_t remote) {
+	// solve remote = local + offset + skew * (local - last)
+	double local = (ntp_to_ms(remote, ctx->clock.remote0) - ctx->clock.offset + ctx->clock.skew * ctx->clock.last) / (1 + ctx->clock.skew);
+	return ctx->clock.local0 + (s32_t) floor(local + 0.5);
+}
@@ -52,7 +52,7 @@ extern log_level	util_loglevel;
 static log_level 		*loglevel = &util_loglevel;
 
 static char *ltrim(char *s);
-static int read_line(int fd, char *line, int maxlen, int timeout);
+static int http_read(http_buf_t *http, int timeout);
 
 /*----------------------------------------------------------------------------*/
 /* 																			  */
@@ -86,7 +86,8 @@ in_addr_t get_localhost(char **name)
 	}
 	else return INADDR_ANY;
 #else
-	tcpip_adapter_ip_info_t ipInfo; 
+	// interfaces might not exist yet, then results are not filled
+	tcpip_adapter_ip_info_t ipInfo = { 0 };
 	tcpip_adapter_if_t if_type = TCPIP_ADAPTER_IF_STA;
 
 	// then get IP address
@@ -100,7 +101,7 @@ in_addr_t get_localhost(char **name)
 
 	// get hostname if required
 	if (name) {
-		const char *hostname;
+		const char *hostname = "";
 		tcpip_adapter_get_hostname(if_type, &hostname);
 		*name = strdup(hostname);
 	}	
@@ -368,120 +369,204 @@ static char *ltrim(char *s)
 /*----------------------------------------------------------------------------*/
 
 /*----------------------------------------------------------------------------*/
-bool http_parse(int sock, char *method, key_data_t *rkd, char **body, int *len)
+bool http_open(http_buf_t *http, int sock)
 {
-	char line[256], *dp;
-	unsigned j;
-	int i, timeout = 100;
+	memset(http, 0, sizeof(http_buf_t));
+	http->sock = sock;
+	http->size = HTTP_BUF_SIZE;
+	http->data = malloc(http->size);
+	http->saved = -1;
 
-	rkd[0].key = NULL;
+	return http->data != NULL;
+}
 
-	if ((i = read_line(sock, line, sizeof(line), timeout)) <= 0) {
-		if (i < 0) {
-			LOG_ERROR("cannot read method", NULL);
-		}
-		return false;
+
+/*----------------------------------------------------------------------------*/
+void http_close(http_buf_t *http)
+{
+	NFREE(http->data);
+	NFREE(http->body);
+	http->fill = http->used = 0;
+}
+
+
+/*----------------------------------------------------------------------------*/
+bool http_pending(http_buf_t *http)
+{
+	// CR/LF left after a body are not a request, first byte might be borrowed
+	for (int i = http->used; http->data && i < http->fill; i++) {
+		int c = i == http->used && http->saved >= 0 ? http->saved : http->data[i];
+		if (c != '\r' && c != '\n') return true;
 	}
 
-	if (!sscanf(line, "%s", method)) {
-		LOG_ERROR("missing method", NULL);
-		return false;
+	return false;
+}
+
+
+/*----------------------------------------------------------------------------*/
+static int http_read(http_buf_t *http, int timeout)
+{
+	struct pollfd pfds = { http->sock, POLLIN, 0 };
+	int bytes;
+
+	if (!poll(&pfds, 1, timeout)) return 0;
+
+	bytes = recv(http->sock, http->data + http->fill, http->size - http->fill, 0);
+
+	if (bytes < 0) {
+		if (errno == EAGAIN) return 0;
+		LOG_ERROR("fd: %d read error: %s", http->sock, strerror(errno));
+	} else if (!bytes) {
+		LOG_INFO("disconnected on the other end %u", http->sock);
+	} else {
+		http->fill += bytes;
 	}
 
-	i = *len = 0;
+	return bytes;
+}
 
-	while (read_line(sock, line, sizeof(line), timeout) > 0) {
 
-		LOG_SDEBUG("sock: %u, received %s", line);
+/*----------------------------------------------------------------------------*/
+/* Headers are parsed in place, so rkd points into the connection buffer and is
+ * only valid until next call. Body is zero-copy as well unless it does not fit
+ * and it must not be freed either. The byte after the body is borrowed for its
+ * '\0' terminator as it belongs to the next (pipelined) request                */
+bool http_parse(http_buf_t *http, char *method, key_data_t *rkd, int max, char **body, int *len)
+{
+	char *line, *next, *end, *dp;
+	int i, scan = 0, start = -1, headers = 0, size = 0;
 
-		// line folding should be deprecated
-		if (i && rkd[i].key && (line[0] == ' ' || line[0] == '\t')) {
-			for(j = 0; j < strlen(line); j++) if (line[j] != ' ' && line[j] != '\t') break;
-			rkd[i].data = realloc(rkd[i].data, strlen(rkd[i].data) + strlen(line + j) + 1);
-			strcat(rkd[i].data, line + j);
-			continue;
+	rkd[0].key = NULL;
+	*body = NULL;
+	*len = 0;
+	NFREE(http->body);
+
+	// give back borrowed byte and reclaim what previous request used
+	if (http->saved >= 0) http->data[http->used] = http->saved;
+	http->saved = -1;
+	memmove(http->data, http->data + http->used, http->fill - http->used);
+	http->fill -= http->used;
+	http->used = 0;
+
+	while (1) {
+		// skip empty lines between requests
+		if (start < 0) {
+			while (http->used < http->fill && (http->data[http->used] == '\r' || http->data[http->used] == '\n')) http->used++;
+			if (http->used < http->fill) start = scan = http->used;
 		}
 
-		dp = strstr(line,":");
-
-		if (!dp){
-			LOG_ERROR("Request failed, bad header", NULL);
-			kd_free(rkd);
-			return false;
+		// headers end with an empty line, only scan what has just been received
+		for (i = scan; start >= 0 && i < http->fill && !headers; i++) {
+			if (http->data[i] != '\n') continue;
+			if (i == start || (i == start + 1 && http->data[start] == '\r')) headers = i + 1;
+			else start = i + 1;
 		}
 
-		*dp = 0;
-		rkd[i].key = strdup(line);
-		rkd[i].data = strdup(ltrim(dp + 1));
+		if (headers) break;
+		scan = http->fill;
 
-		if (!strcasecmp(rkd[i].key, "Content-Length")) *len = atol(rkd[i].data);
+		if (http->fill == http->size) {
+			LOG_ERROR("request headers too large %d", http->fill);
+			return false;
+		}
 
-		i++;
-		rkd[i].key = NULL;
+		if ((i = http_read(http, 100)) <= 0) {
+			if (i < 0) {
+				LOG_ERROR("cannot read method", NULL);
+			}
+			return false;
+		}
 	}
 
-	if (*len) {
-		int size = 0;
+	line = http->data + http->used;
+	end = http->data + headers;
 
-		*body = malloc(*len + 1);
-		while (*body && size < *len) {
-			int bytes = recv(sock, *body + size, *len - size, 0);
-			if (bytes <= 0) break;
-			size += bytes;
+	// line folding should be deprecated, it is equivalent to a space
+	for (dp = line; dp < end - 1; dp++) {
+		if (*dp == '\n' && (dp[1] == ' ' || dp[1] == '\t')) {
+			*dp = ' ';
+			if (dp > line && dp[-1] == '\r') dp[-1] = ' ';
 		}
+	}
 
-		(*body)[*len] = '\0';
+	// all lines are terminated in place
+	for (dp = line; dp < end; dp++) if (*dp == '\r' || *dp == '\n') *dp = '\0';
 
-		if (!*body || size != *len) {
-			LOG_ERROR("content length receive error %d %d", *len, size);
-		}
+	for (i = 0; i < 15 && line[i] && !isspace((int) line[i]); i++) method[i] = line[i];
+	method[i] = '\0';
+
+	if (!*method) {
+		LOG_ERROR("missing method", NULL);
+		return false;
 	}
 
-	return true;
-}
+	for (i = 0, line += strlen(line) + 1; line < end; line = next) {
+		next = line + strlen(line) + 1;
+		if (!*line) continue;
 
+		LOG_SDEBUG("sock: %u, received %s", http->sock, line);
 
-/*----------------------------------------------------------------------------*/
-static int read_line(int fd, char *line, int maxlen, int timeout)
-{
-	int i,rval;
-	int count=0;
-	struct pollfd pfds;
-	char ch;
-
-	*line = 0;
-	pfds.fd = fd;
-	pfds.events = POLLIN;
-
-	for(i = 0; i < maxlen; i++){
-		if (poll(&pfds, 1, timeout)) rval=recv(fd, &ch, 1, 0);
-		else return 0;
-
-		if (rval == -1) {
-			if (errno == EAGAIN) return 0;
-			LOG_ERROR("fd: %d read error: %s", fd, strerror(errno));
-			return -1;
+		if ((dp = strchr(line, ':')) == NULL) {
+			LOG_ERROR("Request failed, bad header", NULL);
+			rkd[0].key = NULL;
+			return false;
 		}
 
-		if (rval == 0) {
-			LOG_INFO("disconnected on the other end %u", fd);
-			return 0;
+		*dp = '\0';
+		dp = ltrim(dp + 1);
+
+		// body must be consumed even if we can't keep its header
+		if (!strcasecmp(line, "Content-Length")) *len = atol(dp);
+
+		if (i == max - 1) {
+			LOG_WARN("too many headers, ignoring %s", line);
+			continue;
 		}
 
-		if (ch == '\n') {
-			*line=0;
-			return count;
+		rkd[i].key = line;
+		rkd[i].data = dp;
+
+		i++;
+		rkd[i].key = NULL;
+	}
+
+	http->used = headers;
+
+	if (*len <= 0) {
+		*len = 0;
+		return true;
+	}
+
+	if (headers + *len < http->size) {
+		// body fits, so does its terminator
+		while (http->fill < headers + *len && http_read(http, -1) > 0);
+		size = min(http->fill - headers, *len);
+		*body = http->data + headers;
+	} else if ((http->body = malloc(*len + 1)) != NULL) {
+		// large ones (artwork) have their own buffer and nothing can be after them
+		size = http->fill - headers;
+		memcpy(http->body, http->data + headers, size);
+
+		while (size < *len) {
+			int bytes = recv(http->sock, http->body + size, *len - size, 0);
+			if (bytes <= 0) break;
+			size += bytes;
 		}
 
-		if (ch=='\r') continue;
+		*body = http->body;
+	}
+
+	if (*body) {
+		http->used = min(http->fill, headers + size);
+		if (*body != http->body) http->saved = (unsigned char) http->data[http->used];
+		(*body)[size] = '\0';
+	}
 
-		*line++=ch;
-		count++;
-		if (count >= maxlen-1) break;
+	if (!*body || size != *len) {
+		LOG_ERROR("content length receive error %d %d", *len, size);
 	}
 
-	*line = 0;
-	return count;
+	return true;
 }
 
 
@@ -76,7 +76,20 @@ int 		conn_socket(unsigned short port);typedef struct {
 	char *data;
 } key_data_t;
 
-bool 		http_parse(int sock, char *method, key_data_t *rkd, char **body, int *len);char*		http_send(int sock, char *method, key_data_t *rkd);
+#define HTTP_BUF_SIZE	4096
+
+// per-connection receive buffer, requests are parsed in place
+typedef struct {
+	int sock;
+	char *data, *body;
+	int size, fill, used;
+	int saved;				// byte borrowed to terminate body or -1
+} http_buf_t;
+
+bool		http_open(http_buf_t *http, int sock);
+void		http_close(http_buf_t *http);
+bool		http_pending(http_buf_t *http);
+bool 		http_parse(http_buf_t *http, char *method, key_data_t *rkd, int max, char **body, int *len);char*		http_send(int sock, char *method, key_data_t *rkd);
 
 char*		kd_lookup(key_data_t *kd, char *key);
 bool 		kd_add(key_data_t *kd, char *key, char *value);
@@ -67,16 +67,31 @@ static void task_stats( cJSON* top ) {
 #ifdef CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
 #pragma message("Compiled with runtime stats")
 	uint32_t elapsed = current.total - previous.total;
+	// run time is per core, last slot is for tasks without affinity
+	uint32_t busy[portNUM_PROCESSORS + 1] = { 0 }, idle[portNUM_PROCESSORS] = { 0 };
 
 	for(int i = 0, n = 0; i < current.n; i++ ) {
 		for (int j = 0; j < previous.n; j++) {
 			if (current.tasks[i].xTaskNumber == previous.tasks[j].xTaskNumber) {
-				n += snprintf(scratch + n, SCRATCH_SIZE - n, "%16s (%u) %2lu%% s:%5lu", current.tasks[i].pcTaskName,
+				uint32_t delta = current.tasks[i].ulRunTimeCounter - previous.tasks[j].ulRunTimeCounter;
+				BaseType_t core = xTaskGetCoreID(current.tasks[i].xHandle);
+				if (core < 0 || core >= portNUM_PROCESSORS) core = -1;
+
+				bool is_idle = false;
+				for (int k = 0; k < portNUM_PROCESSORS; k++) {
+					if (current.tasks[i].xHandle != xTaskGetIdleTaskHandleForCore(k)) continue;
+					idle[k] = delta;
+					is_idle = true;
+				}
+				if (!is_idle) busy[core < 0 ? portNUM_PROCESSORS : core] += delta;
+
+				n += snprintf(scratch + n, SCRATCH_SIZE - n, "%16s (%u) %2lu%% c:%2d s:%5lu", current.tasks[i].pcTaskName,
 																			   current.tasks[i].eCurrentState,
-																			   (unsigned long)(100 * (current.tasks[i].ulRunTimeCounter - previous.tasks[j].ulRunTimeCounter) / elapsed),
+																			   (unsigned long)(100 * delta / elapsed), (int) core,
 																			   (unsigned long)current.tasks[i].usStackHighWaterMark);
 				cJSON * t=cJSON_CreateObject();
-				cJSON_AddNumberToObject(t,"cpu",100 * (current.tasks[i].ulRunTimeCounter - previous.tasks[j].ulRunTimeCounter) / elapsed);
+				cJSON_AddNumberToObject(t,"cpu",100 * delta / elapsed);
+				cJSON_AddNumberToObject(t,"core",core);
 				cJSON_AddNumberToObject(t,"minstk",current.tasks[i].usStackHighWaterMark);
 				cJSON_AddNumberToObject(t,"bprio",current.tasks[i].uxBasePriority);
 				cJSON_AddNumberToObject(t,"cprio",current.tasks[i].uxCurrentPriority);
@@ -92,6 +107,25 @@ static void task_stats( cJSON* top ) {
 			}
 		}
 	}
+
+	// per-core load is what idle did not get, pinned tasks share tells who used it
+	if (previous.tasks && elapsed) {
+		cJSON * clist=cJSON_CreateArray();
+		int n = 0;
+		for (int k = 0; k < portNUM_PROCESSORS; k++) {
+			cJSON * c=cJSON_CreateObject();
+			unsigned long load = idle[k] < elapsed ? 100 - 100ULL * idle[k] / elapsed : 0;
+			cJSON_AddNumberToObject(c,"core",k);
+			cJSON_AddNumberToObject(c,"load",load);
+			cJSON_AddNumberToObject(c,"pinned",100ULL * busy[k] / elapsed);
+			cJSON_AddItemToArray(clist,c);
+			n += snprintf(scratch + n, SCRATCH_SIZE - n, "core %d: %2lu%% (pinned %2lu%%) ", k, load, (unsigned long)(100ULL * busy[k] / elapsed));
+		}
+		snprintf(scratch + n, SCRATCH_SIZE - n, "unpinned %2lu%%", (unsigned long)(100ULL * busy[portNUM_PROCESSORS] / elapsed));
+		cJSON_AddNumberToObject(top,"unpinned",100ULL * busy[portNUM_PROCESSORS] / elapsed);
+		cJSON_AddItemToObject(top,"cores",clist);
+		ESP_LOGI(TAG, "%s", scratch);
+	}
 #else
 #pragma message("Compiled WITHOUT runtime stats")
 
@@ -26,6 +26,7 @@
 #include "messaging.h"
 #include "buttons.h"
 #include "services.h"
+#include "task_profile.h"
 
 extern void battery_svc_init(void);
 extern void monitor_svc_init(void);
@@ -352,6 +353,7 @@ void services_sleep_setsleeper(uint32_t (*sleeper)(void)) {
  */
 void services_init(void) {
 	messaging_service_init();
+	task_profile_init();
 	gpio_install_isr_service(0);
 
 #ifdef CONFIG_I2C_LOCKED
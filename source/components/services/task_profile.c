@@ -0,0 +1,60 @@
+/*
+ *  Squeezelite for esp32
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+/*
+Placement of the pipeline tasks on the two cores, read once from NVS key
+"task_pinning" by services_init, before any of these tasks is created, so
+that the table is then read-only. When empty, every task keeps the core it has always been
+created on. "dual" keeps the audio path (output, decode) on core 1 and moves
+what competes with it (stream, network, display, web) on core 0 with WiFi.
+Each class can then be overridden with <class>=<core>, -1 meaning no affinity,
+e.g. "dual,stream=1" or "display=0".
+*/
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include "esp_log.h"
+#include "platform_config.h"
+#include "task_profile.h"
+
+static const char *TAG = "task_profile";
+
+static const char *names[TASK_CLASS_MAX] = { "output", "decode", "stream", "network", "display", "web" };
+static const BaseType_t dual[TASK_CLASS_MAX] = { 1, 1, 0, 0, 0, 0 };
+
+// -2 means legacy placement
+static BaseType_t cores[TASK_CLASS_MAX] = { -2, -2, -2, -2, -2, -2 };
+
+/****************************************************************************************
+ * parse NVS profile, must be called once at startup
+ */
+void task_profile_init(void) {
+	char *config = config_alloc_get_default(NVS_TYPE_STR, "task_pinning", "", 0);
+
+	if (config && *config) {
+		bool profile = strcasestr(config, "dual") != NULL;
+
+		for (int i = 0; i < TASK_CLASS_MAX; i++) {
+			int core = profile ? dual[i] : -2;
+			PARSE_PARAM(config, names[i], '=', core);
+			if (core >= portNUM_PROCESSORS || core < -2) core = -2;
+			cores[i] = core == -1 ? tskNO_AFFINITY : core;
+			if (core != -2) ESP_LOGI(TAG, "%s tasks on core %d", names[i], core);
+		}
+	}
+
+	free(config);
+}
+
+/****************************************************************************************
+ * core where a task of that class shall be created
+ */
+BaseType_t task_profile_core(task_class_e class, BaseType_t legacy_core) {
+	return cores[class] == -2 ? legacy_core : cores[class];
+}
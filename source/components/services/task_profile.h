@@ -0,0 +1,16 @@
+/*
+ *  Squeezelite for esp32
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+typedef enum { TASK_OUTPUT, TASK_DECODE, TASK_STREAM, TASK_NETWORK, TASK_DISPLAY, TASK_WEB, TASK_CLASS_MAX } task_class_e;
+
+void task_profile_init(void);
+BaseType_t task_profile_core(task_class_e class, BaseType_t legacy_core);
@@ -95,7 +95,7 @@ const static actrls_t controls = {
 void got_artwork(uint8_t* data, size_t len, void *context) {
 	if (data) {
 		ESP_LOGI(TAG, "got artwork of %zu bytes", len);
-		displayer_artwork(data);
+		displayer_artwork(data, len);
 		free(data);
 	} else {
 		ESP_LOGW(TAG, "artwork error or too large %zu", len);
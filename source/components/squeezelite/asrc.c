@@ -0,0 +1,110 @@
+/*
+ *  Squeezelite for esp32
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+/*
+Asynchronous sample rate converter used by external sinks to absorb the clock
+drift between the source and the DAC. It is a 4-points cubic (Catmull-Rom)
+interpolator running at a fractional ratio that a PI controller moves by a few
+ppm, so that drift is corrected continuously instead of by skipping or pausing
+whole blocks, which is audible on sustained tones.
+
+Sinks always deliver 16 bits stereo, so input is s16 and output is ISAMPLE_T.
+At 0 ppm and null phase, output is the input delayed by 2 frames, bit-exact.
+*/
+
+#include <math.h>
+#include "squeezelite.h"
+#include "asrc.h"
+
+#define ASRC_KP			20.0f		// ppm per ms of error
+#define ASRC_KI			0.1f		// ppm per ms.s of accumulated error
+#define ASRC_ONE		(1ULL << 32)
+
+#if BYTES_PER_FRAME == 4
+#define SAMPLE_MAX	32767.0f
+#define SAMPLE_MIN	-32768.0f
+#define SAMPLE_SCALE	1.0f
+#else
+#define SAMPLE_MAX	2147483520.0f
+#define SAMPLE_MIN	-2147483648.0f
+#define SAMPLE_SCALE	65536.0f
+#endif
+
+/****************************************************************************************
+ * back to unity ratio with empty history, optionally bypassed
+ */
+void asrc_reset(struct asrc_s *asrc, bool enabled) {
+	memset(asrc, 0, sizeof(*asrc));
+	asrc->enabled = enabled;
+	asrc->pos = ASRC_ONE;
+	asrc->step = ASRC_ONE;
+}
+
+/****************************************************************************************
+ * feed error (ms, positive when we would play too early) measured over interval (ms)
+ */
+void asrc_control(struct asrc_s *asrc, int error, u32_t interval) {
+	float limit = ASRC_MAX_PPM / ASRC_KI;
+
+	// integrator is clamped so that it alone can't exceed the correction range
+	asrc->integral += error * (interval / 1000.0f);
+	if (asrc->integral > limit) asrc->integral = limit;
+	else if (asrc->integral < -limit) asrc->integral = -limit;
+
+	asrc->ppm = -(ASRC_KP * error + ASRC_KI * asrc->integral);
+	if (asrc->ppm > ASRC_MAX_PPM) asrc->ppm = ASRC_MAX_PPM;
+	else if (asrc->ppm < -ASRC_MAX_PPM) asrc->ppm = -ASRC_MAX_PPM;
+
+	asrc->step = (u64_t) llroundf(asrc->ppm * 4294.967296f) + ASRC_ONE;
+}
+
+/****************************************************************************************
+ * frame k of the virtual history + input array
+ */
+static inline const s16_t *frame(struct asrc_s *asrc, const s16_t *in, frames_t k) {
+	return k < 3 ? asrc->hist[k] : in + (k - 3) * 2;
+}
+
+/****************************************************************************************
+ * resample up to out_frames frames, returns frames produced and sets input frames consumed
+ */
+frames_t asrc_process(struct asrc_s *asrc, const s16_t *in, frames_t in_frames, ISAMPLE_T *out, frames_t out_frames, frames_t *consumed) {
+	frames_t done = 0, idx = asrc->pos >> 32;
+	s16_t hist[3][2];
+
+	// interpolation is between idx and idx + 1, so idx + 2 must be available
+	while (idx < in_frames + 1 && done < out_frames) {
+		const s16_t *xm1 = frame(asrc, in, idx - 1), *x0 = frame(asrc, in, idx);
+		const s16_t *x1 = frame(asrc, in, idx + 1), *x2 = frame(asrc, in, idx + 2);
+		float mu = (u32_t) asrc->pos * (1.0f / ASRC_ONE);
+
+		for (int ch = 0; ch < 2; ch++) {
+			float c1 = 0.5f * (x1[ch] - xm1[ch]);
+			float c2 = xm1[ch] - 2.5f * x0[ch] + 2 * x1[ch] - 0.5f * x2[ch];
+			float c3 = 0.5f * (x2[ch] - xm1[ch]) + 1.5f * (x0[ch] - x1[ch]);
+			float v = (((c3 * mu + c2) * mu + c1) * mu + x0[ch]) * SAMPLE_SCALE;
+			*out++ = v >= SAMPLE_MAX ? (ISAMPLE_T) SAMPLE_MAX : (v <= SAMPLE_MIN ? (ISAMPLE_T) SAMPLE_MIN : (ISAMPLE_T) v);
+		}
+
+		asrc->pos += asrc->step;
+		idx = asrc->pos >> 32;
+		done++;
+	}
+
+	// a step larger than 1 can move idx beyond input, so we can't always start next
+	// history at idx - 1 but we can always do it from the last frame of input
+	*consumed = min(idx - 1, in_frames);
+
+	// keep 3 frames from there for next time and re-base position on it
+	for (int i = 0; i < 3; i++) memcpy(hist[i], frame(asrc, in, *consumed + i), sizeof(hist[i]));
+	memcpy(asrc->hist, hist, sizeof(hist));
+
+	asrc->pos -= (u64_t) *consumed << 32;
+
+	return done;
+}
@@ -0,0 +1,22 @@
+/*
+ *  Squeezelite for esp32
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#pragma once
+
+#define ASRC_MAX_PPM	500
+
+struct asrc_s {
+	bool enabled;
+	u64_t pos, step;		// Q32 position in history + input, Q32 input frames per output frame
+	s16_t hist[3][2];		// last input frames still needed by the interpolator
+	float ppm, integral;	// current correction and PI integrator (ms.s)
+};
+
+void asrc_reset(struct asrc_s *asrc, bool enabled);
+void asrc_control(struct asrc_s *asrc, int error, u32_t interval);
+frames_t asrc_process(struct asrc_s *asrc, const s16_t *in, frames_t in_frames, ISAMPLE_T *out, frames_t out_frames, frames_t *consumed);
@@ -0,0 +1,621 @@
+/*
+ *  Squeezelite for esp32
+ *
+ *  Host benchmark of the output pipeline
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+/*
+Runs _output_frames() the way the i2s output thread does, but with a write
+callback that stops at the staging buffer instead of calling i2s_write. Each
+case is measured on a freshly filled outputbuf so that in-place gain does not
+decay the samples across iterations.
+
+Results are printed as CSV on stdout, one line per case, so that two builds can
+simply be diffed. The checksum column is computed on the staging buffer and must
+not change unless the DSP itself is meant to change.
+*/
+
+#include <math.h>
+#include <time.h>
+#include <sched.h>
+#include "squeezelite.h"
+#include "biquad.h"
+#include "asrc.h"
+#include "spdif.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define get_cycles() __rdtsc()
+#else
+#define get_cycles() 0ULL
+#endif
+
+#define FRAME_BLOCK		MAX_SILENCE_FRAMES
+#define BUF_FRAMES		(FRAME_BLOCK * 8)
+#define FILL_FRAMES		(FRAME_BLOCK * 7)
+#define CROSS_FRAMES	(FRAME_BLOCK * 4)
+#define ITERATIONS		2000
+#define WARMUP			20
+
+extern struct outputstate output;
+extern struct buffer *outputbuf;
+extern u8_t *silencebuf;
+
+static u8_t *obuf, *pristine;
+static frames_t oframes;
+
+struct bench_case {
+	char *name;
+	u32_t gain;
+	u8_t flags;
+	bool invert, cross, silence;
+};
+
+static struct bench_case cases[] = {
+	{ "unity",      FIXED_ONE, 0, false, false, false },
+	{ "gain",       0x8000, 0, false, false, false },
+	{ "invert",     0x8000, 0, true, false, false },
+	{ "mono_left",  0x8000, MONO_LEFT, false, false, false },
+	{ "mono_mix",   0x8000, MONO_LEFT | MONO_RIGHT, false, false, false },
+	{ "crossfade",  FIXED_ONE, 0, false, true, false },
+	{ "cross_gain", 0x8000, 0, false, true, false },
+	{ "silence",    FIXED_ONE, 0, false, false, true },
+	{ NULL },
+};
+
+struct eq_case {
+	char *name;
+	u32_t rate;
+	int bands;
+	bool ramp;
+};
+
+static struct eq_case eq_cases[] = {
+	{ "eq3_44k",        44100, 3, false },
+	{ "eq10_44k",       44100, 10, false },
+	{ "eq10_96k",       96000, 10, false },
+	{ "eq10_192k",      192000, 10, false },
+	{ "eq10_ramp_44k",  44100, 10, true },
+	{ NULL },
+};
+
+/****************************************************************************************
+ * Same processing as output_i2s.c write callback, minus visu and i2s_write
+ */
+static int _bench_write_frames(frames_t out_frames, bool silence, s32_t gainL, s32_t gainR, u8_t flags,
+								s32_t cross_gain_in, s32_t cross_gain_out, ISAMPLE_T **cross_ptr) {
+	if (!silence) {
+		bool cross = output.fade == FADE_ACTIVE && output.fade_dir == FADE_CROSS;
+		_apply_and_pack(obuf + oframes * BYTES_PER_FRAME, outputbuf, out_frames, gainL, gainR, flags, 
+						cross_gain_in, cross_gain_out, cross ? cross_ptr : NULL);
+	} else {
+		memcpy(obuf + oframes * BYTES_PER_FRAME, silencebuf, out_frames * BYTES_PER_FRAME);
+	}
+
+	oframes += out_frames;
+	return out_frames;
+}
+
+/****************************************************************************************
+ * Reset outputbuf and output state before each run
+ */
+static void prepare(struct bench_case *c) {
+	memcpy(outputbuf->buf, pristine, BUF_FRAMES * BYTES_PER_FRAME);
+	outputbuf->readp = outputbuf->buf;
+	outputbuf->writep = outputbuf->buf + FILL_FRAMES * BYTES_PER_FRAME;
+
+	output.state = c->silence ? OUTPUT_STOPPED : OUTPUT_RUNNING;
+	output.gainL = output.gainR = c->gain;
+	output.invert = c->invert;
+	output.channels = c->flags;
+	output.fade = FADE_INACTIVE;
+
+	// start halfway through the crossfade so that both tracks are mixed
+	if (c->cross) {
+		output.fade = FADE_ACTIVE;
+		output.fade_dir = FADE_CROSS;
+		output.fade_mode = FADE_CROSSFADE;
+		output.fade_start = outputbuf->wrap - CROSS_FRAMES / 2 * BYTES_PER_FRAME;
+		output.fade_end = outputbuf->readp + CROSS_FRAMES / 2 * BYTES_PER_FRAME;
+	}
+
+	oframes = 0;
+}
+
+static u32_t checksum(u8_t *p, size_t len) {
+	u32_t hash = 2166136261u;
+	while (len--) hash = (hash ^ *p++) * 16777619u;
+	return hash;
+}
+
+static u64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/****************************************************************************************
+ * Run one case
+ */
+static void run(struct bench_case *c, int iterations) {
+	u64_t ns = 0, cycles = 0, frames = 0;
+	u32_t hash = 0;
+
+	for (int i = -WARMUP; i < iterations; i++) {
+		prepare(c);
+
+		u64_t t0 = now_ns(), c0 = get_cycles();
+		_output_frames(FRAME_BLOCK);
+		u64_t c1 = get_cycles(), t1 = now_ns();
+
+		if (i < 0) continue;
+		if (!i) hash = checksum(obuf, oframes * BYTES_PER_FRAME);
+
+		ns += t1 - t0;
+		cycles += c1 - c0;
+		frames += oframes;
+	}
+
+	printf("%s,%d,%u,%d,%.3f,%.2f,%.0f,%08x\n", c->name, BYTES_PER_FRAME, FRAME_BLOCK, iterations,
+			(double) ns / frames, (double) cycles / frames, frames * 1e9 / ns, hash);
+}
+
+/****************************************************************************************
+ * Run one equalizer case, on unity output (same as equalizer_process)
+ */
+static void run_eq(struct eq_case *c, int iterations) {
+	static const float freqs[BIQUAD_MAX_BANDS] = { 31.25, 62.5, 125, 250, 500, 1000, 2000, 4000, 8000, 16000 };
+	float gains[BIQUAD_MAX_BANDS] = { 0 };
+	struct biquad_bank_s bank = { 0 };
+	u64_t ns = 0, cycles = 0, frames = 0;
+	u32_t hash = 0;
+
+	for (int i = 0; i < c->bands; i++) gains[i] = (i & 1) ? -3 : 6;
+
+	for (int i = -WARMUP; i < iterations; i++) {
+		prepare(&cases[0]);
+		_output_frames(FRAME_BLOCK);
+
+		// start from flat and ramp over the whole block if requested
+		memset(&bank, 0, sizeof(bank));
+		biquad_init(&bank, freqs, BIQUAD_MAX_BANDS, 1.414f, c->rate);
+		biquad_set_gains(&bank, gains, c->ramp ? FRAME_BLOCK : 0);
+
+		u64_t t0 = now_ns(), c0 = get_cycles();
+		biquad_process(&bank, (ISAMPLE_T*) obuf, oframes);
+		u64_t c1 = get_cycles(), t1 = now_ns();
+
+		if (i < 0) continue;
+		if (!i) hash = checksum(obuf, oframes * BYTES_PER_FRAME);
+
+		ns += t1 - t0;
+		cycles += c1 - c0;
+		frames += oframes;
+	}
+
+	printf("%s,%d,%u,%d,%.3f,%.2f,%.0f,%08x\n", c->name, BYTES_PER_FRAME, FRAME_BLOCK, iterations,
+			(double) ns / frames, (double) cycles / frames, frames * 1e9 / ns, hash);
+}
+
+/****************************************************************************************
+ * Lowest band boosted at a given rate against a double precision direct form, on low
+ * frequency content where float biquads lose most. Returns failure when the error is 
+ * above what output sample rounding alone would give
+ */
+static int run_eq_precision(u32_t rate) {
+	static const float freqs[BIQUAD_MAX_BANDS] = { 31.25, 62.5, 125, 250, 500, 1000, 2000, 4000, 8000, 16000 };
+	float gains[BIQUAD_MAX_BANDS] = { 6 };
+	struct biquad_bank_s bank = { 0 };
+	frames_t frames = BUF_FRAMES / 2;
+	ISAMPLE_T *samples = malloc(frames * BYTES_PER_FRAME);
+	double *ref = malloc(frames * sizeof(double));
+	double scale = BYTES_PER_FRAME == 8 ? 2147483647.0 : 32767.0, power = 0, error = 0, snr;
+	double A = pow(10, 6 / 40.0), w0 = 2 * M_PI * freqs[0] / rate, alpha = sin(w0) / (2 * 1.414), a0 = 1 + alpha / A;
+	double b[3] = { (1 + alpha * A) / a0, -2 * cos(w0) / a0, (1 - alpha * A) / a0 }, a[2] = { b[1], (1 - alpha / A) / a0 };
+	double x1 = 0, x2 = 0, y1 = 0, y2 = 0;
+
+	for (frames_t i = 0; i < frames; i++) {
+		double v = 0.25 * sin(2 * M_PI * 40 * i / rate) + 0.05 * sin(2 * M_PI * 97 * i / rate) + 0.1 * sin(2 * M_PI * 1000 * i / rate);
+		samples[2 * i] = samples[2 * i + 1] = (ISAMPLE_T) lrint(v * scale);
+		ref[i] = samples[2 * i];
+	}
+
+	biquad_init(&bank, freqs, BIQUAD_MAX_BANDS, 1.414f, rate);
+	biquad_set_gains(&bank, gains, 0);
+	biquad_process(&bank, samples, frames);
+
+	for (frames_t i = 0; i < frames; i++) {
+		double y = b[0] * ref[i] + b[1] * x1 + b[2] * x2 - a[0] * y1 - a[1] * y2;
+		x2 = x1; x1 = ref[i];
+		y2 = y1; y1 = y;
+		// let the filter settle
+		if (i < frames / 2) continue;
+		power += y * y;
+		error += (samples[2 * i] - y) * (samples[2 * i] - y);
+	}
+
+	snr = 10 * log10(power / error);
+	printf("eq_precision_%uk,snr=%.1fdB,%s\n", rate / 1000, snr, snr < (BYTES_PER_FRAME == 8 ? 110 : 80) ? "FAILED" : "ok");
+
+	free(samples);
+	free(ref);
+
+	return snr < (BYTES_PER_FRAME == 8 ? 110 : 80);
+}
+
+/****************************************************************************************
+ * Run sink drift correction on 16 bits input, at 0 ppm it must be a 2 frames delay
+ */
+static void run_asrc(int error, int iterations) {
+	struct asrc_s asrc;
+	s16_t *in = (s16_t*) pristine;
+	ISAMPLE_T *out = (ISAMPLE_T*) outputbuf->buf;
+	u64_t ns = 0, cycles = 0, frames = 0;
+	u32_t hash = 0;
+	char name[32];
+
+	for (int i = -WARMUP; i < iterations; i++) {
+		frames_t consumed, done;
+
+		asrc_reset(&asrc, true);
+		if (error) asrc_control(&asrc, error, 1000);
+
+		u64_t t0 = now_ns(), c0 = get_cycles();
+		done = asrc_process(&asrc, in, FRAME_BLOCK, out, BUF_FRAMES, &consumed);
+		u64_t c1 = get_cycles(), t1 = now_ns();
+
+		if (i < 0) continue;
+		if (!i) {
+			hash = checksum((u8_t*) out, done * BYTES_PER_FRAME);
+			for (frames_t f = 2; !error && f < done; f++) {
+				if (out[f * 2] != (ISAMPLE_T) in[(f - 2) * 2] << (BYTES_PER_FRAME == 8 ? 16 : 0)) {
+					fprintf(stderr, "asrc is not transparent at frame %u\n", f);
+					break;
+				}
+			}
+		}
+
+		ns += t1 - t0;
+		cycles += c1 - c0;
+		frames += done;
+	}
+
+	snprintf(name, sizeof(name), "asrc_%+.0fppm", asrc.ppm);
+	printf("%s,%d,%u,%d,%.3f,%.2f,%.0f,%08x\n", name, BYTES_PER_FRAME, FRAME_BLOCK, iterations,
+			(double) ns / frames, (double) cycles / frames, frames * 1e9 / ns, hash);
+}
+
+/****************************************************************************************
+ * Stream through asrc in random chunks at extreme ratios, it must never consume more
+ * than it was given and must produce the same output as one single call
+ */
+static int run_asrc_stream(int ppm) {
+	struct asrc_s asrc;
+	const s16_t *in = (s16_t*) pristine;
+	frames_t total = BUF_FRAMES * BYTES_PER_FRAME / 4, out_max = total + total / 100 + 16;
+	ISAMPLE_T *ref = malloc(out_max * BYTES_PER_FRAME), *out = malloc(out_max * BYTES_PER_FRAME);
+	frames_t consumed, ref_done, done = 0, pos = 0, calls = 0;
+	u32_t seed = 0x89abcdef;
+	int failed = 0;
+
+	asrc_reset(&asrc, true);
+	asrc.step = (u64_t) llround(ppm * 4294.967296) + (1ULL << 32);
+	ref_done = asrc_process(&asrc, in, total, ref, out_max, &consumed);
+
+	asrc_reset(&asrc, true);
+	asrc.step = (u64_t) llround(ppm * 4294.967296) + (1ULL << 32);
+
+	while (pos < total && done < ref_done) {
+		frames_t in_frames, out_frames;
+
+		seed = seed * 1664525 + 1013904223;
+		in_frames = min(total - pos, (seed >> 16) % 9);
+		out_frames = min(out_max - done, (seed & 0xffff) % 16);
+
+		// small chunks in their own allocation, so that a step crossing input's end is frequent and any overread is caught
+		s16_t *chunk = malloc(in_frames * 4 + 1);
+		memcpy(chunk, in + pos * 2, in_frames * 4);
+		done += asrc_process(&asrc, chunk, in_frames, out + done * 2, out_frames, &consumed);
+		free(chunk);
+		calls++;
+
+		if (consumed > in_frames) {
+			fprintf(stderr, "asrc at %+dppm consumed %u frames out of %u\n", ppm, consumed, in_frames);
+			failed = 1;
+			break;
+		}
+
+		pos += consumed;
+	}
+
+	done = min(done, ref_done);
+	if (!failed && memcmp(out, ref, done * BYTES_PER_FRAME)) {
+		fprintf(stderr, "asrc at %+dppm differs when input is chunked\n", ppm);
+		failed = 1;
+	}
+
+	printf("asrc_stream_%+dppm,calls=%u,frames=%u,%s\n", ppm, calls, done, failed ? "FAILED" : "ok");
+
+	free(ref);
+	free(out);
+
+	return failed;
+}
+
+/****************************************************************************************
+ * SPDIF encoder before it was reworked, kept as the bit-exact reference
+ */
+#define REF_PREAMBLE_B  (0xE8)
+#define REF_PREAMBLE_M  (0xE2)
+#define REF_PREAMBLE_W  (0xE4)
+
+static const u8_t REF_VUCP24[2] = { 0xCC, 0x32 };
+
+static const u16_t ref_bmclookup[256] = {
+	0xcccc, 0xb333, 0xd333, 0xaccc, 0xcb33, 0xb4cc, 0xd4cc, 0xab33, 
+	0xcd33, 0xb2cc, 0xd2cc, 0xad33, 0xcacc, 0xb533, 0xd533, 0xaacc, 
+	0xccb3, 0xb34c, 0xd34c, 0xacb3, 0xcb4c, 0xb4b3, 0xd4b3, 0xab4c, 
+	0xcd4c, 0xb2b3, 0xd2b3, 0xad4c, 0xcab3, 0xb54c, 0xd54c, 0xaab3, 
+	0xccd3, 0xb32c, 0xd32c, 0xacd3, 0xcb2c, 0xb4d3, 0xd4d3, 0xab2c, 
+	0xcd2c, 0xb2d3, 0xd2d3, 0xad2c, 0xcad3, 0xb52c, 0xd52c, 0xaad3, 
+	0xccac, 0xb353, 0xd353, 0xacac, 0xcb53, 0xb4ac, 0xd4ac, 0xab53, 
+	0xcd53, 0xb2ac, 0xd2ac, 0xad53, 0xcaac, 0xb553, 0xd553, 0xaaac, 
+	0xcccb, 0xb334, 0xd334, 0xaccb, 0xcb34, 0xb4cb, 0xd4cb, 0xab34, 
+	0xcd34, 0xb2cb, 0xd2cb, 0xad34, 0xcacb, 0xb534, 0xd534, 0xaacb, 
+	0xccb4, 0xb34b, 0xd34b, 0xacb4, 0xcb4b, 0xb4b4, 0xd4b4, 0xab4b, 
+	0xcd4b, 0xb2b4, 0xd2b4, 0xad4b, 0xcab4, 0xb54b, 0xd54b, 0xaab4, 
+	0xccd4, 0xb32b, 0xd32b, 0xacd4, 0xcb2b, 0xb4d4, 0xd4d4, 0xab2b, 
+	0xcd2b, 0xb2d4, 0xd2d4, 0xad2b, 0xcad4, 0xb52b, 0xd52b, 0xaad4, 
+	0xccab, 0xb354, 0xd354, 0xacab, 0xcb54, 0xb4ab, 0xd4ab, 0xab54, 
+	0xcd54, 0xb2ab, 0xd2ab, 0xad54, 0xcaab, 0xb554, 0xd554, 0xaaab, 
+	0xcccd, 0xb332, 0xd332, 0xaccd, 0xcb32, 0xb4cd, 0xd4cd, 0xab32, 
+	0xcd32, 0xb2cd, 0xd2cd, 0xad32, 0xcacd, 0xb532, 0xd532, 0xaacd, 
+	0xccb2, 0xb34d, 0xd34d, 0xacb2, 0xcb4d, 0xb4b2, 0xd4b2, 0xab4d, 
+	0xcd4d, 0xb2b2, 0xd2b2, 0xad4d, 0xcab2, 0xb54d, 0xd54d, 0xaab2, 
+	0xccd2, 0xb32d, 0xd32d, 0xacd2, 0xcb2d, 0xb4d2, 0xd4d2, 0xab2d, 
+	0xcd2d, 0xb2d2, 0xd2d2, 0xad2d, 0xcad2, 0xb52d, 0xd52d, 0xaad2, 
+	0xccad, 0xb352, 0xd352, 0xacad, 0xcb52, 0xb4ad, 0xd4ad, 0xab52, 
+	0xcd52, 0xb2ad, 0xd2ad, 0xad52, 0xcaad, 0xb552, 0xd552, 0xaaad, 
+	0xccca, 0xb335, 0xd335, 0xacca, 0xcb35, 0xb4ca, 0xd4ca, 0xab35, 
+	0xcd35, 0xb2ca, 0xd2ca, 0xad35, 0xcaca, 0xb535, 0xd535, 0xaaca, 
+	0xccb5, 0xb34a, 0xd34a, 0xacb5, 0xcb4a, 0xb4b5, 0xd4b5, 0xab4a, 
+	0xcd4a, 0xb2b5, 0xd2b5, 0xad4a, 0xcab5, 0xb54a, 0xd54a, 0xaab5, 
+	0xccd5, 0xb32a, 0xd32a, 0xacd5, 0xcb2a, 0xb4d5, 0xd4d5, 0xab2a, 
+	0xcd2a, 0xb2d5, 0xd2d5, 0xad2a, 0xcad5, 0xb52a, 0xd52a, 0xaad5, 
+	0xccaa, 0xb355, 0xd355, 0xacaa, 0xcb55, 0xb4aa, 0xd4aa, 0xab55, 
+	0xcd55, 0xb2aa, 0xd2aa, 0xad55, 0xcaaa, 0xb555, 0xd555, 0xaaaa	
+};
+
+static void spdif_reference(ISAMPLE_T *src, size_t frames, u32_t *dst) {
+    static u8_t vu, count;    
+	register u16_t hi, lo;
+#if BYTES_PER_FRAME == 8
+	register u16_t aux;
+#endif
+    
+    // we assume frame == 0 as well...
+    if (!src) {
+        count = 0;
+        vu = REF_VUCP24[0];
+    }
+    
+	while (frames--) {
+		// start with left channel
+#if BYTES_PER_FRAME == 4		
+		hi = ref_bmclookup[(u8_t)(*src >> 8)];
+		lo = ref_bmclookup[(u8_t)*src++];
+		if (lo & 1) hi = ~hi;
+
+        if (!count--) {            
+			*dst++ = (vu << 24) | (REF_PREAMBLE_B << 16) | 0xCCCC;
+			count = 191;
+		} else {
+			*dst++ = (vu << 24) | (REF_PREAMBLE_M << 16) | 0xCCCC;
+		}
+#else
+		hi = ref_bmclookup[(u8_t)(*src >> 24)];
+		lo = ref_bmclookup[(u8_t)(*src >> 16)];
+		aux = ref_bmclookup[(u8_t)(*src++ >> 8)];
+		if (aux & 1) lo = ~lo;
+		if (lo & 1) hi = ~hi;
+
+
+        if (!count--) {
+			*dst++ = (vu << 24) | (REF_PREAMBLE_B << 16) | aux;
+			count = 191;
+		} else {
+			*dst++ = (vu << 24) | (REF_PREAMBLE_M << 16) | aux;
+		}
+#endif
+
+        vu = REF_VUCP24[hi & 1];
+		*dst++ = ((u32_t)lo << 16) | hi;
+
+		// then do right channel, no need to check REF_PREAMBLE_B
+#if BYTES_PER_FRAME == 4		
+		hi = ref_bmclookup[(u8_t)(*src >> 8)];
+		lo = ref_bmclookup[(u8_t)*src++];
+		if (lo & 1) hi = ~hi;
+
+		*dst++ = (vu << 24) | (REF_PREAMBLE_W << 16) | 0xCCCC;
+#else
+		hi = ref_bmclookup[(u8_t)(*src >> 24)];
+		lo = ref_bmclookup[(u8_t)(*src >> 16)];
+		aux = ref_bmclookup[(u8_t)(*src++ >> 8)];
+		if (aux & 1) lo = ~lo;
+		if (lo & 1) hi = ~hi;
+
+		*dst++ = (vu << 24) | (REF_PREAMBLE_W << 16) | aux;
+#endif
+
+        vu = REF_VUCP24[hi & 1];
+		*dst++ = ((u32_t)lo << 16) | hi;
+	}
+}
+
+/****************************************************************************************
+ * Encode a block by chunks of odd sizes so that 192 frames boundaries fall anywhere
+ */
+static void run_spdif(bool reference, int iterations, u32_t **out) {
+	static const frames_t chunks[] = { 225, 100, 17, 1, 191, 192, 193 };
+	u32_t *dst = malloc(FRAME_BLOCK * 16);
+	u64_t ns = 0, cycles = 0, frames = 0;
+	u32_t hash = 0;
+
+	for (int i = -WARMUP; i < iterations; i++) {
+		ISAMPLE_T *src = (ISAMPLE_T*) pristine;
+		frames_t done = 0;
+
+		u64_t t0 = now_ns(), c0 = get_cycles();
+		if (reference) spdif_reference(NULL, 0, NULL);
+		else spdif_reset(44100, 24);
+		for (int n = 0; done < FRAME_BLOCK; n++) {
+			frames_t chunk = min(chunks[n % (sizeof(chunks) / sizeof(*chunks))], FRAME_BLOCK - done);
+			if (reference) spdif_reference(src + done * 2, chunk, dst + done * 4);
+			else spdif_convert(src + done * 2, chunk, dst + done * 4);
+			done += chunk;
+		}
+		u64_t c1 = get_cycles(), t1 = now_ns();
+
+		if (i < 0) continue;
+		if (!i) hash = checksum((u8_t*) dst, FRAME_BLOCK * 16);
+
+		ns += t1 - t0;
+		cycles += c1 - c0;
+		frames += done;
+	}
+
+	printf("%s,%d,%u,%d,%.3f,%.2f,%.0f,%08x\n", reference ? "spdif_ref" : "spdif", BYTES_PER_FRAME, FRAME_BLOCK, iterations,
+			(double) ns / frames, (double) cycles / frames, frames * 1e9 / ns, hash);
+	*out = dst;
+}
+
+/****************************************************************************************
+ * Apart from VUCP, encoders must be identical. Channel status is read back from the C 
+ * bits of the left sub-frames (carried by the header of right sub-frames)
+ */
+static void run_spdif_exact(int iterations) {
+	u8_t status[24] = { 0 }, expected[24] = { 0x04, 0, 0, 0x00, BYTES_PER_FRAME == 8 ? 0x0b : 0x02 };
+	u32_t *ref, *enc;
+
+	run_spdif(true, iterations, &ref);
+	run_spdif(false, iterations, &enc);
+
+	for (int i = 0; i < FRAME_BLOCK * 4; i++) {
+		u32_t mask = i & 1 ? 0xffffffff : 0x00ffffff;
+		if ((ref[i] & mask) != (enc[i] & mask)) {
+			fprintf(stderr, "spdif encoder is not bit-exact at word %d\n", i);
+			break;
+		}
+	}
+
+	for (int n = 0; n < 192; n++) {
+		u8_t vucp = enc[(n * 4) + 2] >> 24;
+		if (vucp == 0xCA || vucp == 0x34) status[n / 8] |= 1 << (n % 8);
+		else if (vucp != 0xCC && vucp != 0x32) fprintf(stderr, "spdif invalid VUCP %02x at frame %d\n", vucp, n);
+	}
+	if (memcmp(status, expected, sizeof(status))) fprintf(stderr, "spdif wrong channel status\n");
+
+	free(ref);
+	free(enc);
+}
+
+/****************************************************************************************
+ * Lock-free producer/consumer on a ring of the size of outputbuf, the consumer checks
+ * that it reads frames in order and the checksum is that of the whole sequence
+ */
+#define RING_FRAMES		(FRAME_BLOCK * 1024)
+
+static struct buffer ring;
+
+static void *ring_producer(void *arg) {
+	u32_t n = 0;
+
+	while (n < RING_FRAMES) {
+		u8_t *ptr;
+		size_t frames = min(buf_reserve(&ring, &ptr) / BYTES_PER_FRAME, RING_FRAMES - n);
+		for (size_t i = 0; i < frames; i++, n++) memcpy(ptr + i * BYTES_PER_FRAME, &n, sizeof(n));
+		if (frames) buf_commit(&ring, ptr, frames * BYTES_PER_FRAME);
+		else sched_yield();
+	}
+
+	return NULL;
+}
+
+static void run_ring(void) {
+	pthread_t thread;
+	u32_t n = 0, hash = 2166136261u;
+	bool ordered = true;
+
+	buf_init(&ring, BUF_FRAMES * BYTES_PER_FRAME);
+
+	u64_t t0 = now_ns(), c0 = get_cycles();
+	pthread_create(&thread, NULL, ring_producer, NULL);
+
+	while (n < RING_FRAMES) {
+		u8_t *ptr = ring.readp;
+		size_t frames = _buf_cont_read(&ring) / BYTES_PER_FRAME;
+		for (size_t i = 0; i < frames; i++, n++) {
+			u32_t v;
+			memcpy(&v, ptr + i * BYTES_PER_FRAME, sizeof(v));
+			ordered &= v == n;
+			hash = (hash ^ v) * 16777619u;
+		}
+		if (frames) _buf_inc_readp(&ring, frames * BYTES_PER_FRAME);
+		else sched_yield();
+	}
+
+	pthread_join(thread, NULL);
+	u64_t c1 = get_cycles(), t1 = now_ns();
+
+	if (!ordered) fprintf(stderr, "ring frames out of order\n");
+	printf("ring_spsc,%d,%u,%d,%.3f,%.2f,%.0f,%08x\n", BYTES_PER_FRAME, BUF_FRAMES, 1,
+			(double) (t1 - t0) / RING_FRAMES, (double) (c1 - c0) / RING_FRAMES, RING_FRAMES * 1e9 / (t1 - t0), hash);
+
+	buf_destroy(&ring);
+}
+
+/****************************************************************************************
+ * Decoder is not part of this benchmark
+ */
+void decode_wake_space(size_t before, size_t after) { }
+
+int main(int argc, char *argv[]) {
+	int iterations = argc > 1 ? atoi(argv[1]) : ITERATIONS;
+	u32_t seed = 0x1234567;
+	int rc = 0;
+
+	buf_init(outputbuf, BUF_FRAMES * BYTES_PER_FRAME);
+	silencebuf = calloc(MAX_SILENCE_FRAMES, BYTES_PER_FRAME);
+	obuf = malloc(FRAME_BLOCK * BYTES_PER_FRAME);
+	pristine = malloc(BUF_FRAMES * BYTES_PER_FRAME);
+
+	// full scale pseudo-random samples, distinct on left and right
+	for (ISAMPLE_T *p = (ISAMPLE_T*) pristine; p < (ISAMPLE_T*) (pristine + BUF_FRAMES * BYTES_PER_FRAME); p++) {
+		seed = seed * 1664525 + 1013904223;
+		*p = (ISAMPLE_T) (BYTES_PER_FRAME == 8 ? seed : seed >> 16);
+	}
+
+	output.current_sample_rate = output.next_sample_rate = 44100;
+	output.write_cb = &_bench_write_frames;
+
+	printf("case,bytes_per_frame,block_frames,iterations,ns_per_frame,cycles_per_frame,frames_per_sec,checksum\n");
+	for (struct bench_case *c = cases; c->name; c++) run(c, iterations);
+	for (struct eq_case *c = eq_cases; c->name; c++) run_eq(c, iterations);
+	for (u32_t rate = 48000; rate <= 192000; rate *= 2) rc |= run_eq_precision(rate);
+	for (int error = -5; error <= 5; error += 5) run_asrc(error, iterations);
+	for (int ppm = -1000; ppm <= 1000; ppm += 500) rc |= run_asrc_stream(ppm);
+	run_spdif_exact(iterations);
+	run_ring();
+
+	buf_destroy(outputbuf);
+	free(silencebuf);
+	free(obuf);
+	free(pristine);
+
+	return rc;
+}
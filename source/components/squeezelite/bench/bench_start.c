@@ -0,0 +1,153 @@
+/*
+ *  Squeezelite for esp32
+ *
+ *  Host benchmark of start latency
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+/*
+Measures the time between a "strm s" on a local file and the first frames
+reaching outputbuf. It runs the real stream and decode threads with a pass-
+through codec and does what slimproto does: codec_open(), stream_file() and
+decode set to running. Trials are spaced by a random delay so that any polling
+period in these threads is sampled uniformly.
+
+Results are printed as CSV on stdout: latency distribution in ms.
+*/
+
+#include <time.h>
+#include "squeezelite.h"
+
+#define TRIALS			100
+#define FILE_SIZE		(512 * 1024)
+#define BENCH_STREAMBUF	(256 * 1024)
+#define BENCH_OUTPUTBUF	(64 * 1024)
+#define TIMEOUT_MS		2000
+
+extern struct buffer *streambuf;
+extern struct buffer *outputbuf;
+extern struct streamstate stream;
+extern struct decodestate decode;
+
+static u64_t first_ns;
+
+static u64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/****************************************************************************************
+ * Pass-through codec, records when it first produces something
+ */
+static void bench_open(u8_t sample_size, u8_t sample_rate, u8_t channels, u8_t endianness) { }
+static void bench_close(void) { }
+
+static decode_state bench_decode(void) {
+	bool done;
+
+	mutex_lock(streambuf->mutex);
+	mutex_lock(outputbuf->mutex);
+
+	size_t bytes = min(_buf_used(streambuf), _buf_cont_read(streambuf));
+	bytes = min(bytes, min(_buf_space(outputbuf), _buf_cont_write(outputbuf)));
+	bytes -= bytes % BYTES_PER_FRAME;
+
+	if (bytes) {
+		memcpy(outputbuf->writep, streambuf->readp, bytes);
+		_buf_inc_readp(streambuf, bytes);
+		_buf_inc_writep(outputbuf, bytes);
+		if (!first_ns) first_ns = now_ns();
+	}
+
+	done = stream.state <= DISCONNECT && _buf_used(streambuf) < BYTES_PER_FRAME;
+
+	mutex_unlock(outputbuf->mutex);
+	mutex_unlock(streambuf->mutex);
+
+	return done ? DECODE_COMPLETE : DECODE_RUNNING;
+}
+
+struct codec *register_pcm(void) {
+	static struct codec ret = {
+		'p', "aif,pcm", 4096, 4096, bench_open, bench_close, bench_decode,
+	};
+	return &ret;
+}
+
+/****************************************************************************************
+ * Codecs and network helpers are not part of this benchmark
+ */
+struct codec *register_flac(void) { return NULL; }
+struct codec *register_mad(void) { return NULL; }
+struct codec *register_mpg(void) { return NULL; }
+struct codec *register_vorbis(void) { return NULL; }
+struct codec *register_helixaac(void) { return NULL; }
+struct codec *register_alac(void) { return NULL; }
+struct codec *register_opus(void) { return NULL; }
+
+void set_nonblock(sockfd s) { }
+int connect_timeout(sockfd sock, const struct sockaddr *addr, socklen_t addrlen, int timeout) { return -1; }
+
+static int compare(const void *a, const void *b) {
+	return *(double*) a < *(double*) b ? -1 : *(double*) a > *(double*) b;
+}
+
+int main(int argc, char *argv[]) {
+	int trials = argc > 1 ? atoi(argv[1]) : TRIALS;
+	char path[] = "/tmp/bench_startXXXXXX";
+	double *latency = calloc(trials, sizeof(double));
+	u8_t *data = malloc(FILE_SIZE);
+	int fd = mkstemp(path);
+
+	for (int i = 0; i < FILE_SIZE; i++) data[i] = rand();
+	if (fd < 0 || write(fd, data, FILE_SIZE) != FILE_SIZE) {
+		fprintf(stderr, "can't create %s\n", path);
+		return 1;
+	}
+	close(fd);
+
+	buf_init(outputbuf, BENCH_OUTPUTBUF);
+	stream_init(lWARN, BENCH_STREAMBUF);
+	decode_init(lWARN, NULL, "alac,aac,ogg,ops,flac,mp3");
+	srand(0x1234567);
+
+	for (int i = 0; i < trials; i++) {
+		usleep(rand() % 100000);
+
+		decode_flush(false);
+		stream_disconnect();
+		buf_flush(streambuf);
+		buf_flush(outputbuf);
+		first_ns = 0;
+
+		// same sequence as slimproto on strm s, controller then sets decode running
+		u64_t start = now_ns();
+		codec_open('p', '1', '3', '2', '1');
+		stream_file(path, strlen(path), 0);
+		mutex_lock(decode.mutex);
+		decode.state = DECODE_RUNNING;
+		mutex_unlock(decode.mutex);
+		decode_wake();
+
+		while (!first_ns && now_ns() - start < TIMEOUT_MS * 1000000ULL) usleep(100);
+		latency[i] = first_ns ? (first_ns - start) / 1e6 : TIMEOUT_MS;
+	}
+
+	qsort(latency, trials, sizeof(double), compare);
+	printf("case,trials,min_ms,median_ms,p90_ms,p99_ms,max_ms\n");
+	printf("start_file,%d,%.3f,%.3f,%.3f,%.3f,%.3f\n", trials, latency[0], latency[trials / 2],
+			latency[trials * 90 / 100], latency[trials * 99 / 100], latency[trials - 1]);
+
+	decode_close();
+	stream_close();
+	buf_destroy(outputbuf);
+	unlink(path);
+	free(latency);
+	free(data);
+
+	return 0;
+}
@@ -0,0 +1,39 @@
+/*
+ *  Squeezelite for esp32
+ *
+ *  Host benchmarks stubs
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#include <time.h>
+#include "squeezelite.h"
+
+/****************************************************************************************
+ * Stubs for what the benchmarked files expect from the rest of squeezelite
+ */
+const char *logtime(void) {
+	return "";
+}
+
+void logprint(const char *fmt, ...) {
+	va_list args;
+	va_start(args, fmt);
+	vfprintf(stderr, fmt, args);
+	va_end(args);
+}
+
+u32_t gettime_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void wake_controller(void) { }
+void touch_memory(u8_t *buf, size_t size) { }
+
+bool test_open(const char *device, unsigned rates[], bool userdef_rates) {
+	return true;
+}
@@ -0,0 +1,191 @@
+/*
+ *  Squeezelite for esp32
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+/*
+Cascade of peaking biquads (RBJ cookbook) that runs directly on ISAMPLE_T for
+16 and 32 bits frames, at any sample rate. Filtering is done on a small
+de-interleaved float chunk so that it stays in internal RAM. Bands whose gain
+is 0 or whose frequency is too close to Nyquist are simply skipped.
+
+Low bands at high rates have poles very close to z = 1, where float b/a
+coefficients (a1 ~ -2, a2 ~ 1) can't place them and where rounding of the
+recursion is amplified the most. Each band is instead run as y = x + v in
+direct form I, where the residual v = g (x - x[-2]) / A(z). The recursion is
+written on v and its increment d = v - v[-1], with a1 + a2 + 1 and a2 - 1 as
+coefficients. These, like g, are small numbers that keep full precision in
+float as long as 1 - cos(w0) and alpha are computed in double, which is only
+done when the rate changes, and only small increments are rounded.
+
+Gain changes are ramped in dB, with coefficients recalculated once per chunk, 
+which avoids zipper noise when volume (hence loudness) moves. Nothing is ever
+allocated, so all this can be called from the output thread.
+*/
+
+#include <math.h>
+#include "squeezelite.h"
+#include "biquad.h"
+
+#define BIQUAD_CHUNK	256
+
+#if BYTES_PER_FRAME == 4
+#define SAMPLE_MAX	32767.0f
+#define SAMPLE_MIN	-32768.0f
+#else
+// largest float below 2^31
+#define SAMPLE_MAX	2147483520.0f
+#define SAMPLE_MIN	-2147483648.0f
+#endif
+
+// only used from output thread, keep it in internal RAM
+static float chunk[2][BIQUAD_CHUNK];
+
+/****************************************************************************************
+ * calculate coefficients of a peaking filter for the current gain of a band
+ */
+static void design(struct biquad_bank_s *bank, int i) {
+	float A = powf(10, bank->band[i].gain / 40);
+	float alpha = bank->band[i].alpha, aA = alpha / A;
+	float a0 = 1 + aA;
+
+	// b0 - 1 = -(b2 - a2) and b1 = a1, so B(z) - A(z) = g (1 - z^-2)
+	bank->band[i].g = alpha * (A - 1 / A) / a0;
+	// a1 + a2 + 1 and a2 - 1
+	bank->band[i].k1 = 2 * bank->band[i].vers / a0;
+	bank->band[i].k2 = -2 * aA / a0;
+}
+
+/****************************************************************************************
+ * run one band on both channels of a chunk, they are interleaved in the same loop so 
+ * that one can proceed while the other waits for its previous sample
+ */
+static void filter(struct biquad_bank_s *bank, int band, int count) {
+	float g = bank->band[band].g, k1 = bank->band[band].k1, k2 = bank->band[band].k2;
+	float (*x)[2] = bank->band[band].x, (*v)[2] = bank->band[band].v;
+	float lx1 = x[0][0], lx2 = x[0][1], lv = v[0][0], ld = v[0][1];
+	float rx1 = x[1][0], rx2 = x[1][1], rv = v[1][0], rd = v[1][1];
+
+	for (int i = 0; i < count; i++) {
+		float l = chunk[0][i], r = chunk[1][i];
+		// v = g (x - x2) - a1 v1 - a2 v2 with v2 = v1 - d
+		ld += g * (l - lx2) - k1 * lv + k2 * ld;
+		rd += g * (r - rx2) - k1 * rv + k2 * rd;
+		lv += ld;
+		rv += rd;
+		lx2 = lx1;
+		lx1 = l;
+		rx2 = rx1;
+		rx1 = r;
+		chunk[0][i] = l + lv;
+		chunk[1][i] = r + rv;
+	}
+
+	x[0][0] = lx1;
+	x[0][1] = lx2;
+	v[0][0] = lv;
+	v[0][1] = ld;
+	x[1][0] = rx1;
+	x[1][1] = rx2;
+	v[1][0] = rv;
+	v[1][1] = rd;
+}
+
+/****************************************************************************************
+ * set frequencies and sample rate, keep gains but clear all delay lines
+ */
+void biquad_init(struct biquad_bank_s *bank, const float *freqs, int count, float q, uint32_t samplerate) {
+	bank->count = min(count, BIQUAD_MAX_BANDS);
+
+	for (int i = 0; i < bank->count; i++) {
+		double w0 = 2 * M_PI * freqs[i] / samplerate;
+
+		// a band above ~0.45 fs can't be designed properly and is inaudible anyway
+		bank->band[i].valid = w0 < 0.9 * M_PI;
+		bank->band[i].vers = 2 * sin(w0 / 2) * sin(w0 / 2);
+		bank->band[i].alpha = sin(w0) / (2 * q);
+		memset(bank->band[i].x, 0, sizeof(bank->band[i].x));
+		memset(bank->band[i].v, 0, sizeof(bank->band[i].v));
+
+		if (bank->band[i].valid) design(bank, i);
+	}
+}
+
+/****************************************************************************************
+ * set new gains (dB) to be reached progressively over ramp frames
+ */
+void biquad_set_gains(struct biquad_bank_s *bank, const float *gains, frames_t ramp) {
+	for (int i = 0; i < bank->count; i++) {
+		// band was bypassed, so its delay line is stale
+		if (bank->band[i].gain == 0 && bank->band[i].target == 0 && gains[i] != 0) {
+			memset(bank->band[i].x, 0, sizeof(bank->band[i].x));
+			memset(bank->band[i].v, 0, sizeof(bank->band[i].v));
+		}
+
+		bank->band[i].target = gains[i];
+		bank->band[i].ramp = gains[i] != bank->band[i].gain ? ramp : 0;
+		if (bank->band[i].ramp) {
+			bank->band[i].step = (gains[i] - bank->band[i].gain) / ramp;
+		} else {
+			bank->band[i].gain = gains[i];
+			if (bank->band[i].valid) design(bank, i);
+		}
+	}
+}
+
+/****************************************************************************************
+ * is there anything to do
+ */
+bool biquad_active(struct biquad_bank_s *bank) {
+	for (int i = 0; i < bank->count; i++) {
+		if (bank->band[i].valid && (bank->band[i].gain != 0 || bank->band[i].target != 0)) return true;
+	}
+	return false;
+}
+
+/****************************************************************************************
+ * filter interleaved stereo frames in place
+ */
+void biquad_process(struct biquad_bank_s *bank, ISAMPLE_T *samples, frames_t frames) {
+	while (frames) {
+		frames_t count = min(frames, BIQUAD_CHUNK);
+		ISAMPLE_T *p = samples;
+
+		for (int i = 0; i < count; i++) {
+			chunk[0][i] = *p++;
+			chunk[1][i] = *p++;
+		}
+
+		for (int i = 0; i < bank->count; i++) {
+			if (!bank->band[i].valid) continue;
+
+			// move gain towards target once per chunk, a 0 dB peaking filter is transparent
+			if (bank->band[i].ramp) {
+				if (bank->band[i].ramp > count) {
+					bank->band[i].gain += bank->band[i].step * count;
+					bank->band[i].ramp -= count;
+				} else {
+					bank->band[i].gain = bank->band[i].target;
+					bank->band[i].ramp = 0;
+				}
+				design(bank, i);
+			} else if (bank->band[i].gain == 0) {
+				continue;
+			}
+
+			filter(bank, i, count);
+		}
+
+		for (int i = 0; i < count; i++) {
+			for (int ch = 0; ch < 2; ch++) {
+				float v = chunk[ch][i];
+				*samples++ = v >= SAMPLE_MAX ? (ISAMPLE_T) SAMPLE_MAX : (v <= SAMPLE_MIN ? (ISAMPLE_T) SAMPLE_MIN : (ISAMPLE_T) v);
+			}
+		}
+
+		frames -= count;
+	}
+}
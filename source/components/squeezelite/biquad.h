@@ -0,0 +1,29 @@
+/*
+ *  Squeezelite for esp32
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#pragma once
+
+#define BIQUAD_MAX_BANDS	10
+
+struct biquad_bank_s {
+	int count;
+	struct {
+		bool valid;				// band can be designed at current rate
+		float vers, alpha;		// 1 - cos(w0) and sin(w0) / 2Q, designed in double
+		float gain, target;		// dB
+		float step;				// dB per frame while ramping
+		frames_t ramp;			// frames left to reach target
+		float g, k1, k2;		// residual gain and a1 + a2 + 1, a2 - 1 (a0 = 1)
+		float x[2][2], v[2][2];	// per channel, last 2 inputs and residual with its increment
+	} band[BIQUAD_MAX_BANDS];
+};
+
+void biquad_init(struct biquad_bank_s *bank, const float *freqs, int count, float q, uint32_t samplerate);
+void biquad_set_gains(struct biquad_bank_s *bank, const float *gains, frames_t ramp);
+bool biquad_active(struct biquad_bank_s *bank);
+void biquad_process(struct biquad_bank_s *bank, ISAMPLE_T *samples, frames_t frames);
@@ -27,10 +27,30 @@
 
 #include "squeezelite.h"
 
+/* 
+readp is only moved by the consumer and writep by the producer, so each side 
+loads the other's pointer once (acquire) and publishes its own after data has 
+been read/written (release). That is enough for one producer to use 
+buf_reserve/buf_commit without the mutex while the consumer uses the _* read
+functions. The mutex is still needed for control (flush, resize, limit, unwrap,
+adjust) and by _* functions callers that also protect other states with it.
+
+But _buf_resize frees memory and _buf_limit changes wrap/size, so they must 
+never run while a lock-free producer is between buf_reserve and buf_commit, the
+CAS in commit would only drop the data, not prevent the write. For outputbuf,
+producers (process.c and external sinks) hold decode.mutex over that window, so
+resize and limit may only be called with decode.mutex AND the buffer mutex, in 
+that order. This is the case of _checkfade (decoder thread), sinks command 
+handlers and slimproto when it returns from an external sink.
+*/
+#define LOAD(p)		__atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+#define STORE(p, v)	__atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+
 // _* called with muxtex locked
 
 inline unsigned _buf_used(struct buffer *buf) {
-	return buf->writep >= buf->readp ? buf->writep - buf->readp : buf->size - (buf->readp - buf->writep);
+	u8_t *readp = LOAD(buf->readp), *writep = LOAD(buf->writep);
+	return writep >= readp ? writep - readp : buf->size - (readp - writep);
 }
 
 unsigned _buf_space(struct buffer *buf) {
@@ -38,37 +58,56 @@ unsigned _buf_space(struct buffer *buf) {
 }
 
 unsigned _buf_cont_read(struct buffer *buf) {
-	return buf->writep >= buf->readp ? buf->writep - buf->readp : buf->wrap - buf->readp;
+	u8_t *readp = LOAD(buf->readp), *writep = LOAD(buf->writep);
+	return writep >= readp ? writep - readp : buf->wrap - readp;
 }
 
 unsigned _buf_cont_write(struct buffer *buf) {
-	return buf->writep >= buf->readp ? buf->wrap - buf->writep : buf->readp - buf->writep;
+	u8_t *readp = LOAD(buf->readp), *writep = LOAD(buf->writep);
+	return writep >= readp ? buf->wrap - writep : readp - writep;
 }
 
 void _buf_inc_readp(struct buffer *buf, unsigned by) {
-	buf->readp += by;
-	if (buf->readp >= buf->wrap) {
-		buf->readp -= buf->size;
+	u8_t *readp = buf->readp + by;
+	if (readp >= buf->wrap) {
+		readp -= buf->size;
 	}
+	STORE(buf->readp, readp);
 }
 
 void _buf_inc_writep(struct buffer *buf, unsigned by) {
-	buf->writep += by;
-	if (buf->writep >= buf->wrap) {
-		buf->writep -= buf->size;
+	u8_t *writep = buf->writep + by;
+	if (writep >= buf->wrap) {
+		writep -= buf->size;
 	}
+	STORE(buf->writep, writep);
 }
 
 void buf_flush(struct buffer *buf) {
 	mutex_lock(buf->mutex);
-	buf->readp  = buf->buf;
-	buf->writep = buf->buf;
+	_buf_flush(buf);
 	mutex_unlock(buf->mutex);
 }
 
 void _buf_flush(struct buffer *buf) {
-	buf->readp  = buf->buf;
-	buf->writep = buf->buf;
+	STORE(buf->readp, buf->buf);
+	STORE(buf->writep, buf->buf);
+}
+
+// lock-free producer side: get contiguous free span, then commit what has been written
+size_t buf_reserve(struct buffer *buf, u8_t **ptr) {
+	u8_t *readp = LOAD(buf->readp), *writep = LOAD(buf->writep);
+	*ptr = writep;
+	// keep one byte free as full is same as empty otherwise
+	if (writep >= readp) return min((size_t) (buf->wrap - writep), buf->size - (writep - readp) - 1);
+	return readp - writep - 1;
+}
+
+// returns false (and drops data) if buffer has been flushed since buf_reserve
+bool buf_commit(struct buffer *buf, u8_t *ptr, size_t by) {
+	u8_t *writep = ptr + by;
+	if (writep >= buf->wrap) writep -= buf->size;
+	return __atomic_compare_exchange_n(&buf->writep, &ptr, writep, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
 }
 
 // adjust buffer to multiple of mod bytes so reading in multiple always wraps on frame boundary
@@ -176,3 +215,61 @@ void buf_destroy(struct buffer *buf) {
 		mutex_destroy(buf->mutex);
 	}
 }
+
+// watermark notifications, pending is latched so that a signal sent before waiting is not lost
+
+void notify_init(struct notify *notify) {
+#if WIN
+	notify->event = CreateEvent(NULL, FALSE, FALSE, NULL);
+#else
+	pthread_mutex_init(&notify->mutex, NULL);
+	pthread_cond_init(&notify->cond, NULL);
+	notify->pending = false;
+#endif
+}
+
+void notify_signal(struct notify *notify) {
+#if WIN
+	SetEvent(notify->event);
+#else
+	pthread_mutex_lock(&notify->mutex);
+	notify->pending = true;
+	pthread_cond_signal(&notify->cond);
+	pthread_mutex_unlock(&notify->mutex);
+#endif
+}
+
+// returns false on timeout (ms)
+bool notify_wait(struct notify *notify, u32_t timeout) {
+#if WIN
+	return WaitForSingleObject(notify->event, timeout) == WAIT_OBJECT_0;
+#else
+	struct timespec ts;
+	bool signaled;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += timeout / 1000;
+	ts.tv_nsec += (timeout % 1000) * 1000000;
+	if (ts.tv_nsec >= 1000000000) {
+		ts.tv_sec++;
+		ts.tv_nsec -= 1000000000;
+	}
+
+	pthread_mutex_lock(&notify->mutex);
+	while (!notify->pending && pthread_cond_timedwait(&notify->cond, &notify->mutex, &ts) == 0);
+	signaled = notify->pending;
+	notify->pending = false;
+	pthread_mutex_unlock(&notify->mutex);
+
+	return signaled;
+#endif
+}
+
+void notify_destroy(struct notify *notify) {
+#if WIN
+	CloseHandle(notify->event);
+#else
+	pthread_cond_destroy(&notify->cond);
+	pthread_mutex_destroy(&notify->mutex);
+#endif
+}
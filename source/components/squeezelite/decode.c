@@ -35,6 +35,10 @@ struct decodestate decode;
 struct codec *codecs[MAX_CODECS];
 struct codec *codec;
 static bool running = true;
+static struct notify wake;
+
+// safety net only, producers wake us up when a watermark is crossed
+#define DECODE_WAIT_MS	500
 
 #define LOCK_S   mutex_lock(streambuf->mutex)
 #define UNLOCK_S mutex_unlock(streambuf->mutex)
@@ -81,10 +85,18 @@ static void *decode_thread() {
 				min_space = process.max_out_frames * BYTES_PER_FRAME;
 			);
 
+			decode.min_bytes = codec->min_read_bytes;
+			decode.min_space = min_space;
+
 			if (space > min_space && (bytes > codec->min_read_bytes || toend)) {
 				
 				decode.state = codec->decode();
 
+				// let stream thread refill what we have consumed
+				LOCK_S;
+				stream_wake_space(streambuf->size - bytes - 1, _buf_space(streambuf));
+				UNLOCK_S;
+
 				IF_PROCESS(
 					if (process.in_frames) {
 						process_samples();
@@ -113,13 +125,34 @@ static void *decode_thread() {
 		UNLOCK_D;
 
 		if (!ran) {
-			usleep(100000);
+			notify_wait(&wake, DECODE_WAIT_MS);
 		}
 	}
 	
 	return 0;
 }
 
+/****************************************************************************************
+ * Wake decoder on state change
+ */
+void decode_wake(void) {
+	notify_signal(&wake);
+}
+
+/****************************************************************************************
+ * Wake decoder when streambuf level (called with S locked) rises above its watermark
+ */
+void decode_wake_bytes(size_t before, size_t after) {
+	if (before <= decode.min_bytes && after > decode.min_bytes) notify_signal(&wake);
+}
+
+/****************************************************************************************
+ * Wake decoder when outputbuf space (called with O locked) rises above its watermark
+ */
+void decode_wake_space(size_t before, size_t after) {
+	if (before <= decode.min_space && after > decode.min_space) notify_signal(&wake);
+}
+
 static void sort_codecs(int pry, struct codec* ptr) {
 	static int priority[MAX_CODECS];
 	int i, tpry;
@@ -206,6 +239,7 @@ void decode_init(log_level level, const char *include_codecs, const char *exclud
 	LOG_DEBUG("include codecs: %s exclude codecs: %s", include_codecs ? include_codecs : "", exclude_codecs);
 
 	mutex_create(decode.mutex);
+	notify_init(&wake);
 
 #if LINUX || OSX || FREEBSD || EMBEDDED
 	pthread_attr_t attr;
@@ -238,10 +272,12 @@ void decode_close(void) {
 	}
 	running = false;
 	UNLOCK_D;
+	notify_signal(&wake);
 #if LINUX || OSX || FREEBSD || EMBEDDED
 	pthread_join(thread, NULL);
 #endif
 	mutex_destroy(decode.mutex);
+	notify_destroy(&wake);
 #if EMBEDDED	
 	deregister_external();
 #endif	
@@ -306,6 +342,8 @@ void codec_open(u8_t format, u8_t sample_size, u8_t sample_rate, u8_t channels,
 			codec->open(sample_size, sample_rate, channels, endianness);
 
 			decode.state = DECODE_READY;
+			decode.min_bytes = codec->min_read_bytes;
+			decode.min_space = codec->min_space;
 
 			UNLOCK_D;
 			return;
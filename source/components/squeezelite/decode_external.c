@@ -16,6 +16,7 @@
 #endif
 #include "platform_config.h"
 #include "squeezelite.h"
+#include "asrc.h"
 
 
 #if CONFIG_BT_SINK
@@ -43,11 +44,24 @@ static EXT_RAM_ATTR struct {
 	bool enabled;
 	int sum, count, win, errors[SYNC_WIN_SLOW];
 	s32_t len;
-	u32_t start_time, playtime;
+	u32_t start_time, playtime, last;
 } raop_sync;
 #endif
 
+#if CONFIG_BT_SINK
+#define BT_SYNC_PERIOD	1000
+
+static struct {
+	u32_t target, sum, count, time;
+} bt_sync;
+#endif
+
 static enum { SINK_RUNNING, SINK_ABORT, SINK_DISCARD } sink_state;
+static struct asrc_s asrc;
+static struct {
+	u8_t frame[4];
+	size_t len;
+} partial;
 
 #define LOCK_O   mutex_lock(outputbuf->mutex)
 #define UNLOCK_O mutex_unlock(outputbuf->mutex)
@@ -63,38 +77,44 @@ extern struct buffer *outputbuf;
 extern log_level loglevel;
 
 /****************************************************************************************
- * Common sink data handler
+ * Write whole s16 stereo frames to outputbuf
  */
-static uint32_t sink_data_handler(const uint8_t *data, uint32_t len, int retries)
+static uint32_t sink_write(const uint8_t *data, uint32_t len, int retries)
 {
     size_t bytes, space;
     uint32_t written = 0;    
 	int wait = retries + 1;
-		
-	// would be better to lock output, but really, it does not matter
-	if (!output.external) {
-		LOG_SDEBUG("Cannot use external sink while LMS is controlling player");
-		return 0;
-	} 
 
-	LOCK_O;
-	if (sink_state == SINK_ABORT) sink_state = SINK_RUNNING;
-
-	// there will always be room at some point
+	// we are the only producer of outputbuf, so data can be written without its mutex, but
+	// decode's mutex is needed so that buffer is not resized/limited between reserve and commit
 	while (len && wait && sink_state == SINK_RUNNING) {
-		bytes = min(_buf_space(outputbuf), _buf_cont_write(outputbuf)) / (BYTES_PER_FRAME / 4);
-		bytes = min(len, bytes);
+		u8_t *writep;
+		
+		LOCK_D;
+		space = buf_reserve(outputbuf, &writep);
+		
+		if (asrc.enabled) {
+			// drift correction, output frames count slightly differs from input's
+			frames_t consumed, frames;
+			frames = asrc_process(&asrc, (const s16_t*) data, len / 4, (ISAMPLE_T*) writep, space / BYTES_PER_FRAME, &consumed);
+			buf_commit(outputbuf, writep, frames * BYTES_PER_FRAME);
+			bytes = consumed * 4;
+		} else {
+			// always write whole frames
+			bytes = min(len, space / BYTES_PER_FRAME * 4);
 #if BYTES_PER_FRAME == 4
-		memcpy(outputbuf->writep, data, bytes);
+			memcpy(writep, data, bytes);
 #else
-		{
-			s16_t *iptr = (s16_t*) data;
-			ISAMPLE_T *optr = (ISAMPLE_T *) outputbuf->writep;
-			size_t n = bytes / 2;
-			while (n--) *optr++ = *iptr++ << 16;
-		}
+			{
+				s16_t *iptr = (s16_t*) data;
+				ISAMPLE_T *optr = (ISAMPLE_T *) writep;
+				size_t n = bytes / 2;
+				while (n--) *optr++ = *iptr++ << 16;
+			}
 #endif	
-		_buf_inc_writep(outputbuf, bytes * BYTES_PER_FRAME / 4);
+			buf_commit(outputbuf, writep, bytes * BYTES_PER_FRAME / 4);
+		}	
+		UNLOCK_D;
 		space = _buf_space(outputbuf);
 
 		len -= bytes;
@@ -102,30 +122,96 @@ static uint32_t sink_data_handler(const uint8_t *data, uint32_t len, int retries
         written += bytes;
 				
 		// allow i2s to empty the buffer if needed
-		if (len && !space) {
+		if (len && space < BYTES_PER_FRAME) {
             if (!retries) break;
 			wait--;
-			UNLOCK_O; usleep(50000); LOCK_O;
+			usleep(50000);
 		}
 	}	
 
 	if (!wait) {
-        // re-align the buffer according to what we threw away
-        _buf_inc_writep(outputbuf, outputbuf->size - (BYTES_PER_FRAME - (len % BYTES_PER_FRAME)));
 		LOG_WARN("Waited too long, dropping frames %d", len);
 	}
     
-    UNLOCK_O;
-    
     return written;
 }
 
+/****************************************************************************************
+ * Common sink data handler
+ */
+static uint32_t sink_data_handler(const uint8_t *data, uint32_t len, int retries)
+{
+    uint32_t written = 0, whole, done;
+		
+	// would be better to lock output, but really, it does not matter
+	if (!output.external) {
+		LOG_SDEBUG("Cannot use external sink while LMS is controlling player");
+		return 0;
+	} 
+
+	LOCK_O;
+	if (sink_state == SINK_ABORT) {
+		sink_state = SINK_RUNNING;
+		// what is left from previous call belongs to flushed audio
+		partial.len = 0;
+	}	
+	UNLOCK_O;
+	
+	if (sink_state != SINK_RUNNING) return 0;
+
+	// a frame can be split across calls, complete the one we have started first
+	if (partial.len) {
+		size_t n = min(4 - partial.len, len);
+		memcpy(partial.frame + partial.len, data, n);
+		partial.len += n;
+		data += n;
+		len -= n;
+		written += n;
+		if (partial.len < 4 || sink_write(partial.frame, 4, retries) < 4) return written;
+		partial.len = 0;
+	}
+	
+	// and keep the incomplete one at the end for next call
+	whole = len & ~3;
+	done = sink_write(data, whole, retries);
+	written += done;
+	
+	if (done == whole && len > whole) {
+		partial.len = len - whole;
+		memcpy(partial.frame, data + whole, partial.len);
+		written += partial.len;
+	}	
+	
+	return written;
+}
+
 /****************************************************************************************
  * BT sink data handler
  */
 #if CONFIG_BT_SINK
 static void bt_sink_data_handler(const uint8_t *data, uint32_t len) {
     sink_data_handler(data, len, 10);
+
+	if (output.state != OUTPUT_RUNNING) {
+		bt_sync.count = bt_sync.sum = 0;
+		return;
+	}	
+
+	// source paces us with its own clock, so drift shows as outputbuf level moving away from its start
+	u32_t now = gettime_ms();
+	if (!bt_sync.count++) bt_sync.time = now;
+	bt_sync.sum += (u64_t) _buf_used(outputbuf) * 1000 / BYTES_PER_FRAME / output.current_sample_rate;
+	if (now - bt_sync.time < BT_SYNC_PERIOD) return;
+
+	u32_t level = bt_sync.sum / bt_sync.count;
+	if (!bt_sync.target) {
+		bt_sync.target = level;
+		LOG_INFO("BT sync level target %u ms", level);
+	} else {
+		asrc_control(&asrc, (s32_t) (bt_sync.target - level), now - bt_sync.time);
+		LOG_DEBUG("BT sync level %u ms (target:%u), correction %.1f ppm", level, bt_sync.target, asrc.ppm);
+	}	
+	bt_sync.count = bt_sync.sum = 0;
 }    
 
 /****************************************************************************************
@@ -151,6 +237,8 @@ static bool bt_sink_cmd_handler(bt_sink_cmd_t cmd, va_list args)
 		output.external = DECODE_BT;
 		output.state = OUTPUT_STOPPED;
 		output.frames_played = 0;
+		asrc_reset(&asrc, true);
+		memset(&bt_sync, 0, sizeof(bt_sync));
 		if (decode.state != DECODE_STOPPED) decode.state = DECODE_ERROR;
 		LOG_INFO("BT sink started");
 		break;
@@ -171,6 +259,8 @@ static bool bt_sink_cmd_handler(bt_sink_cmd_t cmd, va_list args)
 		output.state = OUTPUT_STOPPED;
 		output.stop_time = gettime_ms();
 		sink_state = SINK_ABORT;
+		asrc_reset(&asrc, true);
+		memset(&bt_sync, 0, sizeof(bt_sync));
 		LOG_INFO("BT stop");
 		break;
 	case BT_SINK_PAUSE:		
@@ -246,11 +336,13 @@ static bool raop_sink_cmd_handler(raop_event_t event, va_list args)
 			}	
 			
 			// calculate sum, error and update sliding window
+			raop_sync.sum -= raop_sync.errors[raop_sync.count % raop_sync.win];
 			raop_sync.errors[raop_sync.count++ % raop_sync.win] = error;
 			raop_sync.sum += error;
 			error = raop_sync.sum / min(raop_sync.count, raop_sync.win);
 
-			// wait till we have enough data or there is a strong deviation
+			// resampling is limited to ASRC_MAX_PPM so it would take minutes to absorb more than 
+			// a few ms, larger deviations are still fixed by skipping/pausing
 			if ((raop_sync.count >= raop_sync.win && abs(error) > 10) || (raop_sync.count >= SYNC_WIN_CHECK && abs(error) > 100)) {
 				if (error < 0) {
 					output.skip_frames = -(error * RAOP_SAMPLE_RATE) / 1000;
@@ -264,7 +356,12 @@ static bool raop_sink_cmd_handler(raop_event_t event, va_list args)
 				
 				raop_sync.sum = raop_sync.count = 0;
 				memset(raop_sync.errors, 0, sizeof(raop_sync.errors));
+			} else if (asrc.enabled && raop_sync.count >= raop_sync.win) {
+				asrc_control(&asrc, error, now - raop_sync.last);
+				LOG_DEBUG("drift correction %.1f ppm (error:%d)", asrc.ppm, error);
 			}	
+
+			raop_sync.last = now;
 			
 			// move to normal mode if possible			
 			if (raop_sync.win == 1) {
@@ -300,6 +397,8 @@ static bool raop_sink_cmd_handler(raop_event_t event, va_list args)
 			raop_sync.sum = raop_sync.count = 0;
 			memset(raop_sync.errors, 0, sizeof(raop_sync.errors));
 			raop_sync.enabled = !strcasestr(output.device, "BT");
+			raop_sync.last = gettime_ms();
+			asrc_reset(&asrc, raop_sync.enabled);
 			output.next_sample_rate = output.current_sample_rate = RAOP_SAMPLE_RATE;
 			break;
         case RAOP_STALLED:
@@ -309,6 +408,7 @@ static bool raop_sink_cmd_handler(raop_event_t event, va_list args)
 		case RAOP_FLUSH:
 			LOG_INFO("%s", event == RAOP_FLUSH ? "Flush" : "Stop");
 			_buf_flush(outputbuf);
+			asrc_reset(&asrc, asrc.enabled && event == RAOP_FLUSH);
 			raop_state = event;
 			if (output.state > OUTPUT_STOPPED) output.state = OUTPUT_STOPPED;
 			sink_state = SINK_ABORT;
@@ -377,6 +477,8 @@ static bool cspot_cmd_handler(cspot_event_t cmd, va_list args)
         output.threshold = 25;
 		output.state = OUTPUT_STOPPED;
         sink_state = SINK_ABORT;
+		// pulled from network, there is no clock to follow
+		asrc_reset(&asrc, false);
 		_buf_flush(outputbuf);
         _buf_limit(outputbuf, 0);
 		if (decode.state != DECODE_STOPPED) decode.state = DECODE_ERROR;
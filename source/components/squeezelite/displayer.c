@@ -17,6 +17,9 @@
 #include "gds_draw.h"
 #include "gds_image.h"
 #include "led_vu.h"
+#include "task_profile.h"
+#include "esp_cpu.h"
+#include "platform_config.h"
 
 #pragma pack(push, 1)
 
@@ -143,11 +146,14 @@ static struct {
 static uint32_t *grayMap;
 
 #define LONG_WAKE 		(10*1000)
+#define VISU_WAKE		33
+#define METER_WAKE		100
 #define SB_HEIGHT		32
 
 // lenght are number of frames, i.e. 2 channels of 16 bits
-#define	FFT_LEN_BIT	7		
-#define	FFT_LEN		(1 << FFT_LEN_BIT)
+#define	FFT_MIN		256
+#define	FFT_MAX		2048
+#define	FFT_DEFAULT	512
 #define RMS_LEN_BIT	6
 #define RMS_LEN		(1 << RMS_LEN_BIT)
 
@@ -196,9 +202,13 @@ static EXT_RAM_ATTR struct {
 	struct bar_s {
 		int current, max;
 		int limit;
+		int first, last;	// FFT bins of that bar
+		float ratio;		// part of bin "last" that also belongs to that bar
+		int drawn, peak;	// what is currently on screen
 	} bars[MAX_BARS];
 	float spectrum_scale;
 	int n, col, row, height, width, border, style, max;
+	bool redraw;
 	enum { VISU_BLANK, VISU_VUMETER = 0x01, VISU_SPECTRUM = 0x02, VISU_WAVEFORM } mode;
 	struct {
 		u8_t *frame;
@@ -210,8 +220,21 @@ static EXT_RAM_ATTR struct {
 static uint8_t* led_data;
 
 static EXT_RAM_ATTR struct {
-	float fft[FFT_LEN*2], samples[FFT_LEN*2], hanning[FFT_LEN];
+	int len;						// FFT size in real samples
+	bool q15;
+	u32_t rate, cursor;
+	struct visu_snapshot_s export;
+	struct {
+		u32_t count, max;
+		u64_t total;
+	} cycles;	
+	float fft[FFT_MAX / 2], twiddle[FFT_MAX], hanning[FFT_MAX];
+	float samples[FFT_MAX], power[FFT_MAX / 2];
+	int16_t fft_sc16[FFT_MAX / 2], hanning_sc16[FFT_MAX];
+	int16_t samples_sc16[FFT_MAX];
 	int levels[2];
+	// two windows with 50% overlap
+	u8_t frames[(FFT_MAX + FFT_MAX / 2) * BYTES_PER_FRAME];
 } meters;
 
 static EXT_RAM_ATTR struct {
@@ -221,7 +244,16 @@ static EXT_RAM_ATTR struct {
 	struct bar_s bars[MAX_BARS] ;
 } led_visu;
 
-static EXT_RAM_ATTR uint8_t vu_bitmap[VU_WIDTH * VU_HEIGHT];
+// VU-meter background and needles in display's format, for a given width and orientation
+static struct {
+	int width;
+	bool rotate;
+	struct GDS_Device *base;
+	struct {
+		struct GDS_Device *sprite;
+		int offset;
+	} needles[VU_COUNT];
+} vu_sprites;
 extern const uint8_t vu_base[] asm("_binary_vu_s_data_start");
 extern const struct {
 	uint8_t offset;
@@ -260,6 +292,10 @@ static void visu_handler(u8_t *data, int len);
 static void ledv_handler(u8_t *data, int len);
 static void ledd_handler(u8_t *data, int len);
 static void displayer_task(void* arg);
+static void spectrum_init(void);
+static bool spectrum_check(void);
+static void spectrum_map(int n, struct bar_s *bars);
+static void visu_invalidate(int x1, int y1, int x2, int y2);
 
 /* scrolling undocumented information
 	grfs	
@@ -343,9 +379,6 @@ bool sb_displayer_init(void) {
 		visu.bar_gap = 1;
 		visu.back.frame = calloc(1, (displayer.width * displayer.height) / 8);
 		
-		// prepare the VU raw data in PSRAM
-		memcpy(vu_bitmap, vu_base, sizeof(vu_bitmap));
-		
 		// size scroller (width + current screen)
 		scroller.scroll.max = (displayer.width * displayer.height / 8) * (15 + 1);
 		scroller.scroll.frame = malloc(scroller.scroll.max);
@@ -365,12 +398,12 @@ bool sb_displayer_init(void) {
 	// inform LMS of our screen/led dimensions
 	sendSETD(GDS_GetWidth(display), GDS_GetHeight(display), led_visu.config);
 	
-	dsps_fft2r_init_fc32(meters.fft, FFT_LEN);
-	dsps_wind_hann_f32(meters.hanning, FFT_LEN);
+	spectrum_init();
 		
 	// create displayer management task
 	displayer.mutex = xSemaphoreCreateMutex();
-	displayer.task = xTaskCreateStatic( (TaskFunction_t) displayer_task, "sb_displayer", SCROLL_STACK_SIZE, NULL, ESP_TASK_PRIO_MIN + 1, xStack, &xTaskBuffer);
+	displayer.task = xTaskCreateStaticPinnedToCore( (TaskFunction_t) displayer_task, "sb_displayer", SCROLL_STACK_SIZE, NULL, ESP_TASK_PRIO_MIN + 1, xStack, &xTaskBuffer,
+													task_profile_core(TASK_DISPLAY, tskNO_AFFINITY));
 	
 	// chain handlers
 	slimp_handler_chain = slimp_handler;
@@ -398,7 +431,8 @@ static bool display_bus_handler(void *from, enum display_bus_cmd_e cmd) {
 		displayer.owned = false;
 		break;
 	case DISPLAY_BUS_GIVE:
-		displayer.owned = true;
+		// whoever had the display has drawn over our visu
+		displayer.owned = visu.redraw = true;
 		break;
 	}
 	
@@ -461,7 +495,7 @@ static void server(in_addr_t ip, u16_t hport, u16_t cport) {
 	
 	sprintf(msg, "%s:%hu", inet_ntoa(ip), hport);
 	if (display && displayer.owned) GDS_TextPos(display, GDS_FONT_LINE_1, GDS_TEXT_CENTERED, GDS_TEXT_CLEAR | GDS_TEXT_UPDATE, msg);
-	displayer.dirty = true;
+	displayer.dirty = visu.redraw = true;
 	
 	xSemaphoreGive(displayer.mutex);
 		
@@ -620,67 +654,80 @@ static void vfdc_handler( u8_t *_data, int bytes_read) {
 }
 
 /****************************************************************************************
- * Display VU-Meter (lots of hard-coding)
+ * Render one VU-Meter pixel (VU data is by columns) in a sprite
  */
-void draw_VU(struct GDS_Device * display, int level, int x, int y, int width, bool rotate) {
-	// VU data is by columns and vertical flip to allow block offset 
-	uint8_t *data = vu_bitmap;
-	int offset = level > 0 ? vu_arrow[level].offset * VU_HEIGHT : 0;
+static void vu_pixel(struct GDS_Device *sprite, int col, int row, uint8_t level, bool rotate) {
+	int color = GDS_GetMode(display) <= GDS_GRAYSCALE ? level >> (8 - GDS_GetDepth(display)) : grayMap[level];
+	if (rotate) GDS_DrawPixelFast(sprite, VU_HEIGHT - 1 - row, col, color);
+	else GDS_DrawPixelFast(sprite, col, row, color);
+}
 
-	// place the arrow in base VU
-	memcpy(data + offset, vu_arrow[level].data, sizeof(vu_arrow[level].data));
+/****************************************************************************************
+ * Pre-render VU-Meter background and all needles (only once per layout)
+ */
+static void vu_render(int width, bool rotate) {
+	int crop = (VU_WIDTH - width) / 2;
+	
+	GDS_DeleteSprite(vu_sprites.base);
+	for (int i = 0; i < VU_COUNT; i++) GDS_DeleteSprite(vu_sprites.needles[i].sprite);
+	memset(&vu_sprites, 0, sizeof(vu_sprites));
 	
+	vu_sprites.base = rotate ? GDS_CreateSprite(display, VU_HEIGHT, width) : GDS_CreateSprite(display, width, VU_HEIGHT);
+	if (!vu_sprites.base) {
+		LOG_ERROR("can't allocate VU-Meter sprites");
+		return;
+	}	
+	
+	for (int c = 0; c < width; c++) {
+		for (int r = 0; r < VU_HEIGHT; r++) vu_pixel(vu_sprites.base, c, r, vu_base[(c + crop) * VU_HEIGHT + r], rotate);
+	}	
+	
+	// needles are full columns of the VU-Meter, only keep what is in the window
+	for (int i = 0; i < VU_COUNT; i++) {
+		int offset = i > 0 ? vu_arrow[i].offset : 0;
+		int first = max(offset, crop), last = min(offset + ARROW_WIDTH, crop + width);
+		
+		if (first >= last) continue;
+		
+		struct GDS_Device *sprite = rotate ? GDS_CreateSprite(display, VU_HEIGHT, last - first) : GDS_CreateSprite(display, last - first, VU_HEIGHT);
+		if (!sprite) continue;
+		
+		for (int c = first; c < last; c++) {
+			for (int r = 0; r < VU_HEIGHT; r++) vu_pixel(sprite, c - first, r, vu_arrow[i].data[(c - offset) * VU_HEIGHT + r], rotate);
+		}	
+		
+		vu_sprites.needles[i].sprite = sprite;
+		vu_sprites.needles[i].offset = first - crop;
+	}
+	
+	vu_sprites.width = width;
+	vu_sprites.rotate = rotate;
+	LOG_INFO("VU-Meter sprites rendered for width %d (rotate:%u)", width, rotate);
+}
+
+/****************************************************************************************
+ * Display VU-Meter (lots of hard-coding)
+ */
+void draw_VU(struct GDS_Device * display, int level, int x, int y, int width, bool rotate) {
 	// adjust to current display window
 	if (width > VU_WIDTH) {
 		if (rotate) y += (width - VU_WIDTH) / 2;		
 		else x += (width - VU_WIDTH) / 2;		
 		width = VU_WIDTH;
-	} else {
-		data += (VU_WIDTH - width) / 2 * VU_HEIGHT;	
-	}	
-
-	if (GDS_GetMode(display) <= GDS_GRAYSCALE) {
-		// this is 8 bits grayscale
-		int scale = 8 - GDS_GetDepth(display);
+	}
 	
-		// use "fast" version as we are not beyond screen boundaries
-		if (rotate) {
-			for (int r = 0; r < width; r++) {
-				for (int c = VU_HEIGHT; --c >= 0;) {
-					GDS_DrawPixelFast(display, c + x, r + y, *data++ >> scale);
-				}	
-			}	
-		} else {
-			for (int r = 0; r < width; r++) {
-				for (int c = 0; c < VU_HEIGHT; c++) {
-					GDS_DrawPixelFast(display, r + x, c + y, *data++ >> scale);
-				}	
-			}			
-		}	
-	} else {
-		// use "fast" version as we are not beyond screen boundaries
-		if (rotate) {
-			for (int r = 0; r < width; r++) {
-				for (int c = VU_HEIGHT; --c >= 0;) {
-					GDS_DrawPixelFast(display, c + x, r + y, grayMap[*data++]);
-				}	
-			}	
-		} else {
-			for (int r = 0; r < width; r++) {
-				for (int c = 0; c < VU_HEIGHT; c++) {
-					GDS_DrawPixelFast(display, r + x, c + y, grayMap[*data++]);
-				}	
-			}			
-		}	
-	}	
+	if (width != vu_sprites.width || rotate != vu_sprites.rotate) vu_render(width, rotate);
+	if (!vu_sprites.base) return;
 	
-	// restore base VU
-	memcpy(vu_bitmap + offset, vu_base + offset, sizeof(vu_arrow[level].data));
+	// background then needle at its place
+	GDS_Blit(display, vu_sprites.base, x, y);
 	
-	// need to manually set dirty flag as DrawPixel does not do it
-	GDS_SetDirty(display);
-}
+	if (vu_sprites.needles[level].sprite) {
+		if (rotate) GDS_Blit(display, vu_sprites.needles[level].sprite, x, y + vu_sprites.needles[level].offset);
+		else GDS_Blit(display, vu_sprites.needles[level].sprite, x + vu_sprites.needles[level].offset, y);
+	}	
 
+}
 /****************************************************************************************
  * Process graphic display data
  */
@@ -714,6 +761,7 @@ static void grfe_handler( u8_t *data, int len) {
 		if (displayer.dirty || (artwork.enable && width == displayer.width && artwork.y < displayer.height)) {
 			GDS_Clear(display, GDS_COLOR_BLACK);
 			displayer.dirty = false;
+			visu.redraw = true;
 		}	
 	
 		// when doing screensaver, that frame becomes a visu background
@@ -726,6 +774,7 @@ static void grfe_handler( u8_t *data, int len) {
 		}
 		
 		GDS_DrawBitmapCBR(display, data + sizeof(struct grfe_packet), width, displayer.height, GDS_COLOR_WHITE);
+		visu_invalidate(0, 0, width - 1, displayer.height - 1);
 		GDS_Update(display);
 	}	
 	
@@ -845,6 +894,7 @@ static void grfg_handler(u8_t *data, int len) {
 	// can only write if we really own display
 	if (displayer.owned) {
 		GDS_DrawBitmapCBR(display, scroller.frame, scroller.back.width, displayer.height, GDS_COLOR_WHITE);
+		visu_invalidate(0, 0, scroller.back.width - 1, displayer.height - 1);
 		GDS_Update(display);
 	}	
 		
@@ -881,7 +931,10 @@ static void grfa_handler(u8_t *data, int len) {
 			// this is just to specify artwork coordinates
 			artwork.x = htons(pkt->x);
 			artwork.y = htons(pkt->y);		
-		} else if (artwork.size) GDS_ClearWindow(display, artwork.x, artwork.y, -1, -1, GDS_COLOR_BLACK);
+		} else if (artwork.size) {
+			GDS_ClearWindow(display, artwork.x, artwork.y, -1, -1, GDS_COLOR_BLACK);
+			visu_invalidate(artwork.x, artwork.y, INT_MAX, INT_MAX);
+		}	
 		
 		artwork.full = artwork.enable && artwork.x == 0 && artwork.y == 0;
 		LOG_DEBUG("gfra en:%u x:%hu, y:%hu", artwork.enable, artwork.x, artwork.y);
@@ -895,6 +948,7 @@ static void grfa_handler(u8_t *data, int len) {
 		// same trick to clean current/previous window
 		if (artwork.size) {
 			GDS_ClearWindow(display, artwork.x, artwork.y, -1, -1, GDS_COLOR_BLACK);
+			visu_invalidate(artwork.x, artwork.y, INT_MAX, INT_MAX);
 			artwork.size = 0;
 		}
 		
@@ -912,7 +966,8 @@ static void grfa_handler(u8_t *data, int len) {
 	if (artwork.size == length) {
 		GDS_ClearWindow(display, artwork.x, artwork.y, -1, -1, GDS_COLOR_BLACK);
 		xSemaphoreTake(displayer.mutex, portMAX_DELAY);			
-		GDS_DrawJPEG(display, artwork.data, artwork.x, artwork.y, artwork.y < displayer.height ? (GDS_IMAGE_RIGHT | GDS_IMAGE_TOP) : GDS_IMAGE_CENTER);
+		display_draw_artwork(artwork.data, length, artwork.x, artwork.y, artwork.y < displayer.height ? (GDS_IMAGE_RIGHT | GDS_IMAGE_TOP) : GDS_IMAGE_CENTER);
+		visu_invalidate(artwork.x, artwork.y, INT_MAX, INT_MAX);
 		xSemaphoreGive(displayer.mutex);		
 		free(artwork.data);
 		artwork.data = NULL;
@@ -922,36 +977,189 @@ static void grfa_handler(u8_t *data, int len) {
 }
 
 /****************************************************************************************
- * Fit spectrum into N bands and convert to dB
+ * Spectrum analyzer setup, "spectrum_config" is size=<256..2048>[,q15]
  */
-void spectrum_scale(int n, struct bar_s *bars, int max, float *samples) { 
-	float rate = visu_export.rate;			
-	// now arrange the result with the number of bar and sampling rate (don't want DC)
-	for (int i = 0, j = 1; i < n && j < (FFT_LEN / 2); i++) {
-		float power, count;
-
-		// find the next point in FFT (this is real signal, so only half matters)
-		for (count = 0, power = 0; j * visu_export.rate < bars[i].limit * FFT_LEN && j < FFT_LEN / 2; j++, count += 1) {
-			power += samples[2*j] * samples[2*j] + samples[2*j+1] * samples[2*j+1];
+static void spectrum_init(void) {
+	char *config = config_alloc_get_default(NVS_TYPE_STR, "spectrum_config", "", 0);
+	int len = FFT_DEFAULT;
+	
+	if (config) {
+		PARSE_PARAM(config, "size", '=', len);
+		meters.q15 = strcasestr(config, "q15") != NULL;
+		free(config);
+	}	
+	
+	// must be a power of 2 within bounds
+	for (meters.len = FFT_MIN; meters.len < FFT_MAX && meters.len < len; meters.len <<= 1);
+	meters.rate = meters.export.rate = 44100;
+	
+	// real FFT of len samples is a complex FFT of len/2 + twiddles to separate odd/even
+	int half = meters.len / 2;
+	for (int k = 0; k < half; k++) {
+		meters.twiddle[2*k] = cosf(2 * M_PI * k / meters.len);
+		meters.twiddle[2*k+1] = -sinf(2 * M_PI * k / meters.len);
+	}	
+	
+	dsps_wind_hann_f32(meters.hanning, meters.len);
+	
+	/* 
+	 We own the twiddle tables instead of using dsps_fft2r_init_xxx whose globals are 
+	 only set once and where sc16 is sized from fc32's table. Float one is always built
+	 as it is the reference for Q15 and its fallback
+	*/
+	esp_err_t err = dsps_gen_w_r2_fc32(meters.fft, half);
+	if (err == ESP_OK) err = dsps_bit_rev_fc32_ansi(meters.fft, half >> 1);
+	if (err != ESP_OK) LOG_ERROR("can't build FFT table for %d points (%d)", meters.len, err);
+	
+	if (meters.q15) {
+		for (int i = 0; i < meters.len; i++) meters.hanning_sc16[i] = meters.hanning[i] * INT16_MAX;
+		err = dsps_gen_w_r2_sc16(meters.fft_sc16, half);
+		if (err == ESP_OK) err = dsps_bit_rev_sc16_ansi(meters.fft_sc16, half >> 1);
+		if (err != ESP_OK || !spectrum_check()) {
+			LOG_ERROR("Q15 spectrum unusable (%d), using float", err);
+			meters.q15 = false;
+		}	
+	}	
+	
+	LOG_INFO("Spectrum analyzer with %d points (%s), 50%% overlap", meters.len, meters.q15 ? "Q15" : "float");
+}
+
+/****************************************************************************************
+ * Map FFT bins to bars, must be updated when sample rate or bars change
+ */
+static void spectrum_map(int n, struct bar_s *bars) {
+	int half = meters.len / 2;
+	float rate = meters.rate;
+	
+	// this is real signal, so only half matters and we don't want DC
+	for (int i = 0, j = 1; i < n; i++) {
+		bars[i].first = j;
+		while (j < half && j * rate < bars[i].limit * meters.len) j++;
+		bars[i].last = j;
+		bars[i].ratio = j < half ? j - (bars[i].limit * meters.len) / rate : 0;
+	}
+}
+
+/****************************************************************************************
+ * Split the complex FFT of even/odd samples into the power spectrum of the real signal
+ */
+static void spectrum_power(float *z, float scale) {
+	int half = meters.len / 2;
+	
+	for (int k = 0; k < half; k++) {
+		int c = (half - k) & (half - 1);
+		float zr = z[2*k], zi = z[2*k+1], cr = z[2*c], ci = -z[2*c+1];
+		float wr = meters.twiddle[2*k], wi = meters.twiddle[2*k+1];
+		// spectrum of even and odd samples
+		float er = (zr + cr) / 2, ei = (zi + ci) / 2;
+		float odr = (zi - ci) / 2, odi = (cr - zr) / 2;
+		float xr = er + wr * odr - wi * odi, xi = ei + wr * odi + wi * odr;
+		meters.power[k] += (xr * xr + xi * xi) * scale;
+	}
+}
+
+/****************************************************************************************
+ * Windowed complex FFT of a mono (L+R) window into samples, stride is in s16 and both 
+ * channels are stride / 2 apart
+ */
+static void spectrum_fft(s16_t *iptr, int stride, bool q15) {
+	int half = meters.len / 2;
+
+	// on xtensa/esp32 the floating point FFT takes 1/2 cycles of the fixed point
+	if (q15) {
+		for (int i = 0; i < meters.len; i++, iptr += stride) {
+			meters.samples_sc16[i] = ((*iptr + *(iptr + stride / 2)) * meters.hanning_sc16[i]) >> 16;
 		}
-		// due to sample rate, we have reached the end of the available spectrum
-		if (j >= (FFT_LEN / 2)) {
-			// normalize accumulated data
+		dsps_fft2r_sc16_ae32_(meters.samples_sc16, half, meters.fft_sc16);
+		dsps_bit_rev_sc16_ansi(meters.samples_sc16, half);
+		// each stage scales by 1/2 and input was scaled by 1/2 as well
+		for (int i = 0; i < meters.len; i++) meters.samples[i] = meters.samples_sc16[i] * (float) meters.len;
+	} else {
+		for (int i = 0; i < meters.len; i++, iptr += stride) {
+			// don't normalize here, but we are due INT16_MAX and len / 2 / 2
+			meters.samples[i] = (float) (*iptr + *(iptr + stride / 2)) * meters.hanning[i];
+		}
+		dsps_fft2r_fc32_ae32_(meters.samples, half, meters.fft);
+		dsps_bit_rev_fc32_ansi(meters.samples, half);
+	}	
+}
+
+/****************************************************************************************
+ * Q15 and float spectra of a test tone must agree, or Q15 can't be trusted
+ */
+static bool spectrum_check(void) {
+	int half = meters.len / 2, bin = meters.len / 16, peak[2] = { 0 };
+	float power[2];
+	s16_t *tone = malloc(meters.len * 2 * sizeof(s16_t));
+	
+	if (!tone) return false;
+	
+	for (int i = 0; i < meters.len; i++) tone[2*i] = tone[2*i+1] = 8192 * sinf(2 * M_PI * bin * i / meters.len);
+	
+	for (int q15 = 0; q15 < 2; q15++) {
+		memset(meters.power, 0, sizeof(meters.power));
+		spectrum_fft(tone, 2, q15);
+		spectrum_power(meters.samples, 1);
+		for (int k = 1; k < half; k++) if (meters.power[k] > meters.power[peak[q15]]) peak[q15] = k;
+		power[q15] = meters.power[peak[q15]];
+	}
+	
+	memset(meters.power, 0, sizeof(meters.power));
+	free(tone);
+	
+	float delta = 10 * log10f((power[1] + 1) / (power[0] + 1));
+	LOG_INFO("spectrum check tone at bin %d, float peak %d, Q15 peak %d (%.2f dB)", bin, peak[0], peak[1], delta);
+	
+	return peak[0] == bin && peak[1] == bin && fabsf(delta) < 1;
+}
+
+/****************************************************************************************
+ * Average power spectrum of 2 mono windows with 50% overlap
+ */
+static void spectrum_run(void) {
+	int half = meters.len / 2;
+	u32_t cycles = esp_cpu_get_cycle_count();
+	
+	for (int w = 0; w < 2; w++) {
+		s16_t *iptr = (s16_t*) (meters.frames + w * half * BYTES_PER_FRAME) + (BYTES_PER_FRAME / 4) - 1;
+		spectrum_fft(iptr, 2 * BYTES_PER_FRAME / 4, meters.q15);
+		spectrum_power(meters.samples, 0.5);
+	}
+	
+	// report how much of the refresh budget we use
+	cycles = esp_cpu_get_cycle_count() - cycles;
+	meters.cycles.total += cycles;
+	meters.cycles.max = max(meters.cycles.max, cycles);
+	if (++meters.cycles.count == 100) {
+		LOG_DEBUG("spectrum %d points: %u cycles/refresh (max %u)", meters.len, (u32_t) (meters.cycles.total / 100), meters.cycles.max);
+		memset(&meters.cycles, 0, sizeof(meters.cycles));
+	}	
+}
+
+/****************************************************************************************
+ * Fit spectrum into N bands using bins map and convert to dB
+ */
+void spectrum_scale(int n, struct bar_s *bars, int max, float *spectrum) { 
+	for (int i = 0; i < n; i++) {
+		int count = bars[i].last - bars[i].first;
+		float power = 0;
+		
+		for (int j = bars[i].first; j < bars[i].last; j++) power += spectrum[j];
+		
+		if (bars[i].last >= meters.len / 2) {
+			// due to sample rate, we have reached the end of the available spectrum
 			if (count) power /= count * 2.;
 		} else if (count) {
-			// how much of what remains do we need to add
-			float ratio = j - (bars[i].limit * FFT_LEN) / rate;
-			power += (samples[2*j] * samples[2*j] + samples[2*j+1] * samples[2*j+1]) * ratio;
-					
-			// normalize accumulated data
-			power /= (count + ratio) * 2;
+			// add what we need of the next bin and normalize accumulated data
+			power += spectrum[bars[i].last] * bars[i].ratio;
+			power /= (count + bars[i].ratio) * 2;
 		} else {
 			// no data for that band (sampling rate too high), just assume same as previous one
-			power = (samples[2*j] * samples[2*j] + samples[2*j+1] * samples[2*j+1]) / 2.;
+			power = spectrum[bars[i].last] / 2.;
 		}	
 			
 		// convert to dB and bars, same back-off
-		bars[i].current = max * (0.01667f*10*(log10f(0.0000001f + power) - log10f(FFT_LEN*(visu_export.gain == FIXED_ONE ? 256 : 2))) - 0.2543f);
+		bars[i].current = max * (0.01667f*10*(log10f(0.0000001f + power) - log10f(meters.len*(meters.export.gain == FIXED_ONE ? 256 : 2))) - 0.2543f);
 		if (bars[i].current > max) bars[i].current = max;
 		else if (bars[i].current < 0) bars[i].current = 0;
 	}	
@@ -963,12 +1171,63 @@ void spectrum_scale(int n, struct bar_s *bars, int max, float *samples) {
 void vu_scale(struct bar_s *bars, int max, int *levels) { 
 	// convert to dB (1 bit remaining for getting X²/N, 60dB dynamic starting from 0dBFS = 3 bits back-off)
 	for (int i = 2; --i >= 0;) {	 
-		bars[i].current = max * (0.01667f*10*log10f(0.0000001f + (levels[i] >> (visu_export.gain == FIXED_ONE ? 8 : 1))) - 0.2543f);
+		bars[i].current = max * (0.01667f*10*log10f(0.0000001f + (levels[i] >> (meters.export.gain == FIXED_ONE ? 8 : 1))) - 0.2543f);
 		if (bars[i].current > max) bars[i].current = max;
 		else if (bars[i].current < 0) bars[i].current = 0;
 	}
 }	
 
+/****************************************************************************************
+ * Something else has been drawn in that window, visu must be fully redrawn
+ */
+static void visu_invalidate(int x1, int y1, int x2, int y2) {
+	if (x1 < visu.col + visu.width && x2 >= visu.col && y1 < visu.row + visu.height && y2 >= visu.row) visu.redraw = true;
+}
+
+/****************************************************************************************
+ * Bar is lit one level out of 2, peak takes 2 levels
+ */
+static inline bool visu_lit(struct bar_s *bar, int level) {
+	if (level <= bar->current && !(level & 1)) return true;
+	return bar->max > 2 && (level == bar->max || (level == bar->max + 1 && bar->max < visu.max - 1));
+}
+
+/****************************************************************************************
+ * Fill levels from..to of a bar (0 is its base) with a single rectangle
+ */
+static void visu_fill(int i, int from, int to, int color) {
+	if (visu.rotate) {
+		int x1 = visu.col;
+		int y1 = visu.row + visu.border + visu.bar_border + i*(visu.bar_width + visu.bar_gap);
+		GDS_ClearWindow(display, x1 + from, y1, x1 + to, y1 + visu.bar_width - 1, color);
+	} else {
+		int x1 = visu.col + visu.border + visu.bar_border + i*(visu.bar_width + visu.bar_gap);
+		int y1 = visu.row + visu.height - 1;
+		GDS_ClearWindow(display, x1, y1 - to, x1 + visu.bar_width - 1, y1 - from, color);
+	}
+}
+
+/****************************************************************************************
+ * Repaint levels from..to of a bar according to its current value and peak
+ */
+static void visu_bar(int i, int from, int to, bool erase) {
+	struct bar_s *bar = visu.bars + i;
+	
+	if (from < 0) from = 0;
+	if (to > visu.max) to = visu.max;
+	if (from > to) return;
+	
+	if (erase) visu_fill(i, from, to, GDS_COLOR_BLACK);
+	
+	for (int j = from; j <= to; j++) {
+		if (!visu_lit(bar, j)) continue;
+		int k = j;
+		while (k < to && visu_lit(bar, k + 1)) k++;
+		visu_fill(i, j, k, GDS_COLOR_WHITE);
+		j = k;
+	}
+}	
+
 /****************************************************************************************
  * visu draw
  */
@@ -976,55 +1235,56 @@ void visu_draw(void) {
 	// don't refresh screen if all max are 0 (we were are somewhat idle)
 	int clear = 0;
 	for (int i = visu.n; --i >= 0;) clear = max(clear, visu.bars[i].max);
-	if (clear) GDS_ClearExt(display, false, false, visu.col, visu.row, visu.col + visu.width - 1, visu.row + visu.height - 1);
-	
-	// draw background if we are in screensaver mode
-	if (!(visu.mode & VISU_ESP32) && visu.back.active) {
-		GDS_DrawBitmapCBR(display, visu.back.frame, visu.back.width, displayer.height, GDS_COLOR_WHITE);
-	}	
+	bool background = !(visu.mode & VISU_ESP32) && visu.back.active;
 
 	if ((visu.mode & ~VISU_ESP32) != VISU_VUMETER || !visu.style) {
-		// there is much more optimization to be done here, like not redrawing bars unless needed
+		// bars are only drawn where they changed, unless window has been overwritten or has a background
+		bool full = visu.redraw || (background && clear);
+		
+		if (full) {
+			GDS_ClearExt(display, false, false, visu.col, visu.row, visu.col + visu.width - 1, visu.row + visu.height - 1);
+			// draw background if we are in screensaver mode
+			if (background) GDS_DrawBitmapCBR(display, visu.back.frame, visu.back.width, displayer.height, GDS_COLOR_WHITE);
+			visu.redraw = false;
+		}	
+		
 		for (int i = visu.n; --i >= 0;) {
+			struct bar_s *bar = visu.bars + i;
+			
 			// update maximum
-			if (visu.bars[i].current > visu.bars[i].max) visu.bars[i].max = visu.bars[i].current;
-			else if (visu.bars[i].max) visu.bars[i].max--;
-			else if (!clear) continue;
-
-			if (visu.rotate) {
-				int x1 = visu.col;
-				int y1 = visu.row + visu.border + visu.bar_border + i*(visu.bar_width + visu.bar_gap);
-
-				for (int j = 0; j <= visu.bars[i].current; j += 2) 
-					GDS_DrawLine(display, x1 + j, y1, x1 + j, y1 + visu.bar_width - 1, GDS_COLOR_WHITE);
+			if (bar->current > bar->max) bar->max = bar->current;
+			else if (bar->max) bar->max--;
 			
-				if (visu.bars[i].max > 2) {
-					GDS_DrawLine(display, x1 + visu.bars[i].max, y1, x1 + visu.bars[i].max, y1 + visu.bar_width - 1, GDS_COLOR_WHITE);			
-					if (visu.bars[i].max < visu.max - 1) GDS_DrawLine(display, x1 + visu.bars[i].max + 1, y1, x1 + visu.bars[i].max + 1, y1 + visu.bar_width - 1, GDS_COLOR_WHITE);			
-				}
+			if (full) {
+				visu_bar(i, 0, max(bar->current, bar->max + 1), false);
 			} else {
-				int x1 = visu.col + visu.border + visu.bar_border + i*(visu.bar_width + visu.bar_gap);
-				int y1 = visu.row + visu.height - 1;
-				for (int j = 0; j <= visu.bars[i].current; j += 2) 
-				GDS_DrawLine(display, x1, y1 - j, x1 + visu.bar_width - 1, y1 - j, GDS_COLOR_WHITE);
-			
-				if (visu.bars[i].max > 2) {
-					GDS_DrawLine(display, x1, y1 - visu.bars[i].max, x1 + visu.bar_width - 1, y1 - visu.bars[i].max, GDS_COLOR_WHITE);			
-					if (visu.bars[i].max < visu.max - 1) GDS_DrawLine(display, x1, y1 - visu.bars[i].max + 1, x1 + visu.bar_width - 1, y1 - visu.bars[i].max + 1, GDS_COLOR_WHITE);			
+				// what has been added or removed on top of bar, then old and new peak
+				if (bar->current != bar->drawn) visu_bar(i, min(bar->current, bar->drawn) + 1, max(bar->current, bar->drawn), true);
+				if (bar->max != bar->peak) {
+					visu_bar(i, bar->peak, bar->peak + 1, true);
+					visu_bar(i, bar->max, bar->max + 1, true);
 				}
-			}
-		}
-	} else if (displayer.width / 2 >=  3 * VU_WIDTH / 4) {
-		if (visu.rotate) {
-			draw_VU(display, visu.bars[0].current, 0, visu.row, visu.height / 2, visu.rotate);
-			draw_VU(display, visu.bars[1].current, 0, visu.row + visu.height / 2, visu.height / 2, visu.rotate);
-		} else {
-			draw_VU(display, visu.bars[0].current, 0, visu.row, visu.width / 2, visu.rotate);
-			draw_VU(display, visu.bars[1].current, visu.width / 2, visu.row, visu.width / 2, visu.rotate);
+			}	
+			
+			bar->drawn = bar->current;
+			bar->peak = bar->max;
 		}
 	} else {
-		int level = (visu.bars[0].current + visu.bars[1].current) / 2;
-		draw_VU(display, level, 0, visu.row, visu.rotate ? visu.height : visu.width, visu.rotate);		
+		if (clear) GDS_ClearExt(display, false, false, visu.col, visu.row, visu.col + visu.width - 1, visu.row + visu.height - 1);
+		if (background) GDS_DrawBitmapCBR(display, visu.back.frame, visu.back.width, displayer.height, GDS_COLOR_WHITE);
+		
+		if (displayer.width / 2 >=  3 * VU_WIDTH / 4) {
+			if (visu.rotate) {
+				draw_VU(display, visu.bars[0].current, 0, visu.row, visu.height / 2, visu.rotate);
+				draw_VU(display, visu.bars[1].current, 0, visu.row + visu.height / 2, visu.height / 2, visu.rotate);
+			} else {
+				draw_VU(display, visu.bars[0].current, 0, visu.row, visu.width / 2, visu.rotate);
+				draw_VU(display, visu.bars[1].current, visu.width / 2, visu.row, visu.width / 2, visu.rotate);
+			}
+		} else {
+			int level = (visu.bars[0].current + visu.bars[1].current) / 2;
+			draw_VU(display, level, 0, visu.row, visu.rotate ? visu.height : visu.width, visu.rotate);		
+		}	
 	}	
 }	
 
@@ -1033,27 +1293,31 @@ void visu_draw(void) {
  */
 static void displayer_update(void) {
 	// no update when artwork is full screen and no led_strip (but no need to protect against not owning the display as we are playing	
-	if ((artwork.full && !led_visu.mode) || pthread_mutex_trylock(&visu_export.mutex)) {
-		return;
-	}	
+	if (artwork.full && !led_visu.mode) return;
 	
 	int mode = (visu.mode & ~VISU_ESP32) | led_visu.mode;
 				
-	// not enough frames
-	if (visu_export.level < (mode & VISU_SPECTRUM ? FFT_LEN : RMS_LEN) && visu_export.running) {
-		pthread_mutex_unlock(&visu_export.mutex);
-		return;
-	}
+	// not enough new frames (output is never blocked by us)
+	if (mode & VISU_SPECTRUM) {
+		if (!output_visu_snapshot(meters.frames, meters.len + meters.len / 2, meters.len / 2, &meters.cursor, &meters.export)) return;
+	} else if (!output_visu_snapshot(meters.frames, RMS_LEN, RMS_LEN, &meters.cursor, &meters.export)) return;
+	
+	// bins map depend on sample rate
+	if (meters.export.running && meters.export.rate != meters.rate) {
+		meters.rate = meters.export.rate;
+		spectrum_map(visu.n, visu.bars);
+		spectrum_map(led_visu.n, led_visu.bars);
+	}	
 	
 	// reset all levels no matter what
 	meters.levels[0] = meters.levels[1] = 0;
-	memset(meters.samples, 0, sizeof(meters.samples));	
+	memset(meters.power, 0, sizeof(meters.power));	
 	
-	if (visu_export.running) {
+	if (meters.export.running) {
 		
 		// calculate data for VU-meter						
 		if (mode & VISU_VUMETER) {
-			s16_t *iptr = (s16_t*) visu_export.buffer + (BYTES_PER_FRAME / 4) - 1;
+			s16_t *iptr = (s16_t*) meters.frames + (BYTES_PER_FRAME / 4) - 1;
 			int *left = &meters.levels[0], *right = &meters.levels[1];
 			// calculate sum(L²+R²), try to not overflow at the expense of some precision
 			for (int i = RMS_LEN; --i >= 0;) {
@@ -1065,30 +1329,12 @@ static void displayer_update(void) {
 		}
 		
 		// calculate data for spectrum
-		if (mode & VISU_SPECTRUM) {
-			s16_t *iptr = (s16_t*) visu_export.buffer + (BYTES_PER_FRAME / 4) - 1;
-			// on xtensa/esp32 the floating point FFT takes 1/2 cycles of the fixed point
-			for (int i = 0 ; i < FFT_LEN ; i++) {
-				// don't normalize here, but we are due INT16_MAX and FFT_LEN / 2 / 2
-				meters.samples[i * 2 + 0] = (float) (*iptr + *(iptr+BYTES_PER_FRAME/4)) * meters.hanning[i];
-				meters.samples[i * 2 + 1] = 0;
-				iptr += 2 * BYTES_PER_FRAME / 4;
-			}
-
-			// actual FFT that might be less cycle than all the crap below		
-			dsps_fft2r_fc32_ae32(meters.samples, FFT_LEN);
-			dsps_bit_rev_fc32_ansi(meters.samples, FFT_LEN);
-		}	
-		
+		if (mode & VISU_SPECTRUM) spectrum_run();
 	} 
 		
-	// we took what we want, we can release the buffer
-	visu_export.level = 0;
-	pthread_mutex_unlock(&visu_export.mutex);
-
 	// actualize the display
 	if (visu.mode && !artwork.full) {
-		if (visu.mode & VISU_SPECTRUM) spectrum_scale(visu.n, visu.bars, visu.max, meters.samples);
+		if (visu.mode & VISU_SPECTRUM) spectrum_scale(visu.n, visu.bars, visu.max, meters.power);
 		else for (int i = 2; --i >= 0;) vu_scale(visu.bars, visu.max, meters.levels);
 		visu_draw();
 	}	
@@ -1100,7 +1346,7 @@ static void displayer_update(void) {
 			vu_scale(led_visu.bars, led_visu.gain, meters.levels);
 			led_vu_display(led_visu.bars[0].current, led_visu.bars[1].current, led_visu.max, led_visu.style);
 		} else if (led_visu.mode == VISU_SPECTRUM) { 
-			spectrum_scale(led_visu.n, led_visu.bars, led_visu.gain, meters.samples);
+			spectrum_scale(led_visu.n, led_visu.bars, led_visu.gain, meters.power);
 			uint8_t* p = (uint8_t*) led_data;
 			for (int i = 0; i < led_visu.n; i++) {
 				*p = led_visu.bars[i].current;
@@ -1108,7 +1354,7 @@ static void displayer_update(void) {
 			}
 			led_vu_spectrum(led_data, led_visu.max, led_visu.n, led_visu.style);
 		} else if (led_visu.mode == VISU_WAVEFORM) {
-			spectrum_scale(led_visu.n, led_visu.bars, led_visu.gain, meters.samples);
+			spectrum_scale(led_visu.n, led_visu.bars, led_visu.gain, meters.power);
 			led_vu_spin_dial(
 				led_visu.bars[led_visu.n-2].current,
 				led_visu.bars[(led_visu.n/2)+1].current * 50 / led_visu.max,
@@ -1142,6 +1388,7 @@ static void visu_fit(int bars, int width, int height) {
 		visu.max = height - 1;
 		if (visu.spectrum_scale <= 0 || visu.spectrum_scale > 0.5) visu.spectrum_scale = 0.5;
 		spectrum_limits(visu.bars, 0, visu.n, 0, visu.spectrum_scale);
+		spectrum_map(visu.n, visu.bars);
 	} else {
 		visu.n = 2;
 		visu.max = (visu.style ? VU_COUNT : height) - 1;
@@ -1264,6 +1511,7 @@ static void visu_handler( u8_t *data, int len) {
 		for (int i = visu.n; --i >= 0;) visu.bars[i].max = 0;
 				
 		GDS_ClearExt(display, false, true, visu.col, visu.row, visu.col + visu.width - 1, visu.row + visu.height - 1);
+		visu.redraw = true;
 		
 		LOG_INFO("Visualizer with %u bars of width %d:%d:%d:%d (%w:%u,h:%u,c:%u,r:%u,s:%.02f)", visu.n, visu.bar_border, visu.bar_width, visu.bar_gap, visu.border, visu.width, visu.height, visu.col, visu.row, visu.spectrum_scale);
 	} else {
@@ -1291,9 +1539,11 @@ static void ledv_handler( u8_t *data, int len) {
 		if (led_visu.mode == VISU_SPECTRUM) {
 			led_visu.n = (led_visu.config < MAX_BARS) ? led_visu.config : MAX_BARS;
 			spectrum_limits(led_visu.bars, 0, led_visu.n, 0, 0.25);
+			spectrum_map(led_visu.n, led_visu.bars);
 		} else if (led_visu.mode == VISU_WAVEFORM) {
 			led_visu.n = 6;
 			spectrum_limits(led_visu.bars, 0, led_visu.n, 0, 0.25);
+			spectrum_map(led_visu.n, led_visu.bars);
 		} 
 		
 		displayer.wake = 1; // wake up 
@@ -1367,7 +1617,10 @@ static void displayer_task(void *args) {
 				memcpy(scroller.frame, scroller.back.frame, scroller.back.width * displayer.height / 8);
 				for (int i = 0; i < scroller.width * displayer.height / 8; i++) scroller.frame[i] |= scroller.scroll.frame[scroller.scrolled * displayer.height / 8 + i];
 				scroller.scrolled += scroller.by;
-				if (displayer.owned) GDS_DrawBitmapCBR(display, scroller.frame, scroller.width, displayer.height, GDS_COLOR_WHITE);	
+				if (displayer.owned) {
+					GDS_DrawBitmapCBR(display, scroller.frame, scroller.width, displayer.height, GDS_COLOR_WHITE);	
+					visu_invalidate(0, 0, scroller.width - 1, displayer.height - 1);
+				}	
 				
 				// short sleep & don't need background update
 				scroller.wake = scroller.speed;
@@ -1392,7 +1645,9 @@ static void displayer_task(void *args) {
 		// update visu if active
 		if ((visu.mode || led_visu.mode) && displayer.wake <= 0 && displayer.owned) {
 			displayer_update();
-			displayer.wake = 100;
+			// bars are drawn incrementally so they can be refreshed faster than VU meters and led strips
+			bool bars = visu.mode && !artwork.full && ((visu.mode & ~VISU_ESP32) != VISU_VUMETER || !visu.style);
+			displayer.wake = bars ? VISU_WAKE : METER_WAKE;
 		}
 		
 		// need to make sure we own display
@@ -22,6 +22,7 @@
 #include "messaging.h"
 #include "gpio_exp.h"
 #include "accessors.h"
+#include "task_profile.h"
 
 #ifndef CONFIG_POWER_GPIO_LEVEL
 #define CONFIG_POWER_GPIO_LEVEL 1
@@ -77,6 +78,8 @@ int	pthread_create_name(pthread_t *thread, _CONST pthread_attr_t  *attr,
 	esp_pthread_cfg_t cfg = esp_pthread_get_default_config(); 
 	cfg.thread_name = name; 
 	cfg.inherit_cfg = true; 
+	if (!strcmp(name, "decode")) cfg.pin_to_core = task_profile_core(TASK_DECODE, cfg.pin_to_core);
+	else if (!strcmp(name, "stream")) cfg.pin_to_core = task_profile_core(TASK_STREAM, cfg.pin_to_core);
 	esp_pthread_set_cfg(&cfg); 
 	return pthread_create(thread, attr, start_routine, arg);
 }
@@ -90,12 +90,19 @@ void set_name(char *name);		// can be defined as an empty macro
 
 // to be defined to nothing if you don't want to support these
 extern struct visu_export_s {
-	pthread_mutex_t mutex;
-	u32_t level, size, rate, gain;
+	u32_t wpos, wend, size;	// frames written so far, being written, ring size in frames
+	u32_t seq;				// odd while rate, gain and running are updated
+	u32_t rate, gain;
+	u32_t readers;			// snapshots in progress, buffer can't be freed
 	void *buffer;
 	bool running;
 } visu_export;
+struct visu_snapshot_s {
+	u32_t rate, gain;
+	bool running;
+};
 void 		output_visu_export(void *frames, frames_t out_frames, u32_t rate, bool silence, u32_t gain);
+bool 		output_visu_snapshot(void *frames, frames_t count, frames_t fresh, u32_t *cursor, struct visu_snapshot_s *meta);
 void 		output_visu_init(log_level level);
 void 		output_visu_close(void);
 
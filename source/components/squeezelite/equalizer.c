@@ -9,24 +9,54 @@
  */
 
 #include "math.h"
+#include <stdatomic.h>
 #include "platform_config.h"
 #include "squeezelite.h"
 #include "equalizer.h"
-#include "esp_equalizer.h"
+#include "biquad.h"
 
 #define EQ_BANDS 10
+#define EQ_Q	 1.414f
+#define EQ_RAMP_MS	50
 
 static log_level loglevel = lINFO;
 
+// set by slimproto, sinks volume and console, always under mutex
+static mutex_type mutex = PTHREAD_MUTEX_INITIALIZER;
 static EXT_RAM_ATTR struct {
-	void *handle;
     float loudness, volume;
-    uint32_t samplerate;
 	int8_t gain[EQ_BANDS];
 	float loudness_gain[EQ_BANDS];
-	bool update;
 } equalizer;
 
+/* 
+ Gains are handed over to the output thread through a double buffer. Writer fills
+ the slot not published and makes its sequence odd while doing so. Reader only 
+ uses a slot if its sequence is even and did not change while copying, otherwise
+ it keeps current gains and tries again at next block. Reader never waits. There
+ are several writers (slimproto, sinks volume, console) so they are serialized by
+ the mutex, which the output thread never takes.
+*/ 
+static struct {
+	atomic_uint version;
+	atomic_int published;
+	struct {
+		atomic_uint seq;
+		float gains[EQ_BANDS];
+	} slot[2];
+} params;
+
+// owned by output thread, filters are used for every sample so keep them in internal RAM
+static struct {
+	bool active;
+	unsigned version;
+	uint32_t samplerate, ramp_ms;
+	struct biquad_bank_s bank;
+} dsp = { .ramp_ms = EQ_RAMP_MS };
+
+// LMS bands centers (Hz)
+static const float bands[EQ_BANDS] = { 31.25, 62.5, 125, 250, 500, 1000, 2000, 4000, 8000, 16000 };
+
 #define POLYNOME_COUNT 6
 
 static const float loudness_envelope_coefficients[EQ_BANDS][POLYNOME_COUNT] = {
@@ -65,9 +95,10 @@ static const float loudness_envelope_coefficients[EQ_BANDS][POLYNOME_COUNT] = {
  * calculate loudness gains
  */
 static void calculate_loudness(void) {
-    char trace[EQ_BANDS * 5 + 1];
+    char trace[EQ_BANDS * 10 + 1];
     size_t n = 0;
 	for (int i = 0; i < EQ_BANDS; i++) {
+		equalizer.loudness_gain[i] = 0;
 		for (int j = 0; j < POLYNOME_COUNT && equalizer.loudness != 0; j++) {
 			equalizer.loudness_gain[i] +=
 				loudness_envelope_coefficients[i][j] * pow(equalizer.volume, j);
@@ -78,6 +109,39 @@ static void calculate_loudness(void) {
     LOG_INFO("loudness %s", trace);    
 }
 
+/****************************************************************************************
+ * publish gains for output thread, must hold mutex
+ */
+static void publish_gains(void) {
+	int slot = !atomic_load(&params.published);
+
+	atomic_fetch_add(&params.slot[slot].seq, 1);
+	for (int i = 0; i < EQ_BANDS; i++) params.slot[slot].gains[i] = equalizer.gain[i] + equalizer.loudness_gain[i];
+	atomic_fetch_add(&params.slot[slot].seq, 1);
+
+	atomic_store(&params.published, slot);
+	atomic_fetch_add(&params.version, 1);
+}
+
+/****************************************************************************************
+ * fetch latest gains, returns false if none or if writer is busy
+ */
+static bool fetch_gains(float *gains) {
+	unsigned version = atomic_load(&params.version);
+	if (version == dsp.version) return false;
+
+	int slot = atomic_load(&params.published);
+	unsigned seq = atomic_load(&params.slot[slot].seq);
+	if (seq & 1) return false;
+
+	memcpy(gains, params.slot[slot].gains, sizeof(params.slot[slot].gains));
+	atomic_thread_fence(memory_order_acquire);
+	if (atomic_load(&params.slot[slot].seq) != seq) return false;
+
+	dsp.version = version;
+	return true;
+}
+
 /****************************************************************************************
  * initialize equalizer
  */
@@ -98,132 +162,123 @@ void equalizer_init(void) {
     equalizer.loudness = atof(config) / 10.0;
 
 	free(config);
+
+    // time to move from one set of gains to the next one
+    config = config_alloc_get_default(NVS_TYPE_STR, "eq_ramp", STR(EQ_RAMP_MS), 0);
+    if (config) dsp.ramp_ms = atoi(config);
+
+	free(config);
+
+	mutex_lock(mutex);
+    publish_gains();
+	mutex_unlock(mutex);
 }
 
 /****************************************************************************************
  * close equalizer
  */
 void equalizer_close(void) {
-	if (equalizer.handle) {
-		esp_equalizer_uninit(equalizer.handle);
-		equalizer.handle = NULL;
-	}
+	// force filters and gains to be set again at next start
+	dsp.active = false;
+	dsp.samplerate = 0;
+	dsp.version = 0;
 }
 
 /****************************************************************************************
  * change sample rate
  */
 void equalizer_set_samplerate(uint32_t samplerate) {
-#if BYTES_PER_FRAME == 4
-    if (equalizer.samplerate != samplerate) equalizer_close();
-    equalizer.samplerate = samplerate;
-    equalizer.update = true;
+    if (dsp.samplerate == samplerate) return;
+    
+    // this is called from output thread (or before it starts) so we own filters
+    dsp.samplerate = samplerate;
+    biquad_init(&dsp.bank, bands, EQ_BANDS, EQ_Q, samplerate);
 
     LOG_INFO("equalizer sample rate %u", samplerate);
-#else
-    LOG_INFO("no equalizer with 32 bits samples");
-#endif
 }
 
 /****************************************************************************************
  * get volume update and recalculate loudness according to
  */
 void equalizer_set_volume(unsigned left, unsigned right) {
-#if BYTES_PER_FRAME == 4
     float volume = (left + right) / 2;
     // do classic dB conversion and scale it 0..100
 	if (volume) volume = log2(volume);
 	volume = volume / 16.0 * 100.0;
     
     // LMS has the bad habit to send multiple volume commands
+	mutex_lock(mutex);
     if (volume != equalizer.volume && equalizer.loudness) {
         equalizer.volume = volume;
         calculate_loudness();
-        equalizer.update = true;
+        publish_gains();
     }
-#endif
+	mutex_unlock(mutex);
 }
 
 /****************************************************************************************
  * change gains from LMS
  */
 void equalizer_set_gain(int8_t *gain) {
-#if BYTES_PER_FRAME == 4
     char config[EQ_BANDS * 4 + 1] = { };
 	int n = 0;
-    
-    if (memcmp(equalizer.gain, gain, EQ_BANDS) != 0) equalizer.update = true;
+
+	mutex_lock(mutex);
+    bool update = memcmp(equalizer.gain, gain, EQ_BANDS) != 0;
     
     for (int i = 0; i < EQ_BANDS; i++) {
 		equalizer.gain[i] = gain[i];
 		n += sprintf(config + n, "%d,", gain[i]);
 	}
 
+    if (update) publish_gains();
+	mutex_unlock(mutex);
+
 	config[n-1] = '\0';
 	config_set_value(NVS_TYPE_STR, "equalizer", config);
     
     LOG_INFO("equalizer gain %s", config);
-#else
-    LOG_INFO("no equalizer with 32 bits samples");
-#endif
 }
 
 /****************************************************************************************
  * change loudness from LMS
  */
 void equalizer_set_loudness(uint8_t loudness) {
-#if BYTES_PER_FRAME == 4
     char p[4];
     itoa(loudness, p, 10);
     config_set_value(NVS_TYPE_STR, "loudness", p);
     
     // update loudness gains as a factor of loudness and volume
+	mutex_lock(mutex);
     if (equalizer.loudness != loudness / 10.0) {
         equalizer.loudness = loudness / 10.0;
         calculate_loudness();
-        equalizer.update = true;
+        publish_gains();
     }
+	mutex_unlock(mutex);
 
     LOG_INFO("loudness %u", (unsigned) loudness);
-#else
-    LOG_INFO("no equalizer with 32 bits samples");
-#endif
 }
 
 /****************************************************************************************
  * process equalizer
  */
 void equalizer_process(uint8_t *buf, uint32_t bytes) {
-#if BYTES_PER_FRAME == 4    
-	// don't want to process with output locked, so take the small risk to miss one parametric update
-	if (equalizer.update) {
-        equalizer.update = false;
-
-        if (equalizer.samplerate != 11025 && equalizer.samplerate != 22050 && equalizer.samplerate != 44100 && equalizer.samplerate != 48000) {
-            LOG_WARN("equalizer only supports 11025, 22050, 44100 and 48000 sample rates, not %u", equalizer.samplerate);
-            return;
-        }
-
-        if (!equalizer.handle && ((equalizer.handle = esp_equalizer_init(2, equalizer.samplerate, EQ_BANDS, 0)) == NULL)) {
-            LOG_WARN("can't init equalizer");
-            return;
-        }
-
-		bool active = false;
-		for (int i = 0; i < EQ_BANDS; i++) {
-            float gain = equalizer.gain[i] + equalizer.loudness_gain[i];
-			esp_equalizer_set_band_value(equalizer.handle, gain, i, 0);
-			esp_equalizer_set_band_value(equalizer.handle, gain, i, 1);
-			active |= gain != 0;
-		}
-
-		// at the end do not activate equalizer if all gain are 0
-		if (!active) equalizer_close();
-		LOG_INFO("equalizer %s", active ? "actived" : "deactivated");
+	float gains[EQ_BANDS];
+	
+	// never wait for slimproto, just pick up new gains when they are available
+	if (dsp.samplerate && fetch_gains(gains)) {
+		// always ramp, even from inactive as all bands are then at 0 dB
+		biquad_set_gains(&dsp.bank, gains, dsp.samplerate * dsp.ramp_ms / 1000);
+		
+		// do not activate equalizer if all gain are 0 (deactivate once ramp is done)
+		bool active = biquad_active(&dsp.bank);
+		if (active != dsp.active) LOG_INFO("equalizer %s", active ? "actived" : "deactivated");
+		dsp.active = active;
 	}
 
-	if (equalizer.handle) {
-		esp_equalizer_process(equalizer.handle, buf, bytes, equalizer.samplerate, 2);
+	if (dsp.active) {
+		biquad_process(&dsp.bank, (ISAMPLE_T*) buf, bytes / BYTES_PER_FRAME);
+		dsp.active = biquad_active(&dsp.bank);
 	}
-#endif    
-}
\ No newline at end of file
+}
@@ -72,6 +72,9 @@ static void usage(const char *argv0) {
 #endif
 #endif
 		   "  -a <f>\t\tSpecify sample format (16|24|32) of output file when using -o - to output samples to stdout (interleaved little endian only)\n"
+#if EMBEDDED
+		   "  -a <f>\t\tSpecify S/PDIF word length (16|24), 24 requires a 32 bits build\n"
+#endif
 		   "  -b <stream>:<output>\tSpecify internal Stream and Output buffer sizes in Kbytes\n"
 		   "  -c <codec1>,<codec2>\tRestrict codecs to those specified, otherwise load all available codecs; known codecs: " CODECS "\n"
 		   "  \t\t\tCodecs reported to LMS in order listed, allowing codec priority refinement.\n"
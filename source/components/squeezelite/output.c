@@ -46,6 +46,7 @@ bool user_rates = false;
 frames_t _output_frames(frames_t avail) {
 
 	frames_t frames, size;
+	size_t space;
 	bool silence;
 	u8_t flags = output.channels;
 	
@@ -57,6 +58,7 @@ frames_t _output_frames(frames_t avail) {
 	if (output.invert) { gainL = -gainL; gainR = -gainR; }
 
 	frames = _buf_used(outputbuf) / BYTES_PER_FRAME;
+	space = _buf_space(outputbuf);
 	silence = false;
 
 	// start when threshold met
@@ -282,6 +284,9 @@ frames_t _output_frames(frames_t avail) {
 			
 	LOG_SDEBUG("wrote %u frames", frames);
 
+	// decoder might be waiting for room
+	decode_wake_space(space, _buf_space(outputbuf));
+
 	return frames;
 }
 
@@ -113,17 +113,16 @@ static int _write_frames(frames_t out_frames, bool silence, s32_t gainL, s32_t g
 	assert(btout != NULL);
 	
 	if (!silence ) {
-				
-		if (output.fade == FADE_ACTIVE && output.fade_dir == FADE_CROSS && *cross_ptr) {
-			_apply_cross(outputbuf, out_frames, cross_gain_in, cross_gain_out, cross_ptr);
-		}
-
-		_apply_gain(outputbuf, out_frames, gainL, gainR, flags);
-
+		bool cross = output.fade == FADE_ACTIVE && output.fade_dir == FADE_CROSS;
+		
 #if BYTES_PER_FRAME == 4
-		memcpy(btout + oframes * BYTES_PER_FRAME, outputbuf->readp, out_frames * BYTES_PER_FRAME);
+		_apply_and_pack(btout + oframes * BYTES_PER_FRAME, outputbuf, out_frames, gainL, gainR, flags, 
+						cross_gain_in, cross_gain_out, cross ? cross_ptr : NULL);
 #else
 	{
+		if (cross && *cross_ptr) _apply_cross(outputbuf, out_frames, cross_gain_in, cross_gain_out, cross_ptr);
+		_apply_gain(outputbuf, out_frames, gainL, gainR, flags);
+
 		frames_t count = out_frames;
 		s32_t *_iptr = (s32_t*) outputbuf->readp;
 		s16_t *_optr = (s16_t*) (btout + oframes * BYTES_PER_FRAME);
@@ -177,7 +176,10 @@ int32_t output_bt_data(uint8_t *data, int32_t len) {
 	output.frames_in_process = oframes;
 	UNLOCK;
 	
+#if BYTES_PER_FRAME == 4
+	// equalizer works on ISAMPLE_T but BT frames are always 16 bits
 	equalizer_process(data, oframes * BYTES_PER_FRAME);
+#endif
 
 	SET_MIN_MAX(TIME_MEASUREMENT_GET(start_timer),lock_out_time);
 	SET_MIN_MAX((len-oframes*BYTES_PER_FRAME), rec);
@@ -138,9 +138,9 @@ bool test_open(const char *device, unsigned rates[], bool userdef_rates) {
 							  12000, 11025, 8000, 0 };	
 		memcpy(rates, _rates, sizeof(_rates));
 	} else if (!strcasecmp(device, "SPDIF")) {
-		unsigned _rates[] = { 96000, 88200, 48000, 
-							  44100, 32000, 24000, 22050, 16000, 
-							  12000, 11025, 8000, 0 };	
+		// only rates that have a code in IEC 60958 channel status
+		unsigned _rates[] = { 192000, 176400, 96000, 88200, 48000, 
+							  44100, 32000, 24000, 22050, 0 };	
 		memcpy(rates, _rates, sizeof(_rates));
 	} else {
 		rates[0] = 44100;	
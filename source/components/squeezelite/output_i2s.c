@@ -10,19 +10,20 @@
  */
  
 /* 
-Synchronisation is a bit of a hack with i2s. The esp32 driver is always
-full when it starts, so there is a delay of the total length of buffers.
-In other words, i2s_write blocks at first call, until at least one buffer
-has been written (it uses a queue with produce / consume).
+Synchronisation is a bit of a hack with i2s. DMA is always full when it
+starts (with silence), so there is a delay of the total length of buffers.
+In other words, first buffers we fill are played only after that.
 
 The first hack is to consume that length at the beginning of tracks when
 synchronization is active. It's about ~180ms @ 44.1kHz
 
-The second hack is that we never know exactly the number of frames in the 
-DMA buffers when we update the output.frames_played_dmp. We assume that
-after i2s_write, these buffers are always full so by measuring the gap
-between time after i2s_write and update of frames_played_dmp, we have a
-good idea of the error. 
+There used to be a second hack to guess how many frames were in the DMA
+buffers. Now we own the DMA buffers: the driver hands them back once played
+(on_sent) and we pack samples directly into them (or convert them there for
+SPDIF and 32 bits slots), so we know exactly what is queued, down to the part
+of the buffer being played. That part is interpolated from the completion 
+time of the previous buffers, which are kept in a ring. Interrupt latency can
+only delay these timestamps, so the earliest of their projections is used.
 
 The third hack is when sample rate changes, buffers are reset and we also
 do the change too early, but can't do that exaclty at the right time. So 
@@ -34,6 +35,9 @@ sure that using rate_delay would fix that
 #include "slimproto.h"
 #include "esp_pthread.h"
 #include "driver/i2s.h"
+#include "driver/i2s_std.h"
+#include "hal/i2s_ll.h"
+#include "esp_timer.h"
 #include "driver/i2c.h"
 #include "driver/gpio.h"
 #include "perf_trace.h"
@@ -48,23 +52,27 @@ sure that using rate_delay would fix that
 #include "accessors.h"
 #include "equalizer.h"
 #include "globdefs.h"
+#include "task_profile.h"
+#include "spdif.h"
 
 #define LOCK   mutex_lock(outputbuf->mutex)
 #define UNLOCK mutex_unlock(outputbuf->mutex)
 
 #define FRAME_BLOCK MAX_SILENCE_FRAMES
-#define SPDIF_BLOCK	256
-
-/* we produce FRAME_BLOCK (2048) per loop of the i2s thread so it's better if they fit
- * inside a set of DMA buffer nicely, i.e. DMA_BUF_FRAMES * DMA_BUF_COUNT is a multiple 
- * of FRAME_BLOCK so that each DMA buffer is filled and we fully empty a FRAME_BLOCK at 
- * each loop. Because one DMA buffer in esp32 is 4092 or below, when using 16 bits 
- * samples and 2 channels, the best multiple is 512 (512*2*2=2048) and we use 6 of these.
- * In SPDIF, as we virtually use 32 bits per sample, the next proper multiple would
- * be 256 but such DMA buffers are too small and this causes stuttering. So we will use
- * non-multiples which means that at every loop one DMA buffer will be not fully filled. 
- * At least, let's make sure it's not a too small amount of samples so 450*4*2=3600 fits 
- * nicely in one DMA buffer and 2048/450 = 4 buffers + ~1/2 buffer which is acceptable.
+#define DMA_BUF_MAX_SIZE	4092
+#define DMA_RING			32
+#define DMA_RING_FIT		8
+
+/* All DMA buffers are preloaded with silence when I2S starts. Then dma_sent hands each
+ * of them back, cleared, once played and the output thread packs samples directly into
+ * it (or converts them for SPDIF and 16 bits samples in 32 bits slots). A loop fills at
+ * most what is left in the current buffer and the next one continues from there, so 
+ * FRAME_BLOCK does not have to be a multiple of DMA_BUF_FRAMES anymore. The total,
+ * DMA_BUF_FRAMES * DMA_BUF_COUNT, is the depth of the pipeline i.e. its latency and 
+ * margin against underrun (6144 frames, ~140ms at 44.1kHz). One DMA buffer in esp32 
+ * is 4092 bytes or below, so i2s_create caps the length (511 frames with 32 bits 
+ * samples). In SPDIF, each audio frame uses two 32 bits stereo DMA frames so 450 DMA 
+ * frames (3600 bytes) carry 225 audio frames and 7 of these are ~36ms at 44.1kHz.
  */
 #define DMA_BUF_FRAMES	512
 #define DMA_BUF_COUNT	12
@@ -77,6 +85,7 @@ sure that using rate_delay would fix that
 	DECLARE_MIN_MAX(s); 		\
 	DECLARE_MIN_MAX(rec); 		\
 	DECLARE_MIN_MAX(i2s_time); 	\
+	DECLARE_MIN_MAX(eq_time); 	\
 	DECLARE_MIN_MAX(buffering);
 
 #define RESET_ALL_MIN_MAX 		\
@@ -84,6 +93,7 @@ sure that using rate_delay would fix that
 	RESET_MIN_MAX(s); 			\
 	RESET_MIN_MAX(rec);	\
 	RESET_MIN_MAX(i2s_time);	\
+	RESET_MIN_MAX(eq_time);	\
 	RESET_MIN_MAX(buffering);
 	
 #define STATS_PERIOD_MS 5000
@@ -109,13 +119,26 @@ static bool (*slimp_handler_chain)(u8_t *data, int len);
 static bool jack_mutes_amp;
 static bool running, isI2SStarted, ended;
 static i2s_config_t i2s_config;
-static u8_t *obuf;
+static u8_t *obuf, *optr;
 static frames_t oframes;
 static struct {
 	bool enabled;
-	u8_t *buf;
+	u8_t bits;
 } spdif;
-static size_t dma_buf_frames;
+static struct {
+	i2s_chan_handle_t chan;
+	QueueHandle_t free;			// buffers played (and cleared) by DMA, ready to be refilled
+	u8_t * volatile buf;		// buffer being filled, NULL if none
+	frames_t offset;			// frames already in buf
+	size_t count, frames, bytes;// number of buffers, audio frames per buffer, bytes per audio frame in DMA
+	bool staged;				// samples need conversion, can't be packed directly in DMA
+	u32_t rate;					// audio frames per second in DMA
+	u32_t started;				// time (us) when DMA was enabled
+	struct {
+		volatile u32_t seq;		// buffers played since DMA was enabled
+		u32_t time[DMA_RING];	// time (us) each of the last buffers has been played
+	} sent;
+} dma;
 static TaskHandle_t output_i2s_task;
 static struct {
 	int gpio, active;
@@ -129,7 +152,7 @@ static int _i2s_write_frames(frames_t out_frames, bool silence, s32_t gainL, s32
 static void output_thread_i2s(void *arg);
 static void i2s_stats(uint32_t now);
 
-static void spdif_convert(ISAMPLE_T *src, size_t frames, u32_t *dst);
+static esp_err_t i2s_create(i2s_pin_config_t *pin);
 static void (*jack_handler_chain)(bool inserted);
 
 #define I2C_PORT	0
@@ -235,7 +258,7 @@ void __real_esp_panic_handler(void*);
 void __wrap_esp_panic_handler (void* info) {
     esp_rom_printf("I2S abort!\r\n");
     
-    i2s_stop(CONFIG_I2S_NUM);
+    i2s_ll_tx_stop(I2S_LL_GET_HW(CONFIG_I2S_NUM));
     
     /* Call the original panic handler function to finish processing this error */
     __real_esp_panic_handler(info);
@@ -307,9 +330,6 @@ void output_init_i2s(log_level level, char *device, unsigned output_buf_size, ch
 	
 	if (strcasestr(device, "spdif")) {
 		spdif.enabled = true;	
-		if ((spdif.buf = heap_caps_malloc(SPDIF_BLOCK * 16, MALLOC_CAP_INTERNAL)) == NULL) {
-			LOG_ERROR("Cannot allocate SPDIF buffer");
-		}
 	
 		if (i2s_spdif_pin.bck_io_num == -1 || i2s_spdif_pin.ws_io_num == -1 || i2s_spdif_pin.data_out_num == -1) {
 			LOG_WARN("Cannot initialize I2S for SPDIF bck:%d ws:%d do:%d", i2s_spdif_pin.bck_io_num, 
@@ -317,8 +337,13 @@ void output_init_i2s(log_level level, char *device, unsigned output_buf_size, ch
 																		   i2s_spdif_pin.data_out_num);
 		}
 									
-		i2s_config.sample_rate = output.current_sample_rate * 2;
+		// audio rate, the I2S clock runs twice faster (see i2s_clock)
+		i2s_config.sample_rate = output.current_sample_rate;
 		i2s_config.bits_per_sample = 32;
+		
+		// word length of samples, 24 bits are only available in 32 bits builds
+		spdif.bits = BYTES_PER_FRAME == 8 ? 24 : 16;
+		if (params && *params) spdif.bits = atoi(params) > 16 && BYTES_PER_FRAME == 8 ? 24 : 16;
 		// Normally counted in frames, but 16 sample are transformed into 32 bits in spdif
 		i2s_config.dma_buf_len = DMA_BUF_FRAMES_SPDIF;	
 		i2s_config.dma_buf_count = DMA_BUF_COUNT_SPDIF;
@@ -327,21 +352,18 @@ void output_init_i2s(log_level level, char *device, unsigned output_buf_size, ch
 		   we push at sample_rate * 2. Each of these pseudo-frames is a single true
 		   audio frame. So the real depth in true frames is (LEN * COUNT / 2)
 		*/   
-		dma_buf_frames = i2s_config.dma_buf_len * i2s_config.dma_buf_count / 2;	
 		
 		// silence DAC output if sharing the same ws/bck
 		if (i2s_dac_pin.ws_io_num == i2s_spdif_pin.ws_io_num && i2s_dac_pin.bck_io_num == i2s_spdif_pin.bck_io_num)	silent_do = i2s_dac_pin.data_out_num;		
 		
-		res = i2s_driver_install(CONFIG_I2S_NUM, &i2s_config, 0, NULL);
-		res |= i2s_set_pin(CONFIG_I2S_NUM, &i2s_spdif_pin);
-		LOG_INFO("SPDIF using I2S bck:%d, ws:%d, do:%d", i2s_spdif_pin.bck_io_num, i2s_spdif_pin.ws_io_num, i2s_spdif_pin.data_out_num);
+		res = i2s_create(&i2s_spdif_pin);
+		LOG_INFO("SPDIF using I2S bck:%d, ws:%d, do:%d, %u bits", i2s_spdif_pin.bck_io_num, i2s_spdif_pin.ws_io_num, i2s_spdif_pin.data_out_num, spdif.bits);
 	} else {
 		i2s_config.sample_rate = output.current_sample_rate;
 		i2s_config.bits_per_sample = BYTES_PER_FRAME * 8 / 2;
 		// Counted in frames (but i2s allocates a buffer <= 4092 bytes)
 		i2s_config.dma_buf_len = DMA_BUF_FRAMES;	
 		i2s_config.dma_buf_count = DMA_BUF_COUNT;
-		dma_buf_frames = i2s_config.dma_buf_len * i2s_config.dma_buf_count;
 		
 		// silence SPDIF output
 		silent_do = i2s_spdif_pin.data_out_num;		
@@ -382,8 +404,7 @@ void output_init_i2s(log_level level, char *device, unsigned output_buf_size, ch
         LOG_INFO("configuring MCLK on GPIO %d", i2s_dac_pin.mck_io_num);
 #endif    
        
-		res |= i2s_driver_install(CONFIG_I2S_NUM, &i2s_config, 0, NULL);
-		res |= i2s_set_pin(CONFIG_I2S_NUM, &i2s_dac_pin);
+		if (res == ESP_OK) res = i2s_create(&i2s_dac_pin);
         	
 		if (res == ESP_OK && mute_control.gpio >= 0) {
 			gpio_reset_pin(mute_control.gpio);
@@ -414,8 +435,7 @@ void output_init_i2s(log_level level, char *device, unsigned output_buf_size, ch
 			spdif.enabled ? "S/PDIF" : "normal", 
 			i2s_config.sample_rate, i2s_config.bits_per_sample, i2s_config.dma_buf_len, i2s_config.dma_buf_count);
 	
-	i2s_stop(CONFIG_I2S_NUM);
-	i2s_zero_dma_buffer(CONFIG_I2S_NUM);
+	// channel is created stopped, DMA buffers are cleared when it starts
 	isI2SStarted=false;
     
     equalizer_set_samplerate(output.current_sample_rate);
@@ -458,7 +478,8 @@ void output_init_i2s(log_level level, char *device, unsigned output_buf_size, ch
 		static DRAM_ATTR StaticTask_t xTaskBuffer __attribute__ ((aligned (4)));
 		static EXT_RAM_ATTR StackType_t xStack[OUTPUT_THREAD_STACK_SIZE] __attribute__ ((aligned (4)));
 		output_i2s_task = xTaskCreateStaticPinnedToCore( (TaskFunction_t) output_thread_i2s, "output_i2s", OUTPUT_THREAD_STACK_SIZE, 
-											  NULL, CONFIG_ESP32_PTHREAD_TASK_PRIO_DEFAULT + 10, xStack, &xTaskBuffer, 0 );
+											  NULL, CONFIG_ESP32_PTHREAD_TASK_PRIO_DEFAULT + 10, xStack, &xTaskBuffer,
+											  task_profile_core(TASK_OUTPUT, 0) );
 	}
 }
 
@@ -472,7 +493,9 @@ void output_close_i2s(void) {
 	
 	while (!ended) vTaskDelay(20 / portTICK_PERIOD_MS);
 	
-	i2s_driver_uninstall(CONFIG_I2S_NUM);
+	if (isI2SStarted) i2s_channel_disable(dma.chan);
+	i2s_del_channel(dma.chan);
+	vQueueDelete(dma.free);
 	free(obuf);
 	
 	equalizer_close();
@@ -494,19 +517,17 @@ bool output_volume_i2s(unsigned left, unsigned right) {
 static int _i2s_write_frames(frames_t out_frames, bool silence, s32_t gainL, s32_t gainR, u8_t flags,
 								s32_t cross_gain_in, s32_t cross_gain_out, ISAMPLE_T **cross_ptr) {
 	if (!silence) {
-		if (output.fade == FADE_ACTIVE && output.fade_dir == FADE_CROSS && *cross_ptr) {
-			_apply_cross(outputbuf, out_frames, cross_gain_in, cross_gain_out, cross_ptr);
-		}
-		
-		_apply_gain(outputbuf, out_frames, gainL, gainR, flags);
-		memcpy(obuf + oframes * BYTES_PER_FRAME, outputbuf->readp, out_frames * BYTES_PER_FRAME);
+		// crossfade, gain and mono in a single pass from outputbuf to obuf or DMA
+		bool cross = output.fade == FADE_ACTIVE && output.fade_dir == FADE_CROSS;
+		_apply_and_pack(optr + oframes * BYTES_PER_FRAME, outputbuf, out_frames, gainL, gainR, flags, 
+						cross_gain_in, cross_gain_out, cross ? cross_ptr : NULL);
 	} else {
-		memcpy(obuf + oframes * BYTES_PER_FRAME, silencebuf, out_frames * BYTES_PER_FRAME);
+		memcpy(optr + oframes * BYTES_PER_FRAME, silencebuf, out_frames * BYTES_PER_FRAME);
 	}
 
 	// don't update visu if we don't have enough data in buffer (500 ms)
 	if (silence || _buf_used(outputbuf) >  BYTES_PER_FRAME * output.current_sample_rate / 2) {
-		output_visu_export(obuf + oframes * BYTES_PER_FRAME, out_frames, output.current_sample_rate, silence, (gainL + gainR) / 2);
+		output_visu_export(optr + oframes * BYTES_PER_FRAME, out_frames, output.current_sample_rate, silence, (gainL + gainR) / 2);
 	}
 		
 	oframes += out_frames;
@@ -514,19 +535,208 @@ static int _i2s_write_frames(frames_t out_frames, bool silence, s32_t gainL, s32
 	return out_frames;
 }
 
+/****************************************************************************************
+ * DMA buffer has been played, clear it and hand it back for refill (ISR)
+ */
+static bool IRAM_ATTR dma_sent(i2s_chan_handle_t chan, i2s_event_data_t *event, void *ctx) {
+	u8_t *buf = *(u8_t**) event->data;
+	BaseType_t woken = pdFALSE;
+
+	dma.sent.time[dma.sent.seq % DMA_RING] = esp_timer_get_time();
+	dma.sent.seq++;
+
+	// we are so late that DMA caught up with the buffer being filled, take it back so 
+	// that it is requeued as silence like the others and filler moves to the next one
+	if (buf == dma.buf) dma.buf = NULL;
+
+	// in case of underrun, do not replay old buffer
+	memset(buf, 0, event->size);
+	xQueueSendFromISR(dma.free, &buf, &woken);
+
+	return woken == pdTRUE;
+}
+
+/****************************************************************************************
+ * I2S clock for an audio rate. In SPDIF, each audio frame uses two 32 bits stereo frames 
+ * so I2S runs at twice the rate and MCLK must be lowered to 128x for 176.4k/192k
+ */
+static i2s_std_clk_config_t i2s_clock(uint32_t sample_rate) {
+	i2s_std_clk_config_t clk_cfg = I2S_STD_CLK_DEFAULT_CONFIG(spdif.enabled ? sample_rate * 2 : sample_rate);
+
+	if (spdif.enabled) clk_cfg.mclk_multiple = I2S_MCLK_MULTIPLE_128;
+#ifndef CONFIG_IDF_TARGET_ESP32S3
+	clk_cfg.clk_src = I2S_CLK_SRC_APLL;
+#endif
+
+	return clk_cfg;
+}
+
+/****************************************************************************************
+ * Create I2S channel from i2s_config, with DMA buffers we fill ourselves
+ */
+static esp_err_t i2s_create(i2s_pin_config_t *pin) {
+	size_t slot_bytes = i2s_config.bits_per_sample / 8 * 2;
+	i2s_chan_config_t chan_cfg = I2S_CHANNEL_DEFAULT_CONFIG(CONFIG_I2S_NUM, I2S_ROLE_MASTER);
+	i2s_std_config_t std_cfg = {
+		.clk_cfg = i2s_clock(i2s_config.sample_rate),
+		.slot_cfg = I2S_STD_PHILIPS_SLOT_DEFAULT_CONFIG((i2s_data_bit_width_t) i2s_config.bits_per_sample, I2S_SLOT_MODE_STEREO),
+		.gpio_cfg = { .mclk = pin->mck_io_num, .bclk = pin->bck_io_num, .ws = pin->ws_io_num, 
+					  .dout = pin->data_out_num, .din = I2S_GPIO_UNUSED },
+	};
+	i2s_event_callbacks_t callbacks = { .on_sent = dma_sent };
+	esp_err_t res;
+
+	// driver would shrink DMA buffers above that size, so do it here to know their length
+	i2s_config.dma_buf_len = min(i2s_config.dma_buf_len, DMA_BUF_MAX_SIZE / slot_bytes);
+	chan_cfg.dma_desc_num = i2s_config.dma_buf_count;
+	chan_cfg.dma_frame_num = i2s_config.dma_buf_len;
+	// buffers are cleared in dma_sent, before they are handed back to us
+	chan_cfg.auto_clear = false;
+
+	// in SPDIF, each audio frame uses two 32 bits stereo DMA frames
+	dma.count = i2s_config.dma_buf_count;
+	dma.bytes = spdif.enabled ? 16 : slot_bytes;
+	dma.frames = i2s_config.dma_buf_len * slot_bytes / dma.bytes;
+	dma.staged = dma.bytes != BYTES_PER_FRAME;
+	dma.rate = i2s_config.sample_rate;
+	dma.free = xQueueCreate(dma.count * 2, sizeof(u8_t*));
+
+	res = i2s_new_channel(&chan_cfg, &dma.chan, NULL);
+	if (res == ESP_OK) res = i2s_channel_init_std_mode(dma.chan, &std_cfg);
+	if (res == ESP_OK) res = i2s_channel_register_event_callback(dma.chan, &callbacks, NULL);
+
+	return res;
+}
+
+/****************************************************************************************
+ * Start DMA with silence in all buffers, they are handed back as they are played
+ */
+static void dma_start(void) {
+	size_t loaded;
+
+	// preload begins with first buffer and loads nothing once they are all full
+	do {
+		loaded = 0;
+		i2s_channel_preload_data(dma.chan, silencebuf, MAX_SILENCE_FRAMES * BYTES_PER_FRAME, &loaded);
+	} while (loaded);
+
+	xQueueReset(dma.free);
+	dma.buf = NULL;
+	dma.offset = 0;
+	dma.sent.seq = 0;
+	dma.started = esp_timer_get_time();
+	i2s_channel_enable(dma.chan);
+}
+
+static void dma_stop(void) {
+	i2s_channel_disable(dma.chan);
+	dma.buf = NULL;
+	dma.offset = 0;
+}
+
+/****************************************************************************************
+ * Buffer being filled or wait for a played one to refill. As dma_sent may take back the
+ * buffer being filled at any time, dma.buf must only be read once through this
+ */
+static u8_t *dma_acquire(void) {
+	u8_t *buf = dma.buf;
+	if (buf) return buf;
+	
+	// more buffers than DMA has means we missed a full round and some are duplicated
+	if (uxQueueMessagesWaiting(dma.free) > dma.count) xQueueReset(dma.free);
+	xQueueReceive(dma.free, (void*) &buf, portMAX_DELAY);
+	dma.offset = 0;
+	dma.buf = buf;
+
+	return buf;
+}
+
+static void dma_advance(u8_t *buf, frames_t frames) {
+	// what has been written in a buffer taken back by dma_sent is lost
+	if (buf != dma.buf) return;
+	dma.offset += frames;
+	if (dma.offset == dma.frames) dma.buf = NULL;
+}
+
+/****************************************************************************************
+ * Convert (or copy) packed samples into DMA buffers, waiting for them as needed
+ */
+static void dma_write(u8_t *src, frames_t frames) {
+	while (frames) {
+		u8_t *buf = dma_acquire();
+		frames_t chunk = min(frames, dma.frames - dma.offset);
+		u8_t *dst = buf + dma.offset * dma.bytes;
+
+		if (spdif.enabled) {
+			spdif_convert((ISAMPLE_T*) src, chunk, (u32_t*) dst);
+#if BYTES_PER_FRAME == 4
+		} else if (dma.staged) {
+			// 16 bits samples in 32 bits slots, MSB aligned
+			for (s16_t *s = (s16_t*) src, *end = s + chunk * 2; s < end; dst += 4) *(u32_t*) dst = (u32_t) *s++ << 16;
+#endif
+		} else {
+			memcpy(dst, src, chunk * BYTES_PER_FRAME);
+		}
+
+		src += chunk * BYTES_PER_FRAME;
+		frames -= chunk;
+		dma_advance(buf, chunk);
+	}
+}
+
+/****************************************************************************************
+ * Frames of the buffer being played that have been played at a given time (us)
+ */
+static frames_t dma_played(u32_t now) {
+	u32_t seq = dma.sent.seq, start = dma.started;
+
+	if (seq) {
+		u32_t period = (u64_t) dma.frames * 1000000 / dma.rate;
+		start = dma.sent.time[(seq - 1) % DMA_RING];
+		// timestamps are only late, so project the previous ones and keep the earliest
+		for (u32_t n = 2; n <= min(seq, DMA_RING_FIT); n++) {
+			u32_t projected = dma.sent.time[(seq - n) % DMA_RING] + (n - 1) * period;
+			if ((s32_t) (projected - start) < 0) start = projected;
+		}
+	}
+
+	if ((s32_t) (now - start) <= 0) return 0;
+	return min((u64_t) (now - start) * dma.rate / 1000000, dma.frames);
+}
+
+/****************************************************************************************
+ * Frames written to DMA and not played yet at a given time (us)
+ */
+static frames_t dma_queued(u32_t now) {
+	// when starting, all buffers are preloaded with silence that will be played first
+	if (!isI2SStarted) return dma.count * dma.frames;
+
+	// once filled (or taken back), a buffer is pending and offset is stale
+	u8_t *buf = dma.buf;
+	frames_t offset = buf ? dma.offset : 0;
+	int pending = dma.count - uxQueueMessagesWaiting(dma.free) - (buf ? 1 : 0);
+	if (pending <= 0) return offset;
+
+	// first pending buffer is the one being played
+	return pending * dma.frames + offset - dma_played(now);
+}
+
 /****************************************************************************************
  * Main output thread
  */
 static void output_thread_i2s(void *arg) {
-	size_t bytes;
-	frames_t iframes = FRAME_BLOCK;
-	uint32_t timer_start = 0;
+	frames_t iframes = FRAME_BLOCK, frames;
+	uint32_t timer_start = 0, eq_start = 0;
 	int discard = 0;
-	uint32_t fullness = gettime_ms();
-	bool synced;
+	bool synced, direct;
+	u8_t *dbuf = NULL;
 	output_state state = OUTPUT_OFF - 1;
         
 	while (running) {
+
+		// pack directly in DMA when possible, a played buffer paces the loop then
+		direct = !dma.staged && !discard && isI2SStarted;
+		if (direct) dbuf = dma_acquire();
 			
 		TIME_MEASUREMENT_START(timer_start);
 
@@ -557,7 +767,7 @@ static void output_thread_i2s(void *arg) {
 			UNLOCK;
 			if (isI2SStarted) {
 				isI2SStarted = false;
-				i2s_stop(CONFIG_I2S_NUM);
+				dma_stop();
 				adac->power(ADAC_STANDBY);
 			}
 			usleep(100000);
@@ -567,16 +777,19 @@ static void output_thread_i2s(void *arg) {
 		}
 					
 		oframes = 0;
-		output.updated = gettime_ms();
+		optr = direct ? dbuf + dma.offset * BYTES_PER_FRAME : obuf;
+		frames = direct ? min(iframes, dma.frames - dma.offset) : iframes;
+		// position is taken at the exact ms boundary that we report
+		u64_t now = esp_timer_get_time();
+		output.updated = now / 1000;
 		output.frames_played_dmp = output.frames_played;
-		// try to estimate how much we have consumed from the DMA buffer (calculation is incorrect at the very beginning ...)
-		output.device_frames = dma_buf_frames - ((output.updated - fullness) * output.current_sample_rate) / 1000;
-        // we'll try to produce iframes if we have any, but we might return less if outpuf does not have enough
-		_output_frames( iframes );
+		output.device_frames = dma_queued(now - now % 1000);
+        // we'll try to produce frames if we have any, but we might return less if outpuf does not have enough
+		_output_frames( frames );
 		// oframes must be a global updated by the write callback
 		output.frames_in_process = oframes;
               						
-		SET_MIN_MAX_SIZED(oframes,rec,iframes);
+		SET_MIN_MAX_SIZED(oframes,rec,frames);
 		SET_MIN_MAX_SIZED(_buf_used(outputbuf),o,outputbuf->size);
 		SET_MIN_MAX_SIZED(_buf_used(streambuf),s,streambuf->size);
 		SET_MIN_MAX( TIME_MEASUREMENT_GET(timer_start),buffering);
@@ -602,13 +815,12 @@ static void output_thread_i2s(void *arg) {
 		if (!isI2SStarted ) {
 			isI2SStarted = true;
 			LOG_INFO("Restarting I2S.");
-			i2s_zero_dma_buffer(CONFIG_I2S_NUM);
-			i2s_start(CONFIG_I2S_NUM);
+			dma_start();
 			adac->power(ADAC_ON);	
-            if (spdif.enabled) spdif_convert(NULL, 0, NULL);
+            if (spdif.enabled) spdif_reset(output.current_sample_rate, spdif.bits);
 		} 
 
-		// this does not work well as set_sample_rates resets the fifos (and it's too early)
+		// this does not work well as DMA is restarted (and it's too early)
 		if (i2s_config.sample_rate != output.current_sample_rate) {
 			LOG_INFO("changing sampling rate %u to %u", i2s_config.sample_rate, output.current_sample_rate);
 			if (synced) {
@@ -618,47 +830,37 @@ static void output_thread_i2s(void *arg) {
 				discard = DMA_BUF_COUNT * DMA_BUF_LEN * BYTES_PER_FRAME;
 			*/		
 			}	
+			// what we just packed in DMA would be cleared by restart
+			if (direct) {
+				memcpy(obuf, optr, oframes * BYTES_PER_FRAME);
+				optr = obuf;
+				direct = false;
+			}
 			i2s_config.sample_rate = output.current_sample_rate;
-			i2s_set_sample_rates(CONFIG_I2S_NUM, spdif.enabled ? i2s_config.sample_rate * 2 : i2s_config.sample_rate);
-			i2s_zero_dma_buffer(CONFIG_I2S_NUM);
+			i2s_std_clk_config_t clk_cfg = i2s_clock(i2s_config.sample_rate);
+			dma_stop();
+			i2s_channel_reconfig_std_clock(dma.chan, &clk_cfg);
+			dma.rate = i2s_config.sample_rate;
+			dma_start();
+			// new rate code in channel status
+			if (spdif.enabled) spdif_reset(output.current_sample_rate, spdif.bits);
 
             equalizer_set_samplerate(output.current_sample_rate);
 		}
 		
 		// run equalizer
-		equalizer_process(obuf, oframes * BYTES_PER_FRAME);
+		TIME_MEASUREMENT_START(eq_start);
+		equalizer_process(optr, oframes * BYTES_PER_FRAME);
+		SET_MIN_MAX(TIME_MEASUREMENT_GET(eq_start), eq_time);
 
-		// we assume that here we have been able to entirely fill the DMA buffers
-		if (spdif.enabled) {
-			size_t obytes, count = 0;
-			bytes = 0;
-			// need IRAM for speed but can't allocate a FRAME_BLOCK * 16, so process by smaller chunks
-			while (count < oframes) {
-				size_t chunk = min(SPDIF_BLOCK, oframes - count);
-                spdif_convert((ISAMPLE_T*) obuf + count * 2, chunk, (u32_t*) spdif.buf);              
-				i2s_write(CONFIG_I2S_NUM, spdif.buf, chunk * 16, &obytes, portMAX_DELAY);
-				bytes += obytes / (16 / BYTES_PER_FRAME);
-				count += chunk;
-			}
-#if BYTES_PER_FRAME == 4		
-		} else if (i2s_config.bits_per_sample == 32) {  
-			i2s_write_expand(CONFIG_I2S_NUM, obuf, oframes * BYTES_PER_FRAME, 16, 32, &bytes, portMAX_DELAY);
-#endif			
-		} else {
-			i2s_write(CONFIG_I2S_NUM, obuf, oframes * BYTES_PER_FRAME, &bytes, portMAX_DELAY);
-		}
+		// samples are already in DMA or must be converted there
+		if (direct) dma_advance(dbuf, oframes);
+		else dma_write(obuf, oframes);
 
-		fullness = gettime_ms();
-
-		if (bytes != oframes * BYTES_PER_FRAME) {
-			LOG_WARN("I2S DMA Overflow! available bytes: %d, I2S wrote %d bytes", oframes * BYTES_PER_FRAME, bytes);
-		}
-		
 		SET_MIN_MAX( TIME_MEASUREMENT_GET(timer_start),i2s_time);
 		
 	}
 
-	if (spdif.enabled) free(spdif.buf);
 	ended = true;
 
 	vTaskDelete(NULL);	
@@ -693,130 +895,7 @@ static void i2s_stats(uint32_t now) {
 	LOG_INFO("              ----------+----------+-----------+-----------+  ");
 	LOG_INFO(LINE_MIN_MAX_DURATION_FORMAT,LINE_MIN_MAX_DURATION("Buffering(us)",buffering));
 	LOG_INFO(LINE_MIN_MAX_DURATION_FORMAT,LINE_MIN_MAX_DURATION("i2s tfr(us)",i2s_time));
+	LOG_INFO(LINE_MIN_MAX_DURATION_FORMAT,LINE_MIN_MAX_DURATION("eq(us)",eq_time));
 	LOG_INFO("              ----------+----------+-----------+-----------+");
 	RESET_ALL_MIN_MAX;
 }
-
-/****************************************************************************************
- * SPDIF support
- */
-#define PREAMBLE_B  (0xE8) //11101000
-#define PREAMBLE_M  (0xE2) //11100010
-#define PREAMBLE_W  (0xE4) //11100100
-
-static const u8_t VUCP24[2] = { 0xCC, 0x32 };
-
-static const u16_t spdif_bmclookup[256] = {
-	0xcccc, 0xb333, 0xd333, 0xaccc, 0xcb33, 0xb4cc, 0xd4cc, 0xab33, 
-	0xcd33, 0xb2cc, 0xd2cc, 0xad33, 0xcacc, 0xb533, 0xd533, 0xaacc, 
-	0xccb3, 0xb34c, 0xd34c, 0xacb3, 0xcb4c, 0xb4b3, 0xd4b3, 0xab4c, 
-	0xcd4c, 0xb2b3, 0xd2b3, 0xad4c, 0xcab3, 0xb54c, 0xd54c, 0xaab3, 
-	0xccd3, 0xb32c, 0xd32c, 0xacd3, 0xcb2c, 0xb4d3, 0xd4d3, 0xab2c, 
-	0xcd2c, 0xb2d3, 0xd2d3, 0xad2c, 0xcad3, 0xb52c, 0xd52c, 0xaad3, 
-	0xccac, 0xb353, 0xd353, 0xacac, 0xcb53, 0xb4ac, 0xd4ac, 0xab53, 
-	0xcd53, 0xb2ac, 0xd2ac, 0xad53, 0xcaac, 0xb553, 0xd553, 0xaaac, 
-	0xcccb, 0xb334, 0xd334, 0xaccb, 0xcb34, 0xb4cb, 0xd4cb, 0xab34, 
-	0xcd34, 0xb2cb, 0xd2cb, 0xad34, 0xcacb, 0xb534, 0xd534, 0xaacb, 
-	0xccb4, 0xb34b, 0xd34b, 0xacb4, 0xcb4b, 0xb4b4, 0xd4b4, 0xab4b, 
-	0xcd4b, 0xb2b4, 0xd2b4, 0xad4b, 0xcab4, 0xb54b, 0xd54b, 0xaab4, 
-	0xccd4, 0xb32b, 0xd32b, 0xacd4, 0xcb2b, 0xb4d4, 0xd4d4, 0xab2b, 
-	0xcd2b, 0xb2d4, 0xd2d4, 0xad2b, 0xcad4, 0xb52b, 0xd52b, 0xaad4, 
-	0xccab, 0xb354, 0xd354, 0xacab, 0xcb54, 0xb4ab, 0xd4ab, 0xab54, 
-	0xcd54, 0xb2ab, 0xd2ab, 0xad54, 0xcaab, 0xb554, 0xd554, 0xaaab, 
-	0xcccd, 0xb332, 0xd332, 0xaccd, 0xcb32, 0xb4cd, 0xd4cd, 0xab32, 
-	0xcd32, 0xb2cd, 0xd2cd, 0xad32, 0xcacd, 0xb532, 0xd532, 0xaacd, 
-	0xccb2, 0xb34d, 0xd34d, 0xacb2, 0xcb4d, 0xb4b2, 0xd4b2, 0xab4d, 
-	0xcd4d, 0xb2b2, 0xd2b2, 0xad4d, 0xcab2, 0xb54d, 0xd54d, 0xaab2, 
-	0xccd2, 0xb32d, 0xd32d, 0xacd2, 0xcb2d, 0xb4d2, 0xd4d2, 0xab2d, 
-	0xcd2d, 0xb2d2, 0xd2d2, 0xad2d, 0xcad2, 0xb52d, 0xd52d, 0xaad2, 
-	0xccad, 0xb352, 0xd352, 0xacad, 0xcb52, 0xb4ad, 0xd4ad, 0xab52, 
-	0xcd52, 0xb2ad, 0xd2ad, 0xad52, 0xcaad, 0xb552, 0xd552, 0xaaad, 
-	0xccca, 0xb335, 0xd335, 0xacca, 0xcb35, 0xb4ca, 0xd4ca, 0xab35, 
-	0xcd35, 0xb2ca, 0xd2ca, 0xad35, 0xcaca, 0xb535, 0xd535, 0xaaca, 
-	0xccb5, 0xb34a, 0xd34a, 0xacb5, 0xcb4a, 0xb4b5, 0xd4b5, 0xab4a, 
-	0xcd4a, 0xb2b5, 0xd2b5, 0xad4a, 0xcab5, 0xb54a, 0xd54a, 0xaab5, 
-	0xccd5, 0xb32a, 0xd32a, 0xacd5, 0xcb2a, 0xb4d5, 0xd4d5, 0xab2a, 
-	0xcd2a, 0xb2d5, 0xd2d5, 0xad2a, 0xcad5, 0xb52a, 0xd52a, 0xaad5, 
-	0xccaa, 0xb355, 0xd355, 0xacaa, 0xcb55, 0xb4aa, 0xd4aa, 0xab55, 
-	0xcd55, 0xb2aa, 0xd2aa, 0xad55, 0xcaaa, 0xb555, 0xd555, 0xaaaa	
-};
-
-/* 
- SPDIF is supposed to be (before BMC encoding, from LSB to MSB)				
-    0....  1...   191..  0
-    BLFMRF MLFWRF MLFWRF BLFMRF (B,M,W=preamble-4, L/R=left/Right-24, F=Flags-4)
-    each xLF pattern is 32 bits 
-	PPPP AAAA  SSSS SSSS  SSSS SSSS  SSSS VUCP (P=preamble, A=auxiliary, S=sample-20bits, V=valid, U=user data, C=channel status, P=parity)
- After BMC encoding, each bit becomes 2 hence this becomes a 64 bits word. The parity
- is fixed by changing AAAA bits so that VUPC does not change. Then then trick is to 
- start not with a PPPP sequence but with an VUCP sequence to that the 16 bits samples
- are aligned with a BMC word boundary. Input buffer is left first => LRLR...
- The I2S interface must output first the B/M/W preamble which means that second
- 32 bits words must be first and so must be marked right channel. 
-*/
-static void IRAM_ATTR spdif_convert(ISAMPLE_T *src, size_t frames, u32_t *dst) {
-    static u8_t vu, count;    
-	register u16_t hi, lo;
-#if BYTES_PER_FRAME == 8
-	register u16_t aux;
-#endif
-    
-    // we assume frame == 0 as well...
-    if (!src) {
-        count = 0;
-        vu = VUCP24[0];
-    }
-    
-	while (frames--) {
-		// start with left channel
-#if BYTES_PER_FRAME == 4		
-		hi = spdif_bmclookup[(u8_t)(*src >> 8)];
-		lo = spdif_bmclookup[(u8_t)*src++];
-		if (lo & 1) hi = ~hi;
-
-        if (!count--) {            
-			*dst++ = (vu << 24) | (PREAMBLE_B << 16) | 0xCCCC;
-			count = 191;
-		} else {
-			*dst++ = (vu << 24) | (PREAMBLE_M << 16) | 0xCCCC;
-		}
-#else
-		hi = spdif_bmclookup[(u8_t)(*src >> 24)];
-		lo = spdif_bmclookup[(u8_t)(*src >> 16)];
-		aux = spdif_bmclookup[(u8_t)(*src++ >> 8)];
-		if (aux & 1) lo = ~lo;
-		if (lo & 1) hi = ~hi;
-
-
-        if (!count--) {
-			*dst++ = (vu << 24) | (PREAMBLE_B << 16) | aux;
-			count = 191;
-		} else {
-			*dst++ = (vu << 24) | (PREAMBLE_M << 16) | aux;
-		}
-#endif
-
-        vu = VUCP24[hi & 1];
-		*dst++ = ((u32_t)lo << 16) | hi;
-
-		// then do right channel, no need to check PREAMBLE_B
-#if BYTES_PER_FRAME == 4		
-		hi = spdif_bmclookup[(u8_t)(*src >> 8)];
-		lo = spdif_bmclookup[(u8_t)*src++];
-		if (lo & 1) hi = ~hi;
-
-		*dst++ = (vu << 24) | (PREAMBLE_W << 16) | 0xCCCC;
-#else
-		hi = spdif_bmclookup[(u8_t)(*src >> 24)];
-		lo = spdif_bmclookup[(u8_t)(*src >> 16)];
-		aux = spdif_bmclookup[(u8_t)(*src++ >> 8)];
-		if (aux & 1) lo = ~lo;
-		if (lo & 1) hi = ~hi;
-
-		*dst++ = (vu << 24) | (PREAMBLE_W << 16) | aux;
-#endif
-
-        vu = VUCP24[hi & 1];
-		*dst++ = ((u32_t)lo << 16) | hi;
-	}
-}
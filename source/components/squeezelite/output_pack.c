@@ -414,3 +414,85 @@ void _apply_gain(struct buffer *outputbuf, frames_t count, s32_t gainL, s32_t ga
 	}
 }
 
+
+/* 
+ * Fused crossfade, gain, mono and pack in one pass from outputbuf to an output
+ * buffer. Each combination of crossfade, gain and mono flags is a specialized
+ * kernel so that the per-sample loop has no decision left. Polarity inversion
+ * is already carried by the sign of gainL/gainR. Results are identical to 
+ * _apply_cross + _apply_gain + memcpy, but outputbuf is left untouched.
+ */
+static inline __attribute__((always_inline)) 
+void _pack_kernel(ISAMPLE_T *optr, ISAMPLE_T *iptr, ISAMPLE_T *cptr, frames_t count, s32_t gainL, s32_t gainR,
+				  s32_t cross_gain_in, s32_t cross_gain_out, const bool cross, const bool scale, const u8_t mono) {
+	while (count--) {
+		ISAMPLE_T l = *iptr++, r = *iptr++;
+		
+		if (cross) {
+			l = gain(cross_gain_out, l) + gain(cross_gain_in, *cptr++);
+			r = gain(cross_gain_out, r) + gain(cross_gain_in, *cptr++);
+		}
+		
+		if (mono == (MONO_LEFT | MONO_RIGHT)) {
+			l = r = scale ? (gain(gainL, l) + gain(gainR, r)) / 2 : ((s32_t) l + (s32_t) r) / 2;
+		} else if (mono == MONO_RIGHT) {
+			l = r = scale ? gain(gainR, r) : r;
+		} else if (mono == MONO_LEFT) {
+			l = r = scale ? gain(gainL, l) : l;
+		} else if (scale) {
+			l = gain(gainL, l);
+			r = gain(gainR, r);
+		}	
+		
+		*optr++ = l;
+		*optr++ = r;
+	}
+}
+
+typedef void (*pack_kernel_t)(ISAMPLE_T *optr, ISAMPLE_T *iptr, ISAMPLE_T *cptr, frames_t count, s32_t gainL, s32_t gainR,
+							  s32_t cross_gain_in, s32_t cross_gain_out);
+
+#define PACK_KERNEL(c, s, m) 																				\
+	static void _pack_kernel_##c##s##m(ISAMPLE_T *optr, ISAMPLE_T *iptr, ISAMPLE_T *cptr, frames_t count, 	\
+									   s32_t gainL, s32_t gainR, s32_t cross_gain_in, s32_t cross_gain_out) { 	\
+		_pack_kernel(optr, iptr, cptr, count, gainL, gainR, cross_gain_in, cross_gain_out, c, s, m); 			\
+	}
+	
+#define PACK_KERNELS(c, s) PACK_KERNEL(c, s, 0) PACK_KERNEL(c, s, 1) PACK_KERNEL(c, s, 2) PACK_KERNEL(c, s, 3)
+	
+PACK_KERNELS(0, 0) PACK_KERNELS(0, 1) PACK_KERNELS(1, 0) PACK_KERNELS(1, 1)
+
+#define PACK_ENTRY(c, s) { _pack_kernel_##c##s##0, _pack_kernel_##c##s##1, _pack_kernel_##c##s##2, _pack_kernel_##c##s##3 }
+
+// indexed by [crossfade][gain][flags & (MONO_LEFT | MONO_RIGHT)]
+static const pack_kernel_t pack_kernels[2][2][4] = {
+	{ PACK_ENTRY(0, 0), PACK_ENTRY(0, 1) },
+	{ PACK_ENTRY(1, 0), PACK_ENTRY(1, 1) },
+};
+
+void _apply_and_pack(void *outputptr, struct buffer *outputbuf, frames_t count, s32_t gainL, s32_t gainR, u8_t flags,
+					 s32_t cross_gain_in, s32_t cross_gain_out, ISAMPLE_T **cross_ptr) {
+	ISAMPLE_T *optr = (ISAMPLE_T *)outputptr, *iptr = (ISAMPLE_T *)(void *)outputbuf->readp;
+	bool scale = gainL != FIXED_ONE || gainR != FIXED_ONE;
+	u8_t mono = flags & (MONO_LEFT | MONO_RIGHT);
+	
+	// no crossfade, one single pass (or just a copy)
+	if (!cross_ptr || !*cross_ptr) {
+		if (!scale && !mono) memcpy(optr, iptr, count * BYTES_PER_FRAME);
+		else pack_kernels[0][scale][mono](optr, iptr, NULL, count, gainL, gainR, 0, 0);
+		return;
+	}
+	
+	// crossfade can wrap in outputbuf, so split in contiguous chunks (buffer is a multiple of frames)
+	while (count) {
+		if (*cross_ptr >= (ISAMPLE_T *)outputbuf->wrap) {
+			*cross_ptr -= outputbuf->size / BYTES_PER_FRAME * 2;
+		}
+		frames_t chunk = min(count, ((ISAMPLE_T *)outputbuf->wrap - *cross_ptr) / 2);
+		pack_kernels[1][scale][mono](optr, iptr, *cross_ptr, chunk, gainL, gainR, cross_gain_in, cross_gain_out);
+		*cross_ptr += chunk * 2;
+		optr += chunk * 2;
+		iptr += chunk * 2;
+		count -= chunk;
+	}
+}
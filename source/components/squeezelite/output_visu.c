@@ -22,56 +22,142 @@
 
 #include "squeezelite.h"
 
-#define VISUEXPORT_SIZE	512
+/*
+ The output thread copies each block into a ring that is never locked and 
+ overwrites oldest frames. The position is published with a single store once 
+ frames are in, so the displayer can take a snapshot of the latest frames at 
+ its own pace. The end of the block being written is announced before the copy
+ so that the displayer can detect if the producer lapped it. Rate, gain
+ and running state are published together under a sequence counter. 
+ A snapshot registers as reader before checking running state and close clears
+ running state before waiting for readers to leave, so one of them always sees
+ the other and the ring is never freed while being copied.
+*/
+
+#define VISUEXPORT_SIZE	4096	// must be a power of 2, holds 1.5 times largest FFT
+
+#define LOAD(p)		__atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+#define STORE(p, v)	__atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
 
 EXT_BSS struct visu_export_s visu_export;
 static struct visu_export_s *visu = &visu_export;
 
 static log_level loglevel = lINFO;
 
-void output_visu_export(void *frames, frames_t out_frames, u32_t rate, bool silence, u32_t gain) {
+/****************************************************************************************
+ * Publish metadata, only the output thread writes so no need for a lock
+ */
+static void visu_meta(u32_t rate, u32_t gain, bool running) {
+	if (visu->rate == rate && visu->gain == gain && visu->running == running) return;
 	
+	STORE(visu->seq, visu->seq + 1);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	visu->rate = rate;
+	visu->gain = gain;
+	visu->running = running;
+	STORE(visu->seq, visu->seq + 1);
+}
+
+/****************************************************************************************
+ * Producer, called by the output thread
+ */
+void output_visu_export(void *frames, frames_t out_frames, u32_t rate, bool silence, u32_t gain) {
 	// no data to process
-	if (silence) {
-		visu->running = false;
+	if (silence || !visu->buffer) {
+		visu_meta(visu->rate, visu->gain, false);
 		return;
 	}	
-	
-	// do not block, try to stuff data but wait for consumer to have used them
-	if (!pthread_mutex_trylock(&visu->mutex)) {
-		// don't mix sample rates
-		if (visu->rate != rate) visu->level = 0;
 		
-		// stuff buffer up and wait for consumer to read it (should reset level)
-		if (visu->level < visu->size) {
-			u32_t space = min(visu->size - visu->level, out_frames) * BYTES_PER_FRAME;
-			memcpy(visu->buffer + visu->level, frames, space);
-			
-			visu->level += space / BYTES_PER_FRAME;
-			visu->running = true;
-			visu->rate = rate ? rate : 44100;
-			visu->gain = gain;
-		}
-		
-		// mutex must be released 		
-		pthread_mutex_unlock(&visu->mutex);
-	} 
+	// only the latest frames matter when block is larger than ring
+	u8_t *src = frames;
+	if (out_frames > visu->size) {
+		src += (out_frames - visu->size) * BYTES_PER_FRAME;
+		out_frames = visu->size;
+	}
+	
+	u32_t wpos = visu->wpos, index = wpos & (visu->size - 1);
+	frames_t cont = min(out_frames, visu->size - index);
+	
+	// announce what will be overwritten before doing it
+	__atomic_store_n(&visu->wend, wpos + out_frames, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	
+	memcpy((u8_t*) visu->buffer + index * BYTES_PER_FRAME, src, cont * BYTES_PER_FRAME);
+	memcpy(visu->buffer, src + cont * BYTES_PER_FRAME, (out_frames - cont) * BYTES_PER_FRAME);
+	
+	visu_meta(rate ? rate : 44100, gain, true);
+	STORE(visu->wpos, wpos + out_frames);
+}
+
+/****************************************************************************************
+ * Consumer, copy the latest count frames if at least fresh new frames have been 
+ * exported since cursor (fresh < count means overlap with previous snapshot). Returns 
+ * false when caller shall wait, when true and not running, nothing has been copied
+ */
+static bool visu_snapshot(void *frames, frames_t count, frames_t fresh, u32_t *cursor, struct visu_snapshot_s *meta) {
+	u32_t seq, wpos;
+	
+	// get a consistent copy of metadata
+	do {
+		while ((seq = LOAD(visu->seq)) & 0x01);
+		meta->rate = visu->rate;
+		meta->gain = visu->gain;
+		meta->running = visu->running;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (LOAD(visu->seq) != seq);
+
+	if (!meta->running) return true;
+	
+	wpos = LOAD(visu->wpos);
+	if (wpos - *cursor < fresh) return false;
+	
+	u32_t index = (wpos - count) & (visu->size - 1);
+	frames_t cont = min(count, visu->size - index);
+	
+	memcpy(frames, (u8_t*) visu->buffer + index * BYTES_PER_FRAME, cont * BYTES_PER_FRAME);
+	memcpy((u8_t*) frames + cont * BYTES_PER_FRAME, visu->buffer, (count - cont) * BYTES_PER_FRAME);
+	
+	// producer has (or is) overwriting what we were reading, try next time
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	if (__atomic_load_n(&visu->wend, __ATOMIC_RELAXED) - wpos > visu->size - count) return false;
+	
+	*cursor = wpos;
+	return true;
 }
 
+bool output_visu_snapshot(void *frames, frames_t count, frames_t fresh, u32_t *cursor, struct visu_snapshot_s *meta) {
+	bool done;
+	
+	if (count > visu->size) return false;
+	
+	__atomic_add_fetch(&visu->readers, 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	done = visu_snapshot(frames, count, fresh, cursor, meta);
+	__atomic_sub_fetch(&visu->readers, 1, __ATOMIC_RELEASE);
+	
+	return done;
+}
+
+/****************************************************************************************
+ * Called once output thread has stopped, so we are the only writer
+ */
 void output_visu_close(void) {
-	pthread_mutex_lock(&visu->mutex);
-	visu->running = false;
-	free(visu->buffer);
-	pthread_mutex_unlock(&visu->mutex);
+	void *buffer = visu->buffer;
+	
+	visu_meta(visu->rate, visu->gain, false);
+	
+	// a snapshot that has not seen running cleared might still be copying
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	while (LOAD(visu->readers)) usleep(1000);
+	
+	visu->buffer = NULL;
+	free(buffer);
 }
 
 void output_visu_init(log_level level) {
 	loglevel = level;
-	pthread_mutex_init(&visu->mutex, NULL);
 	visu->size = VISUEXPORT_SIZE;
-	visu->running = false;
 	visu->rate = 44100;
-	visu->buffer = malloc(VISUEXPORT_SIZE * BYTES_PER_FRAME);
+	visu->buffer = calloc(VISUEXPORT_SIZE, BYTES_PER_FRAME);
 	LOG_INFO("Initialize VISUEXPORT %u %u bits samples", VISUEXPORT_SIZE, BYTES_PER_FRAME * 4);
 }
-
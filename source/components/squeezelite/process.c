@@ -54,12 +54,12 @@ static void _write_samples(void) {
 	ISAMPLE_T *iptr   = (ISAMPLE_T *) process.outbuf;
 	unsigned cnt  = 10;
 
-	LOCK_O;
-
+	// decoder is the only producer of outputbuf, no need for the mutex (decode's one we
+	// hold protects from resize/limit between reserve and commit, see buffer.c)
 	while (frames > 0) {
 
-		frames_t f = min(_buf_space(outputbuf), _buf_cont_write(outputbuf)) / BYTES_PER_FRAME;
-		ISAMPLE_T *optr = (ISAMPLE_T*) outputbuf->writep;
+		u8_t *optr;
+		frames_t f = buf_reserve(outputbuf, &optr) / BYTES_PER_FRAME;
 
 		if (f > 0) {
 
@@ -69,26 +69,21 @@ static void _write_samples(void) {
 			
 			frames -= f;
 			
-			_buf_inc_writep(outputbuf, f * BYTES_PER_FRAME);
+			buf_commit(outputbuf, optr, f * BYTES_PER_FRAME);
 			iptr += f * BYTES_PER_FRAME / sizeof(*iptr);
 
 		} else if (cnt--) {
 
 			// there should normally be space in the output buffer, but may need to wait during drain phase
-			UNLOCK_O;
 			usleep(10000);
-			LOCK_O;
 
 		} else {
 
 			// bail out if no space found after 100ms to avoid locking
 			LOG_ERROR("unable to get space in output buffer");
-			UNLOCK_O;
 			return;
 		}
 	}
-
-	UNLOCK_O;
 }
 
 // process samples - called with decode mutex set
@@ -407,9 +407,12 @@ static void process_strm(u8_t *pkt, int len) {
 #if EMBEDDED
 			// not protected so that restore can call synchronously sink handlers
 			if (output.external) decode_restore(output.external);
+			// a sink might still be writing outputbuf, see buffer.c
+			LOCK_D;
 			LOCK_O;
 			output.external = 0;
 			_buf_limit(outputbuf, 0);
+			UNLOCK_D;
 #else
 			LOCK_O;
 #endif
@@ -443,6 +446,7 @@ static void process_cont(u8_t *pkt, int len) {
 			stream.meta_interval = stream.meta_next = cont->metaint;
 		}
 		UNLOCK_S;
+		stream_wake();
 		wake_controller();
 	}
 }
@@ -725,6 +729,7 @@ static void slimproto_run() {
 					_start_output = true;
 				}
 				// autostart 2 and 3 require cont to be received first
+				if (decode.state == DECODE_RUNNING) decode_wake();
 			}
 			if (decode.state == DECODE_COMPLETE || decode.state == DECODE_ERROR) {
 				if (decode.state == DECODE_COMPLETE) _sendSTMd = true;
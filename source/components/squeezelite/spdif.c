@@ -0,0 +1,190 @@
+/*
+ *  Squeezelite for esp32
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#include "squeezelite.h"
+#include "esp_attr.h"
+#include "spdif.h"
+
+/* 
+ SPDIF is supposed to be (before BMC encoding, from LSB to MSB)				
+    0....  1...   191..  0
+    BLFMRF MLFWRF MLFWRF BLFMRF (B,M,W=preamble-4, L/R=left/Right-24, F=Flags-4)
+    each xLF pattern is 32 bits 
+	PPPP AAAA  SSSS SSSS  SSSS SSSS  SSSS VUCP (P=preamble, A=auxiliary, S=sample-20bits, V=valid, U=user data, C=channel status, P=parity)
+ After BMC encoding, each bit becomes 2 hence this becomes a 64 bits word. The parity
+ is fixed by changing AAAA bits so that VUPC does not change. Then then trick is to 
+ start not with a PPPP sequence but with an VUCP sequence to that the 16 bits samples
+ are aligned with a BMC word boundary. Input buffer is left first => LRLR...
+ The I2S interface must output first the B/M/W preamble which means that second
+ 32 bits words must be first and so must be marked right channel. 
+*/
+
+#define PREAMBLE_B  (0xE8) //11101000
+#define PREAMBLE_M  (0xE2) //11100010
+#define PREAMBLE_W  (0xE4) //11100100
+
+#define SPDIF_BLOCK_FRAMES	192
+
+/* 
+ VUCP in the top byte, BMC encoded with V=U=0, for C=0/1 when previous sub-frame 
+ ended low. When it ended high, it is inverted but P is set so that it always ends 
+ low, which is the even parity that preambles expect (0x32 and 0x34)
+*/
+static const DRAM_ATTR u32_t VUCP24[2] = { 0xCC000000, 0xCA000000 };
+#define VUCP_LEVEL	0xFE000000
+
+// BMC encoding of one byte, starting at level 0 (table is in RAM, not in flash)
+static const DRAM_ATTR u16_t bmc[256] = {
+	0xcccc, 0xb333, 0xd333, 0xaccc, 0xcb33, 0xb4cc, 0xd4cc, 0xab33, 
+	0xcd33, 0xb2cc, 0xd2cc, 0xad33, 0xcacc, 0xb533, 0xd533, 0xaacc, 
+	0xccb3, 0xb34c, 0xd34c, 0xacb3, 0xcb4c, 0xb4b3, 0xd4b3, 0xab4c, 
+	0xcd4c, 0xb2b3, 0xd2b3, 0xad4c, 0xcab3, 0xb54c, 0xd54c, 0xaab3, 
+	0xccd3, 0xb32c, 0xd32c, 0xacd3, 0xcb2c, 0xb4d3, 0xd4d3, 0xab2c, 
+	0xcd2c, 0xb2d3, 0xd2d3, 0xad2c, 0xcad3, 0xb52c, 0xd52c, 0xaad3, 
+	0xccac, 0xb353, 0xd353, 0xacac, 0xcb53, 0xb4ac, 0xd4ac, 0xab53, 
+	0xcd53, 0xb2ac, 0xd2ac, 0xad53, 0xcaac, 0xb553, 0xd553, 0xaaac, 
+	0xcccb, 0xb334, 0xd334, 0xaccb, 0xcb34, 0xb4cb, 0xd4cb, 0xab34, 
+	0xcd34, 0xb2cb, 0xd2cb, 0xad34, 0xcacb, 0xb534, 0xd534, 0xaacb, 
+	0xccb4, 0xb34b, 0xd34b, 0xacb4, 0xcb4b, 0xb4b4, 0xd4b4, 0xab4b, 
+	0xcd4b, 0xb2b4, 0xd2b4, 0xad4b, 0xcab4, 0xb54b, 0xd54b, 0xaab4, 
+	0xccd4, 0xb32b, 0xd32b, 0xacd4, 0xcb2b, 0xb4d4, 0xd4d4, 0xab2b, 
+	0xcd2b, 0xb2d4, 0xd2d4, 0xad2b, 0xcad4, 0xb52b, 0xd52b, 0xaad4, 
+	0xccab, 0xb354, 0xd354, 0xacab, 0xcb54, 0xb4ab, 0xd4ab, 0xab54, 
+	0xcd54, 0xb2ab, 0xd2ab, 0xad54, 0xcaab, 0xb554, 0xd554, 0xaaab, 
+	0xcccd, 0xb332, 0xd332, 0xaccd, 0xcb32, 0xb4cd, 0xd4cd, 0xab32, 
+	0xcd32, 0xb2cd, 0xd2cd, 0xad32, 0xcacd, 0xb532, 0xd532, 0xaacd, 
+	0xccb2, 0xb34d, 0xd34d, 0xacb2, 0xcb4d, 0xb4b2, 0xd4b2, 0xab4d, 
+	0xcd4d, 0xb2b2, 0xd2b2, 0xad4d, 0xcab2, 0xb54d, 0xd54d, 0xaab2, 
+	0xccd2, 0xb32d, 0xd32d, 0xacd2, 0xcb2d, 0xb4d2, 0xd4d2, 0xab2d, 
+	0xcd2d, 0xb2d2, 0xd2d2, 0xad2d, 0xcad2, 0xb52d, 0xd52d, 0xaad2, 
+	0xccad, 0xb352, 0xd352, 0xacad, 0xcb52, 0xb4ad, 0xd4ad, 0xab52, 
+	0xcd52, 0xb2ad, 0xd2ad, 0xad52, 0xcaad, 0xb552, 0xd552, 0xaaad, 
+	0xccca, 0xb335, 0xd335, 0xacca, 0xcb35, 0xb4ca, 0xd4ca, 0xab35, 
+	0xcd35, 0xb2ca, 0xd2ca, 0xad35, 0xcaca, 0xb535, 0xd535, 0xaaca, 
+	0xccb5, 0xb34a, 0xd34a, 0xacb5, 0xcb4a, 0xb4b5, 0xd4b5, 0xab4a, 
+	0xcd4a, 0xb2b5, 0xd2b5, 0xad4a, 0xcab5, 0xb54a, 0xd54a, 0xaab5, 
+	0xccd5, 0xb32a, 0xd32a, 0xacd5, 0xcb2a, 0xb4d5, 0xd4d5, 0xab2a, 
+	0xcd2a, 0xb2d5, 0xd2d5, 0xad2a, 0xcad5, 0xb52a, 0xd52a, 0xaad5, 
+	0xccaa, 0xb355, 0xd355, 0xacaa, 0xcb55, 0xb4aa, 0xd4aa, 0xab55, 
+	0xcd55, 0xb2aa, 0xd2aa, 0xad55, 0xcaaa, 0xb555, 0xd555, 0xaaaa	
+};
+
+static struct {
+	u32_t level, count;		// level at which last sub-frame ended, frames left in block
+	u32_t mask;				// drops sample bits beyond word length
+	u8_t status[SPDIF_BLOCK_FRAMES / 8];
+	u8_t until[SPDIF_BLOCK_FRAMES];	// first frame after n where channel status bit changes
+} spdif;
+
+#define STATUS(n) ((spdif.status[(n) >> 3] >> ((n) & 7)) & 1)
+
+/****************************************************************************************
+ * Encode one sample with the header (VUCP and preamble) for the level the previous 
+ * sub-frame ended at, the header of next sub-frame depends on where this one ends
+ */
+#if BYTES_PER_FRAME == 4
+#define ENCODE(sample, header) do {									\
+	u32_t hi = bmc[(u8_t) ((sample) >> 8)], lo = bmc[(u8_t) (sample)];	\
+	hi ^= -(lo & 1) & 0xffff;										\
+	*dst++ = (header) ^ level;										\
+	*dst++ = (lo << 16) | hi;										\
+	level = -(hi & 1) & VUCP_LEVEL;								\
+} while (0)
+#else
+#define ENCODE(sample, header) do {									\
+	u32_t s = (sample) & mask;										\
+	u32_t hi = bmc[(u8_t) (s >> 24)], lo = bmc[(u8_t) (s >> 16)], aux = bmc[(u8_t) (s >> 8)];	\
+	lo ^= -(aux & 1) & 0xffff;										\
+	hi ^= -(lo & 1) & 0xffff;										\
+	*dst++ = ((header) ^ level) | aux;							\
+	*dst++ = (lo << 16) | hi;										\
+	level = -(hi & 1) & VUCP_LEVEL;								\
+} while (0)
+#endif
+
+#if BYTES_PER_FRAME == 4
+#define HEADER(preamble, c) (VUCP24[c] | ((preamble) << 16) | 0xCCCC)
+#else
+#define HEADER(preamble, c) (VUCP24[c] | ((preamble) << 16))
+#endif
+
+/****************************************************************************************
+ * Restart at block boundary with a consumer channel status (IEC 60958-3) for that format
+ */
+void spdif_reset(u32_t sample_rate, u8_t bits) {
+	static const struct { u32_t rate; u8_t code; } rates[] = {
+		{ 44100, 0x0 }, { 48000, 0x2 }, { 32000, 0x3 }, { 22050, 0x4 }, { 24000, 0x6 },
+		{ 88200, 0x8 }, { 96000, 0xa }, { 176400, 0xc }, { 192000, 0xe }, { 0, 0x1 },
+	};
+	int i;
+
+	// 24 bits uses the auxiliary bits, so it's only possible with 32 bits samples
+	if (BYTES_PER_FRAME == 4 || bits != 24) bits = 16;
+	for (i = 0; rates[i].rate && rates[i].rate != sample_rate; i++);
+
+	memset(spdif.status, 0, sizeof(spdif.status));
+	// consumer, PCM, copy permitted, no pre-emphasis, 2 channels
+	spdif.status[0] = 0x04;
+	// sample frequency in bits 24..27, clock accuracy level II
+	spdif.status[3] = rates[i].code;
+	// max word length 20 bits and 16 bits used, or max 24 bits and 24 bits used
+	spdif.status[4] = bits == 24 ? 0x0b : 0x02;
+
+	// channel status is mostly constant, so encode by runs where it is
+	for (int n = SPDIF_BLOCK_FRAMES - 1; n >= 0; n--) {
+		bool last = n == SPDIF_BLOCK_FRAMES - 1 || STATUS(n) != STATUS(n + 1);
+		spdif.until[n] = last ? n + 1 : spdif.until[n + 1];
+	}
+
+	spdif.mask = bits == 24 ? 0xffffff00 : 0xffff0000;
+	spdif.level = 0;
+	spdif.count = 0;
+}
+
+/****************************************************************************************
+ * Convert frames to SPDIF sub-frames (4 x 32 bits per frame)
+ */
+void IRAM_ATTR spdif_convert(ISAMPLE_T *src, size_t frames, u32_t *dst) {
+	// locals can't be aliased by dst so they stay in registers
+	u32_t level = -spdif.level & VUCP_LEVEL;
+#if BYTES_PER_FRAME == 8
+	u32_t mask = spdif.mask;
+#endif
+
+	// process by runs where channel status does not change, so only first frame of a run 
+	// tests for B and uses the previous C bit, the others use the same pair of headers
+	while (frames) {
+		u32_t preamble = PREAMBLE_M;
+
+		if (!spdif.count) {
+			preamble = PREAMBLE_B;
+			spdif.count = SPDIF_BLOCK_FRAMES;
+		}
+
+		// n is the frame index in block, VUCP in left header belongs to previous right sub-frame
+		u32_t n = SPDIF_BLOCK_FRAMES - spdif.count, c = STATUS(n);
+		size_t run = min(frames, spdif.until[n] - n);
+		u32_t first = HEADER(preamble, STATUS((n + SPDIF_BLOCK_FRAMES - 1) % SPDIF_BLOCK_FRAMES));
+		u32_t left = HEADER(PREAMBLE_M, c), right = HEADER(PREAMBLE_W, c);
+
+		frames -= run;
+		spdif.count -= run;
+
+		ENCODE(src[0], first);
+		ENCODE(src[1], right);
+		src += 2;
+
+		while (--run) {
+			ENCODE(src[0], left);
+			ENCODE(src[1], right);
+			src += 2;
+		}
+	}
+
+	spdif.level = level != 0;
+}
@@ -0,0 +1,12 @@
+/*
+ *  Squeezelite for esp32
+ *
+ *  This software is released under the MIT License.
+ *  https://opensource.org/licenses/MIT
+ *
+ */
+
+#pragma once
+
+void spdif_reset(u32_t sample_rate, u8_t bits);
+void spdif_convert(ISAMPLE_T *src, size_t frames, u32_t *dst);
@@ -528,15 +528,18 @@ void touch_memory(u8_t *buf, size_t size);
 #endif
 
 // buffer.c
+#define BUF_CACHE_LINE	64
+
 struct buffer {
 	u8_t *buf;
-	u8_t *readp;
-	u8_t *writep;
 	u8_t *wrap;
 	size_t size;
 	size_t base_size;
 	size_t true_size;
 	mutex_type mutex;
+	// consumer and producer positions, each on its own cache line
+	u8_t *readp __attribute__((aligned(BUF_CACHE_LINE)));
+	u8_t *writep __attribute__((aligned(BUF_CACHE_LINE)));
 };
 
 // _* called with mutex locked
@@ -555,6 +558,26 @@ size_t _buf_limit(struct buffer *buf, size_t limit);
 void buf_init(struct buffer *buf, size_t size);
 void buf_destroy(struct buffer *buf);
 
+// single producer spans, no mutex needed
+size_t buf_reserve(struct buffer *buf, u8_t **ptr);
+bool buf_commit(struct buffer *buf, u8_t *ptr, size_t by);
+
+// wake-up of a thread waiting on buffer watermarks, a signal is latched until consumed
+struct notify {
+#if WIN
+	HANDLE event;
+#else
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	bool pending;
+#endif
+};
+
+void notify_init(struct notify *notify);
+void notify_signal(struct notify *notify);
+bool notify_wait(struct notify *notify, u32_t timeout);
+void notify_destroy(struct notify *notify);
+
 // slimproto.c
 void slimproto(log_level level, char *server, u8_t mac[6], const char *name, const char *namefile, const char *modelname, int maxSampleRate);
 void slimproto_stop(void);
@@ -587,6 +610,8 @@ void stream_close(void);
 void stream_file(const char *header, size_t header_len, unsigned threshold);
 void stream_sock(u32_t ip, u16_t port, bool use_ssl, bool use_ogg, const char *header, size_t header_len, unsigned threshold, bool cont_wait);
 bool stream_disconnect(void);
+void stream_wake(void);
+void stream_wake_space(size_t before, size_t after);
 
 // decode.c
 typedef enum { DECODE_STOPPED = 0, DECODE_READY, DECODE_RUNNING, DECODE_COMPLETE, DECODE_ERROR } decode_state;
@@ -595,6 +620,7 @@ struct decodestate {
 	decode_state state;
 	bool new_stream;
 	mutex_type mutex;
+	unsigned min_bytes, min_space;	// watermarks the decoder waits for
 #if PROCESS
 	bool direct;
 	bool process;
@@ -626,6 +652,9 @@ void decode_close(void);
 void decode_flush(bool close);
 unsigned decode_newstream(unsigned sample_rate, unsigned supported_rates[]);
 void codec_open(u8_t format, u8_t sample_size, u8_t sample_rate, u8_t channels, u8_t endianness);
+void decode_wake(void);
+void decode_wake_bytes(size_t before, size_t after);
+void decode_wake_space(size_t before, size_t after);
 
 #if PROCESS
 // process.c
@@ -768,6 +797,8 @@ void output_close_stdout(void);
 void _scale_and_pack_frames(void *outputptr, s32_t *inputptr, frames_t cnt, s32_t gainL, s32_t gainR, u8_t flags, output_format format);
 void _apply_cross(struct buffer *outputbuf, frames_t out_frames, s32_t cross_gain_in, s32_t cross_gain_out, ISAMPLE_T **cross_ptr);
 void _apply_gain(struct buffer *outputbuf, frames_t count, s32_t gainL, s32_t gainR, u8_t flags);
+void _apply_and_pack(void *outputptr, struct buffer *outputbuf, frames_t count, s32_t gainL, s32_t gainR, u8_t flags,
+					 s32_t cross_gain_in, s32_t cross_gain_out, ISAMPLE_T **cross_ptr);
 s32_t gain(s32_t gain, s32_t sample);
 s32_t to_gain(float f);
 
@@ -58,6 +58,11 @@ is enough and much faster than a mutex
 */
 static bool polling;
 static sockfd fd;
+static struct notify wake;
+
+// stream thread waits for a new connection or for the decoder to free that much
+#define STREAM_WAKE_SPACE	(16 * 1024)
+#define STREAM_WAIT_MS		500
 
 struct EXT_RAM_ATTR streamstate stream;
 
@@ -176,6 +181,8 @@ static void _disconnect(stream_state state, disconnect_code disconnect) {
 	closesocket(fd);
 	fd = -1;
 	wake_controller();
+	// decoder can now consume what is left below its watermark
+	decode_wake();
 }
 
 static size_t memfind(const u8_t* haystack, size_t n, const char* needle, size_t len, size_t* offset) {
@@ -324,7 +331,7 @@ static void *stream_thread() {
 
 		if (fd < 0 || !space || stream.state <= STREAMING_WAIT) {
 			UNLOCK;
-			usleep(space ? 100000 : 25000);
+			notify_wait(&wake, STREAM_WAIT_MS);
 			continue;
 		}
 
@@ -338,6 +345,7 @@ static void *stream_thread() {
 			if (n > 0) {
 				_buf_inc_writep(streambuf, n);
 				stream.bytes += n;
+				decode_wake_bytes(_buf_used(streambuf) - n, _buf_used(streambuf));
 				LOG_SDEBUG("streambuf read %d bytes", n);
 			}
 			if (n < 0) {
@@ -497,6 +505,7 @@ static void *stream_thread() {
                         stream_ogg(n);
 						_buf_inc_writep(streambuf, n);
 						stream.bytes += n;
+						decode_wake_bytes(_buf_used(streambuf) - n, _buf_used(streambuf));
 						if (stream.meta_interval) {
 							stream.meta_next -= n;
 						}
@@ -570,6 +579,7 @@ void stream_init(log_level level, unsigned stream_buf_size) {
 	*stream.header = '\0';
 
 	fd = -1;
+	notify_init(&wake);
 
 #if LINUX || FREEBSD
 	touch_memory(streambuf->buf, streambuf->size);
@@ -594,9 +604,11 @@ void stream_close(void) {
 	LOCK;
 	running = false;
 	UNLOCK;
+	notify_signal(&wake);
 #if LINUX || OSX || FREEBSD || EMBEDDED
 	pthread_join(thread, NULL);
 #endif
+	notify_destroy(&wake);
 	free(stream.header);
 	buf_destroy(streambuf);
 }
@@ -635,6 +647,7 @@ void stream_file(const char *header, size_t header_len, unsigned threshold) {
 	stream.threshold = threshold;
 
 	UNLOCK;
+	notify_signal(&wake);
 }
 
 void stream_sock(u32_t ip, u16_t port, bool use_ssl, bool use_ogg, const char *header, size_t header_len, unsigned threshold, bool cont_wait) {
@@ -743,6 +756,22 @@ void stream_sock(u32_t ip, u16_t port, bool use_ssl, bool use_ogg, const char *h
     ogg.serial = ULLONG_MAX;
 
 	UNLOCK;
+	notify_signal(&wake);
+}
+
+/****************************************************************************************
+ * Wake stream thread on state change
+ */
+void stream_wake(void) {
+	notify_signal(&wake);
+}
+
+/****************************************************************************************
+ * Wake stream thread when streambuf space (called with S locked) rises above watermark
+ */
+void stream_wake_space(size_t before, size_t after) {
+	size_t mark = min(STREAM_WAKE_SPACE, streambuf->size / 4);
+	if (before < mark && after >= mark) notify_signal(&wake);
 }
 
 bool stream_disconnect(void) {
@@ -35,6 +35,7 @@
 #include "platform_esp32.h"
 #include "trace.h"
 #include "tools.h"
+#include "task_profile.h"
 static const char TAG[] = "http_server";
 
 EXT_RAM_ATTR static httpd_handle_t _server;
@@ -153,6 +154,7 @@ esp_err_t http_server_start()
 	config.backlog_conn = 1;
     config.uri_match_fn = httpd_uri_match_wildcard;
 	config.task_priority = ESP_TASK_PRIO_MIN;
+	config.core_id = task_profile_core(TASK_WEB, config.core_id);
 	_port = config.server_port;
     //todo:  use the endpoint below to configure session token?
     // config.open_fn
@@ -87,6 +87,7 @@ const DefaultNumVal defaultNumVals[] = {
 const DefaultStringVal defaultStringVals[] = {
     {"equalizer", ""},
     {"loudness", "0"},
+    {"eq_ramp", "50"},
     {"actrls_config", ""},
     {"lms_ctrls_raw", "n"},
     {"rotary_config", CONFIG_ROTARY_ENCODER},
@@ -105,10 +106,13 @@ const DefaultStringVal defaultStringVals[] = {
     {"gpio_exp_config", CONFIG_GPIO_EXP_CONFIG},
     {"bat_config", ""},
     {"metadata_config", ""},
+    {"artwork_cache", "524288"},
     {"telnet_enable", ""},
     {"telnet_buffer", "40000"},
     {"telnet_block", "500"},
     {"stats", "n"},
+    {"task_pinning", ""},
+    {"spectrum_config", ""},
     {"rel_api", CONFIG_RELEASE_API},
     {"pollmx", "600"},
     {"pollmin", "15"},